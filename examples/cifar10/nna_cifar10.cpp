@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "nna_hw.h"
 #include "nna_interface.h"
@@ -101,6 +102,9 @@
 #define CONV4_BIAS_LSHIFT 1
 #define CONV4_OUT_RSHIFT 8
 
+#define BENCH_MAX_BATCH 8
+#define BENCH_ITERATIONS 100
+
 static void* gp_vaddr;
 static void* gp_paddr;
 
@@ -120,6 +124,9 @@ static int16_t conv4_bias[10] = CONV4_BIAS;
 
 static int8_t scratch_buffer[65536];
 
+// Output of the unbatched network, the batch benchmark checks against it
+static int8_t cifar10_result[CONV4_OUT_CH];
+
 static char labels[][13] = {"airplane","automobile","bird","cat","deer","dog","frog","horse","ship","truck"};
 
 /**
@@ -207,6 +214,21 @@ void run_conv(nna_conv_op_desc* conv_op,
   nna_reset();
 }
 
+void run_pool(nna_pdp_op_desc* pdp_op,
+              nna_pdp_surface_desc* pdp_surface) {
+
+  // Perform pooling with input read from memory
+
+  nna_pdp_set_producer(0,0);
+
+  nna_pdp_program(pdp_op,pdp_surface);
+
+  nna_pdp_enable(0,1);
+
+  nna_wait_done(0x10,0x10);
+  nna_reset();
+}
+
 void set_conv(int in_dim,
               int in_c,
               int k_dim,
@@ -348,7 +370,9 @@ void set_bias_relu(int in_dim,
   sdp_op->x1_op.truncate = 0;
 
   sdp_op->x1_op.mode = SDP_OP_PER_KERNEL;
-  sdp_surface->x1_data.address = (uint32_t)(gp_paddr)+bias_offset;
+  sdp_op->x1_op.precision = PRECISION_INT16; // Bias values are int16
+  nna_sdp_operand_cube(&sdp_surface->x1_data, (uint32_t)(gp_paddr)+bias_offset, &sdp_op->x1_op,
+    out_w, out_h, k);
 
   sdp_op->x1_op.act = ACTIVATION_RELU;
 
@@ -406,10 +430,9 @@ void set_bias(int in_dim,
   sdp_op->x1_op.truncate = 0;
 
   sdp_op->x1_op.mode = SDP_OP_PER_KERNEL;
-  sdp_surface->x1_data.address = (uint32_t)(gp_paddr)+bias_offset;
-  // Bias value is int16 so mutliple by 2
-  sdp_surface->x1_data.line_stride = sdp_surface->src_data.line_stride *2;
-  sdp_surface->x1_data.surf_stride = sdp_surface->src_data.height * channelsPerGroup * sdp_surface->src_data.width *2;
+  sdp_op->x1_op.precision = PRECISION_INT16; // Bias values are int16
+  nna_sdp_operand_cube(&sdp_surface->x1_data, (uint32_t)(gp_paddr)+bias_offset, &sdp_op->x1_op,
+    out_w, out_h, k);
 
   // Bypass x2
   sdp_op->x2_op.enable = 0;
@@ -469,6 +492,41 @@ void set_max_pool(int in_dim,
 
 }
 
+void set_batch(int batch,
+               nna_conv_op_desc* conv_op,
+               nna_conv_surface_desc* conv_surface,
+               nna_sdp_op_desc* sdp_op,
+               nna_sdp_surface_desc* sdp_surface) {
+
+  // Run conv and sdp over a batch of cubes stored one after the other, sdp must
+  // write to memory as pdp can't pool a batch on the fly
+  int surfaces = (conv_surface->src_data.channel + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE;
+
+  conv_surface->src_data.size = conv_surface->src_data.surf_stride * surfaces;
+  nna_batch_cube(&conv_surface->src_data, batch);
+
+  conv_op->batch = batch;
+  conv_op->data_bank = calculate_data_bank(conv_op,conv_surface);
+
+  surfaces = (sdp_surface->dst_data.channel + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE;
+  sdp_surface->dst_data.size = sdp_surface->dst_data.surf_stride * surfaces;
+
+  sdp_op->batch_num = batch;
+  sdp_op->batch_stride = nna_batch_cube(&sdp_surface->dst_data, batch) / batch;
+}
+
+void set_pool_batch(int batch,
+                    uint32_t in_offset,
+                    nna_pdp_op_desc* pdp_op,
+                    nna_pdp_surface_desc* pdp_surface) {
+
+  // Cubes of a batch with whole channel groups are contiguous, so they
+  // can be pooled as one cube with batch times the channels
+  pdp_surface->src_data.address = (uint32_t)(gp_paddr)+in_offset;
+  pdp_surface->src_data.channel *= batch;
+  pdp_surface->dst_data.channel *= batch;
+}
+
 void softmax_q7(int8_t *vec_in, uint16_t dim_vec, int8_t *p_out) {
 
   /*, Not your normal softmax as we use power of 2 softmax here, i.e.,:
@@ -698,6 +756,7 @@ void cifar10() {
 
   // Result is 1x1x10 cube
   sunxi_ion_loadout(((uint32_t)gp_paddr)+buf1_offset, CONV4_OUT_DIM*CONV4_OUT_DIM*CONV4_OUT_CH, (char*)scratch_buffer);
+  memcpy(cifar10_result, scratch_buffer, CONV4_OUT_CH);
 
   // Clear some space in scratch buffer for the softmax result starting at
   // position 20
@@ -714,6 +773,124 @@ void cifar10() {
   sunxi_ion_alloc_close();
 }
 
+void cifar10_bench() {
+
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  nna_pdp_op_desc pdp_op;
+  nna_pdp_surface_desc pdp_surface;
+
+  struct timespec start, end;
+
+  printf ("Running %s ...\n", __FUNCTION__);
+
+  sunxi_ion_alloc_open();
+  sunxi_ion_alloc_palloc(0x100000,&gp_vaddr,&gp_paddr);
+
+  // All weights and biases stay loaded so only the network is timed
+  uint32_t  wgt1_offset  = 0x00000;
+  uint32_t  wgt2_offset  = 0x01000;
+  uint32_t  wgt3_offset  = 0x05000;
+  uint32_t  wgt4_offset  = 0x09000;
+  uint32_t  bias1_offset = 0x0C000;
+  uint32_t  bias2_offset = 0x0C100;
+  uint32_t  bias3_offset = 0x0C200;
+  uint32_t  bias4_offset = 0x0C300;
+  uint32_t  buf1_offset  = 0x20000; // temp buffer for input/output data
+  uint32_t  buf2_offset  = 0x80000; // temp buffer for input/output data
+
+  sunxi_ion_loadin((char*)conv1_nhwc_wt, sizeof(conv1_nhwc_wt), ((uint32_t)(gp_paddr)+wgt1_offset));
+  sunxi_ion_loadin((char*)conv2_nhwc_wt, sizeof(conv2_nhwc_wt), ((uint32_t)(gp_paddr)+wgt2_offset));
+  sunxi_ion_loadin((char*)conv3_nhwc_wt, sizeof(conv3_nhwc_wt), ((uint32_t)(gp_paddr)+wgt3_offset));
+  sunxi_ion_loadin((char*)conv4_nhwc_wt, sizeof(conv4_nhwc_wt), ((uint32_t)(gp_paddr)+wgt4_offset));
+  sunxi_ion_loadin((char*)conv1_bias, sizeof(conv1_bias), ((uint32_t)(gp_paddr)+bias1_offset));
+  sunxi_ion_loadin((char*)conv2_bias, sizeof(conv2_bias), ((uint32_t)(gp_paddr)+bias2_offset));
+  sunxi_ion_loadin((char*)conv3_bias, sizeof(conv3_bias), ((uint32_t)(gp_paddr)+bias3_offset));
+  sunxi_ion_loadin((char*)conv4_bias, sizeof(conv4_bias), ((uint32_t)(gp_paddr)+bias4_offset));
+
+  for (int batch=1;batch<=BENCH_MAX_BATCH;batch<<=1) {
+
+    // Every image in the batch is the same so outputs can be checked against the unbatched network
+    for (int n=0;n<batch;n++)
+      sunxi_ion_loadin((char*)image_data, sizeof(image_data), (uint32_t)(gp_paddr)+buf1_offset+n*sizeof(image_data));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i=0;i<BENCH_ITERATIONS;i++) {
+
+      // 1st layer
+      set_conv(CONV1_IM_DIM, CONV1_IM_CH, CONV1_KER_DIM, CONV1_OUT_CH, CONV1_OUT_DIM,
+        CONV1_PADDING, CONV1_STRIDE, buf1_offset, wgt1_offset, &conv_op, &conv_surface);
+      set_bias(CONV1_OUT_DIM, CONV1_OUT_CH, CONV1_OUT_DIM, CONV1_OUT_RSHIFT, CONV1_BIAS_LSHIFT,
+        buf2_offset, bias1_offset, &sdp_op, &sdp_surface);
+      sdp_op.x1_op.act = ACTIVATION_RELU;
+      set_batch(batch, &conv_op, &conv_surface, &sdp_op, &sdp_surface);
+      run_conv(&conv_op, &conv_surface, &sdp_op, &sdp_surface);
+
+      set_max_pool(CONV1_OUT_DIM, POOL1_KER_DIM, CONV1_OUT_CH, POOL1_OUT_DIM, POOL1_PADDING,
+        POOL1_STRIDE, buf1_offset, &pdp_op, &pdp_surface);
+      set_pool_batch(batch, buf2_offset, &pdp_op, &pdp_surface);
+      run_pool(&pdp_op, &pdp_surface);
+
+      // 2nd layer
+      set_conv(CONV2_IM_DIM, CONV2_IM_CH, CONV2_KER_DIM, CONV2_OUT_CH, CONV2_OUT_DIM,
+        CONV2_PADDING, CONV2_STRIDE, buf1_offset, wgt2_offset, &conv_op, &conv_surface);
+      set_bias(CONV2_OUT_DIM, CONV2_OUT_CH, CONV2_OUT_DIM, CONV2_OUT_RSHIFT, CONV2_BIAS_LSHIFT,
+        buf2_offset, bias2_offset, &sdp_op, &sdp_surface);
+      sdp_op.x1_op.act = ACTIVATION_RELU;
+      set_batch(batch, &conv_op, &conv_surface, &sdp_op, &sdp_surface);
+      run_conv(&conv_op, &conv_surface, &sdp_op, &sdp_surface);
+
+      set_max_pool(CONV2_OUT_DIM, POOL2_KER_DIM, CONV2_OUT_CH, POOL2_OUT_DIM, POOL2_PADDING,
+        POOL2_STRIDE, buf1_offset, &pdp_op, &pdp_surface);
+      set_pool_batch(batch, buf2_offset, &pdp_op, &pdp_surface);
+      run_pool(&pdp_op, &pdp_surface);
+
+      // 3rd layer
+      set_conv(CONV3_IM_DIM, CONV3_IM_CH, CONV3_KER_DIM, CONV3_OUT_CH, CONV3_OUT_DIM,
+        CONV3_PADDING, CONV3_STRIDE, buf1_offset, wgt3_offset, &conv_op, &conv_surface);
+      set_bias(CONV3_OUT_DIM, CONV3_OUT_CH, CONV3_OUT_DIM, CONV3_OUT_RSHIFT, CONV3_BIAS_LSHIFT,
+        buf2_offset, bias3_offset, &sdp_op, &sdp_surface);
+      sdp_op.x1_op.act = ACTIVATION_RELU;
+      set_batch(batch, &conv_op, &conv_surface, &sdp_op, &sdp_surface);
+      run_conv(&conv_op, &conv_surface, &sdp_op, &sdp_surface);
+
+      set_max_pool(CONV3_OUT_DIM, POOL3_KER_DIM, CONV3_OUT_CH, POOL3_OUT_DIM, POOL3_PADDING,
+        POOL3_STRIDE, buf1_offset, &pdp_op, &pdp_surface);
+      set_pool_batch(batch, buf2_offset, &pdp_op, &pdp_surface);
+      run_pool(&pdp_op, &pdp_surface);
+
+      // 4th layer
+      set_conv(CONV4_IM_DIM, CONV4_IM_CH, CONV4_KER_DIM, CONV4_OUT_CH, CONV4_OUT_DIM,
+        CONV4_PADDING, CONV4_STRIDE, buf1_offset, wgt4_offset, &conv_op, &conv_surface);
+      set_bias(CONV4_OUT_DIM, CONV4_OUT_CH, CONV4_OUT_DIM, CONV4_OUT_RSHIFT, CONV4_BIAS_LSHIFT,
+        buf2_offset, bias4_offset, &sdp_op, &sdp_surface);
+      set_batch(batch, &conv_op, &conv_surface, &sdp_op, &sdp_surface);
+      run_conv(&conv_op, &conv_surface, &sdp_op, &sdp_surface);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ms = ((end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0) /
+      BENCH_ITERATIONS;
+
+    // Result is a 1x1x10 cube per image, batch_stride apart
+    int mismatch = 0;
+    sunxi_ion_loadout(((uint32_t)gp_paddr)+buf2_offset, batch*sdp_op.batch_stride + CONV4_OUT_CH, (char*)scratch_buffer);
+    for (int n=0;n<batch;n++)
+      mismatch += memcmp(cifar10_result, scratch_buffer+n*sdp_op.batch_stride, CONV4_OUT_CH) != 0;
+
+    printf("batch %d : %8.3f ms per batch %8.1f images/s %s\n", batch, ms, batch * 1000.0 / ms,
+      mismatch ? "MISMATCH with unbatched" : "");
+  }
+
+  sunxi_ion_alloc_free();
+  sunxi_ion_alloc_close();
+}
+
 int main(int argc, char **argv) {
 
   // Set clock to 400Mhz (DDR2 memory speed ??)
@@ -726,7 +903,10 @@ int main(int argc, char **argv) {
   void* r = xreg_open();
   if (r) {
     nna_reset();
+    // The benchmark compares its outputs with the unbatched network
     cifar10();
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+      cifar10_bench();
     xreg_close();
   }
 
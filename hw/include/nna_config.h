@@ -27,5 +27,10 @@
 #define NNA_CBUF_BANK_NUMBER 32
 #define NNA_CBUF_ENTRIES_PER_BANK 512
 #define NNA_CBUF_ENTRY_WIDTH 8
+#define NNA_CBUF_BANK_WEIGHT_SIZE 16384
+#define NNA_PDP_BUFFER_SIZE 7168 // Bytes of PDP line buffer for partially pooled rows
+#define NNA_PDP_MAX_SPLIT_WIDTH 1024 // Widths of a split are 10 bit registers
+#define NNA_PDP_MAX_SPLITS 255 // split_num is 8 bit, the registers take split_num - 1
+#define NNA_SDP_MAX_SHIFT 63 // ALU operand shift_value is a 6 bit field
 
 #endif // NNA_CONFIG_H
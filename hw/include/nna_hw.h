@@ -33,5 +33,8 @@ int nna_on();
 int nna_off();
 void nna_reset();
 int nna_wait_done(int event_mask, int event_value);
+void nna_submit(int event_mask);
+int nna_poll(int event_mask);
+int nna_wait(int event_mask);
 
 #endif // NNA_HW_H
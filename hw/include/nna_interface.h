@@ -24,14 +24,39 @@
 
 #define KERNEL_PER_GROUP 8
 
+/* Input data formats, pixel formats follow the nvdla numbering */
 #define FORMAT_T_R8			             0
+#define FORMAT_T_A8B8G8R8		        12
+#define FORMAT_T_A8R8G8B8		        13
+#define FORMAT_T_B8G8R8A8		        14
+#define FORMAT_T_R8G8B8A8		        15
+#define FORMAT_T_X8B8G8R8		        16
+#define FORMAT_T_X8R8G8B8		        17
+#define FORMAT_T_B8G8R8X8		        18
+#define FORMAT_T_R8G8B8X8		        19
+#define FORMAT_T_A8Y8U8V8		        26
+#define FORMAT_T_V8U8Y8A8		        27
+#define FORMAT_T_Y8___U8V8_N444	        28
+#define FORMAT_T_Y8___V8U8_N444	        29
 #define FORMAT_FEATURE			        36
 
+#define PIXEL_MAPPING_PITCH_LINEAR 0
+
+#define PRECISION_INT8  0
+#define PRECISION_INT16 1
+
 #define MEAN_FORMAT_DISABLE     0
 #define MEAN_FORMAT_ENABLE      1
 
+#define WEIGHT_FORMAT_UNCOMPRESSED 0
+#define WEIGHT_FORMAT_COMPRESSED   1
+
+#define CONV_MODE_DIRECT   0
+#define CONV_MODE_WINOGRAD 1
+
 #define ACTIVATION_NONE   0
 #define ACTIVATION_RELU   1
+#define ACTIVATION_LUT    2
 #define ACTIVATION_PRELU  3
 
 struct nna_cvt_param {
@@ -57,6 +82,8 @@ struct nna_data_cube {
 
   uint32_t line_stride; // For pixel its width, feature its 8 * width (atom_size = 8 ??)
   uint32_t surf_stride; // For pixel its width * height, feature its 8 * width * height
+  uint32_t plane_stride; // Offset from address to the UV plane for semi-planar pixel formats
+  uint32_t batch_stride; // Offset between cubes of a batch, 0 when all batches share the cube
 };
 
 struct nna_conv_surface_desc {
@@ -65,6 +92,10 @@ struct nna_conv_surface_desc {
   struct nna_data_cube src_data;
   struct nna_data_cube dst_data;
   struct nna_data_cube weight_data;
+
+  /* Compressed weights only, bit mask of non zero weights and bytes per kernel group */
+  struct nna_data_cube wmb_data;
+  struct nna_data_cube wgs_data;
 };
 
 struct nna_conv_op_desc {
@@ -79,16 +110,25 @@ struct nna_conv_op_desc {
   uint8_t data_format; // Either feature or pixel data
   uint8_t pixel_mapping;
 
-  uint8_t batch; // batch number
+  uint8_t conv_mode; // CONV_MODE_DIRECT (default) or CONV_MODE_WINOGRAD
+  uint8_t precision; // PRECISION_INT8 (default) or PRECISION_INT16, for input, weights and processing
+
+  uint8_t batch; // batch number, 0 or 1 for a single cube
 
 
-  uint8_t weight_format;   // Default to 0 (Uncompressed)
+  uint8_t weight_format;   // WEIGHT_FORMAT_UNCOMPRESSED (default) or WEIGHT_FORMAT_COMPRESSED
   uint8_t data_bank;
   uint8_t weight_bank;
 
   uint8_t post_extension;
   uint8_t pixel_sign_override;
 
+  uint8_t clip_truncate; // Right shift applied to the accumulators by CACC, default 0
+
+  int16_t pad_value; // Value of padded input elements, the input zero point for asymmetric models
+
+  struct nna_cvt_param in_cvt; // CDMA input conversion (x - offset) * scale >> truncate
+
   uint16_t release; // number of slices need to be released
 
   /* The input cube dimension for CSC */
@@ -181,22 +221,66 @@ struct nna_sdp_op {
   struct nna_sdp_cvt  cvt;
 };
 
+#define NNA_LUT_LE_ENTRIES 65
+#define NNA_LUT_LO_ENTRIES 257
+
+#define LUT_FUNCTION_EXPONENT 0
+#define LUT_FUNCTION_LINEAR   1
+
+#define LUT_PRIORITY_LE 0
+#define LUT_PRIORITY_LO 1
+
+struct nna_lut_param {
+  /* Raw (LE) table, linear or exponent spaced, and density (LO) table, linear spaced */
+  int16_t le_table[NNA_LUT_LE_ENTRIES];
+  int16_t lo_table[NNA_LUT_LO_ENTRIES];
+
+  uint8_t le_function;     /* LUT_FUNCTION_EXPONENT or LUT_FUNCTION_LINEAR */
+  int8_t  le_index_offset; /* exponent of the first entry, exponent mode only */
+  uint8_t le_index_select; /* log2 of the entry spacing, linear mode only */
+  uint8_t lo_index_select; /* log2 of the entry spacing */
+
+  int32_t le_start;
+  int32_t le_end;
+  int32_t lo_start;
+  int32_t lo_end;
+
+  /* Table used when the input is below/above both tables or inside both */
+  uint8_t uflow_priority;
+  uint8_t oflow_priority;
+  uint8_t hybrid_priority;
+
+  /* Outside a table the output is extrapolated from its end entry, (x - end) * scale >> shift */
+  int16_t le_uflow_scale;
+  int16_t le_oflow_scale;
+  uint8_t le_uflow_shift;
+  uint8_t le_oflow_shift;
+
+  int16_t lo_uflow_scale;
+  int16_t lo_oflow_scale;
+  uint8_t lo_uflow_shift;
+  uint8_t lo_oflow_shift;
+};
+
 struct nna_sdp_op_desc {
 
   struct nna_cvt_param out_cvt;
 
   /* Performance parameters */
-  /* nna_conv_mode */
+  /* nna_conv_mode, must match the conv op when input is from conv on the fly */
   uint8_t conv_mode;
-  uint8_t batch_num;
-  uint16_t reserved0;
+  uint8_t batch_num;  /* 0 or 1 for a single cube, input from conv on the fly only */
+  uint8_t src_precision; /* input precision, for conv on the fly the precision of the conv input */
+  uint8_t dst_precision; /* output precision, can differ from src_precision to widen or narrow */
 
-  uint32_t batch_stride;	/* will be used when batch_num > 1 */
+  uint32_t batch_stride;	/* dst batch stride, will be used when batch_num > 1 */
 
   /* Algorithm parameters */
   struct nna_sdp_op x1_op;
   struct nna_sdp_op x2_op;
   struct nna_sdp_op y_op;
+
+  struct nna_lut_param* lut; /* lookup table applied at the end of y when y_op.act is ACTIVATION_LUT */
 };
 
 struct nna_pdp_surface_desc {
@@ -211,7 +295,19 @@ struct nna_pdp_surface_desc {
 
 struct nna_pdp_op_desc {
 
-	uint8_t   split_num; // Default to 1
+	uint8_t   split_num; // Set by nna_pdp_plan_split() when programmed
+	uint8_t   precision; // PRECISION_INT8 (default) or PRECISION_INT16
+
+	/**
+	 * Input and output widths of the first, middle and last splits when the
+	 * output is too wide for the PDP line buffer, set by nna_pdp_plan_split()
+	 */
+	uint16_t  partial_in_width_first;
+	uint16_t  partial_in_width_mid;
+	uint16_t  partial_in_width_last;
+	uint16_t  partial_out_width_first;
+	uint16_t  partial_out_width_mid;
+	uint16_t  partial_out_width_last;
 
 	/* Algorithm parameters */
 	uint8_t  pool_mode; /* max,min,average */
@@ -228,6 +324,15 @@ struct nna_pdp_op_desc {
 	uint8_t  pad_right;
 	uint8_t  pad_top;
 	uint8_t  pad_bottom;
+
+	int32_t  pad_value; /* value of padded elements for average pooling, the zero point */
+
+	/**
+	 * Average pooling multiplies by these, 0x10000 is 1.0. Set to 0 for the
+	 * reciprocal of the kernel width/height.
+	 */
+	uint32_t recip_width;
+	uint32_t recip_height;
 };
 
 void nna_conv_set_producer(uint32_t group_id, uint32_t rdma_group_id);
@@ -240,10 +345,48 @@ int nna_sdp_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface);
 
 void nna_pdp_set_producer(uint32_t group_id, uint32_t rdma_group_id);
 void nna_pdp_enable(uint8_t enable_stats, uint8_t is_rdma_needed);
+int nna_pdp_plan_split(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_surface);
 int nna_pdp_program(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_surface);
 
 uint16_t calculate_eps(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface);
 uint32_t calculate_data_bank(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface);
 uint32_t calculate_weight_bank(nna_conv_surface_desc* conv_surface);
 
+void nna_feature_cube(nna_data_cube* cube, uint32_t address, uint16_t width, uint16_t height,
+  uint16_t channel, uint8_t precision);
+void nna_sdp_operand_cube(nna_data_cube* cube, uint32_t address, nna_sdp_op* op, uint16_t width,
+  uint16_t height, uint16_t channel);
+uint8_t calculate_sdp_operand_bytes(nna_sdp_op* op);
+uint32_t nna_batch_cube(nna_data_cube* cube, uint8_t batch);
+void nna_cvt_zero_point(nna_cvt_param* cvt, int32_t zero_point);
+
+int nna_conv_setup(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_data_cube* src_data, uint32_t weight_address, uint16_t k, uint8_t k_w, uint8_t k_h,
+  uint8_t stride, uint8_t pad, uint8_t dilation);
+
+uint8_t calculate_pixel_channels(uint8_t format);
+uint8_t calculate_pixel_bytes(uint8_t format);
+uint8_t nna_pixel_is_semiplanar(uint8_t format);
+
+void nna_pixel_cube(nna_data_cube* cube, uint8_t format, uint32_t address, uint32_t uv_address,
+  uint16_t width, uint16_t height, uint32_t line_stride);
+int nna_conv_set_pixel(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface, uint8_t format,
+  int16_t mean_ry, int16_t mean_gu, int16_t mean_bv, int16_t mean_ax);
+/* Copies between host buffers and NNA memory with cache maintenance, such as
+ * sunxi_ion_loadin()/sunxi_ion_loadout() */
+struct nna_mem_io {
+  int (*loadin)(void* src, size_t size, int paddr);
+  void* (*loadout)(int paddr, size_t size, void* dst);
+};
+
+#define NNA_WINOGRAD_PROBE_BYTES 0x1000
+
+int nna_winograd_probe(uint32_t scratch_address, nna_mem_io* io);
+int nna_winograd_supported();
+int nna_conv_set_precision(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint8_t precision);
+int nna_conv_set_winograd(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface);
+int nna_conv_set_compressed(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint32_t weight_bytes, uint32_t wmb_address, uint32_t wmb_bytes, uint32_t wgs_address);
+
 #endif // NNA_INTERFACE_H
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NNA_PACK_H
+#define NNA_PACK_H
+
+/*
+ * Host side helpers to convert model data into the layouts expected by the
+ * NNA. These are intended to be run once when a model is loaded.
+ */
+
+uint32_t nna_weight_bytes(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c);
+uint32_t nna_weight_bytes_int16(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c);
+uint32_t nna_weight_bytes_grouped(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c, uint16_t groups);
+uint32_t nna_weight_bytes_csplit(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c, uint16_t slice_c);
+int nna_pixel_channel_order(uint8_t format, int8_t* order);
+
+int nna_pack_weights(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int8_t* weights);
+int nna_pack_weights_int16(const int16_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int16_t* weights);
+int nna_pack_weights_grouped(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  uint16_t groups, int8_t* weights);
+int nna_pack_weights_csplit(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  uint16_t slice_c, int8_t* weights);
+int nna_pack_weights_winograd(const int8_t* khwc, uint16_t k, uint16_t c, int8_t* weights,
+  uint8_t* shift);
+int nna_pack_weights_deconv(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int8_t* weights);
+int nna_pack_weights_bilinear(uint16_t c, int8_t* weights);
+int nna_zero_point_bias(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int16_t zero_point, const int32_t* bias, int16_t* operand);
+uint32_t nna_wmb_bytes(uint16_t k, uint32_t bytes_per_kernel);
+int nna_compress_weights(const int8_t* weights, uint16_t k, uint32_t bytes_per_kernel, int8_t* wt,
+  uint8_t* wmb, uint32_t* wgs);
+int nna_pack_gemm_b(const int8_t* kn, uint16_t k, uint16_t n, int8_t* weights);
+int nna_pack_weights_pixel(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint8_t c,
+  uint8_t format, int8_t* weights);
+
+void nna_pack_feature_rows(const void* hwc, nna_data_cube* cube, uint8_t precision, void* feature,
+  uint16_t first_row, uint16_t last_row);
+void nna_unpack_feature_rows(const void* feature, nna_data_cube* cube, uint8_t precision, void* hwc,
+  uint16_t first_row, uint16_t last_row);
+void nna_pack_feature(const void* hwc, nna_data_cube* cube, uint8_t precision, void* feature);
+void nna_unpack_feature(const void* feature, nna_data_cube* cube, uint8_t precision, void* hwc);
+void nna_pack_feature_uint8(const uint8_t* hwc, nna_data_cube* cube, int8_t* feature);
+void nna_unpack_feature_uint8(const int8_t* feature, nna_data_cube* cube, uint8_t* hwc);
+
+/* Pool of worker threads used to split layout conversion of large frames by row bands */
+struct nna_pack_pool;
+
+nna_pack_pool* nna_pack_pool_create(uint8_t threads, uint32_t core_mask);
+void nna_pack_pool_destroy(nna_pack_pool* pool);
+void nna_pack_feature_mt(nna_pack_pool* pool, const void* hwc, nna_data_cube* cube, uint8_t precision,
+  void* feature);
+void nna_unpack_feature_mt(nna_pack_pool* pool, const void* feature, nna_data_cube* cube,
+  uint8_t precision, void* hwc);
+
+int nna_pack_sdp_kernel(const int16_t* alu, const int16_t* mul, uint16_t channel, nna_sdp_op* op,
+  void* operand);
+int nna_pack_sdp_point(const int16_t* alu_hwc, const int16_t* mul_hwc, nna_data_cube* cube,
+  nna_sdp_op* op, void* operand);
+
+/*
+ * Per channel requantisation of a conv output, optionally with batch norm
+ * y = gamma * (x - mean) / sqrt(var + eps) + beta folded in. Scales give the
+ * real value of one integer step, bias is in accumulator steps
+ * (in_scale * weight_scale[k]) and may be NULL, bn_gamma is NULL without batch
+ * norm. act is ACTIVATION_NONE or ACTIVATION_RELU.
+ */
+struct nna_requant_desc {
+  uint16_t k;
+  float in_scale;
+  const float* weight_scale;
+  const int32_t* bias;
+
+  const float* bn_gamma;
+  const float* bn_beta;
+  const float* bn_mean;
+  const float* bn_var;
+  float bn_eps;
+
+  float out_scale;
+  int16_t out_zero_point;
+  uint8_t act;
+};
+
+int nna_fold_requant(const nna_requant_desc* requant, nna_sdp_op_desc* sdp_op, void* x1_operand,
+  void* x2_operand);
+int nna_prelu_op(nna_sdp_op* op, const float* slope, uint16_t channel, void* operand);
+void nna_leaky_relu_op(nna_sdp_op* op, float slope);
+
+/* Calibration of a conv layer's SDP parameters over a calibration set */
+struct nna_calib_layer {
+  uint16_t in_w;
+  uint16_t in_h;
+  uint16_t in_c;
+
+  uint16_t k;
+  uint8_t k_w;
+  uint8_t k_h;
+  uint8_t stride;
+  uint8_t pad;
+
+  const int8_t* khwc;
+  float weight_scale;  // Real value of one weight step
+  const float* bias;   // Real per kernel bias, NULL for none
+
+  uint8_t act;         // ACTIVATION_NONE or ACTIVATION_RELU
+  uint8_t pool;        // Max pool size after the layer, 0 for none
+  uint8_t pool_stride;
+  uint8_t pow2;        // 1 to keep the output converter scale at 1
+};
+
+struct nna_calib_result {
+  uint16_t out_w;      // Conv output
+  uint16_t out_h;
+  uint16_t pool_w;     // Output after pooling
+  uint16_t pool_h;
+
+  int16_t* bias;       // Per kernel X1 operand, allocated by the caller
+  uint8_t bias_shift;  // X1 shift_value
+  struct nna_cvt_param out_cvt;
+  float out_scale;     // Real value of one output step
+
+  int64_t max_abs;     // Largest magnitude before the output converter
+  uint32_t saturated;  // Outputs saturated over the set
+};
+
+void nna_calib_sdp_op(const nna_calib_layer* layer, const nna_calib_result* result,
+  nna_sdp_op_desc* sdp_op);
+int nna_calib_eval(const nna_calib_layer* layer, const int8_t* in, int samples,
+  nna_calib_result* result, int8_t* out);
+int nna_calibrate_layer(const nna_calib_layer* layer, float in_scale, const int8_t* in, int samples,
+  nna_calib_result* result, int8_t* out);
+
+/* Bit exact CPU models of the SDP datapath */
+int64_t nna_ref_shift_right(int64_t x, uint8_t shift);
+int64_t nna_ref_saturate(int64_t x, uint8_t bits);
+int64_t nna_ref_cvt(const nna_cvt_param* cvt, int64_t x);
+int64_t nna_ref_sdp_x(const nna_sdp_op* op, int64_t x, int32_t alu, int32_t mul);
+int64_t nna_ref_sdp_y(const nna_sdp_op* op, int64_t x, int32_t alu, int32_t mul);
+int32_t nna_ref_sdp_out(const nna_sdp_op_desc* sdp_op, int64_t x);
+void nna_ref_pdp(const nna_pdp_op_desc* pdp_op, const nna_pdp_surface_desc* pdp_surface,
+  const void* hwc, void* out);
+
+/* Lookup tables for SDP LUT activations */
+#define NNA_LUT_SIGMOID    0
+#define NNA_LUT_TANH       1
+#define NNA_LUT_SWISH      2
+#define NNA_LUT_HARD_SWISH 3
+
+float nna_lut_reference(uint8_t function, float x);
+int nna_lut_generate(nna_lut_param* lut, uint8_t function, float in_scale, float out_scale);
+int32_t nna_lut_eval(const nna_lut_param* lut, int32_t x);
+void nna_lut_accuracy(const nna_lut_param* lut, uint8_t function, float in_scale, float out_scale,
+  int32_t first, int32_t last, float* max_err, float* mean_err);
+
+#endif // NNA_PACK_H
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NNA_PLAN_H
+#define NNA_PLAN_H
+
+/*
+ * Planners that split operations which do not fit the hardware limits (CBUF
+ * banks, line buffers) into a sequence of smaller ops.
+ */
+
+struct nna_conv_tile {
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+
+  uint16_t out_row;  // First output row written by this tile
+  uint16_t out_rows; // Number of output rows
+
+  uint16_t out_kernel;  // First kernel (output channel) computed by this tile
+  uint16_t out_kernels; // Number of kernels
+
+  uint16_t in_channel;  // First input channel read by this tile
+  uint16_t in_channels; // Number of input channels
+};
+
+struct nna_sdp_pass {
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+};
+
+struct nna_pdp_pass {
+  nna_pdp_op_desc pdp_op;
+  nna_pdp_surface_desc pdp_surface;
+};
+
+#define NNA_MAX_GROUP_SLICES 256
+
+struct nna_group_slice {
+  uint16_t in_channel;  // First input channel read by the slice
+  uint16_t in_channels; // Number of input channels
+  uint16_t out_kernel;  // First kernel (output channel) computed by the slice
+  uint16_t out_kernels; // Number of kernels
+};
+
+#define NNA_GEMM_MAX_K 8192
+#define NNA_GEMM_MAX_TILES 256
+
+struct nna_gemm_desc {
+  uint16_t m; // Rows of A and C
+  uint16_t k; // Columns of A, rows of B
+  uint16_t n; // Columns of B and C
+
+  uint32_t a_address; // 1xMxK feature cube
+  uint32_t b_address; // N kernels of 1x1xK packed by nna_pack_gemm_b() or nna_pack_weights()
+  uint32_t c_address; // 1xMxN feature cube
+
+  uint32_t bias_address; // Per column int16 operand packed by nna_pack_sdp_kernel(), 0 for none
+  uint8_t bias_type;     // SDP_OP_ADD for bias, SDP_OP_BOTH for bias and per column scale
+  uint8_t bias_shift;    // Left shift applied to the bias
+  uint8_t mul_shift;     // Right shift after the per column scale
+
+  uint8_t act; // ACTIVATION_NONE or ACTIVATION_RELU
+
+  struct nna_cvt_param out_cvt; // Requantisation of the output to int8
+};
+
+#define NNA_ELTWISE_ADD 0
+#define NNA_ELTWISE_MUL 1
+#define NNA_ELTWISE_MAX 2
+#define NNA_ELTWISE_MIN 3
+
+struct nna_eltwise_desc {
+  uint8_t op;        // NNA_ELTWISE_ADD, NNA_ELTWISE_MUL, NNA_ELTWISE_MAX or NNA_ELTWISE_MIN
+  uint8_t precision; // PRECISION_INT8 or PRECISION_INT16 for both operands and the output
+
+  nna_data_cube a;   // Operands and output, same shape, all in memory
+  nna_data_cube b;
+  nna_data_cube out;
+
+  struct nna_cvt_param b_cvt;   // Set enable to convert b to the scale of a, (b - offset) * scale >> truncate
+  struct nna_cvt_param out_cvt; // Requantisation of the result, zero points go in the offset
+};
+
+struct nna_convert_desc {
+  nna_data_cube src;         // Input cube in memory, laid out for src_precision
+  uint8_t src_precision;     // PRECISION_INT8 or PRECISION_INT16
+  nna_data_cube dst;         // Output cube in memory, same shape, laid out for dst_precision
+  uint8_t dst_precision;
+  struct nna_cvt_param cvt;  // (x - offset) * scale >> truncate then saturated to dst_precision
+};
+
+#define NNA_POOL_DONE 0x10 // PDP_DONE_STATUS0, pooling from memory runs in register group 0
+#define NNA_PDP_MAX_KERNEL 8
+#define NNA_MAX_POOL_STAGES 4
+
+struct nna_pool_desc {
+  uint8_t mode;      // POOL_MODE_AVG, POOL_MODE_MAX or POOL_MODE_MIN
+  uint8_t precision; // PRECISION_INT8 or PRECISION_INT16 for input and output
+
+  // Kernels up to NNA_PDP_MAX_KERNEL take any stride and padding, larger
+  // kernels must have a stride of the kernel size and no padding. A kernel of
+  // the whole input is global pooling.
+  uint16_t kernel_w;
+  uint16_t kernel_h;
+  uint16_t stride_x;
+  uint16_t stride_y;
+  uint8_t pad_left;
+  uint8_t pad_right;
+  uint8_t pad_top;
+  uint8_t pad_bottom;
+  int32_t pad_value; // Added for padded elements by average pooling, the zero point
+
+  nna_data_cube src; // Input and output, both in memory
+  nna_data_cube dst;
+
+  uint32_t scratch_address; // Results between passes of large kernels, see nna_pool_scratch_bytes()
+};
+
+#define NNA_MAX_PYRAMID_LEVELS 8
+
+struct nna_pyramid_desc {
+  nna_data_cube image; // Input frame in memory, uint8 frames packed by nna_pack_feature_uint8()
+  uint8_t precision;   // PRECISION_INT8 or PRECISION_INT16
+  uint8_t levels;      // Downscaled levels, each a 2x2 average of the one before
+
+  uint32_t address;    // Level cubes one after the other, see nna_pyramid_bytes()
+  nna_data_cube level[NNA_MAX_PYRAMID_LEVELS]; // Set by nna_plan_pyramid(), 1/2, 1/4 ...
+};
+
+#define NNA_POST_ADD   0 // Bias or residual add, operand << shift or converted by cvt
+#define NNA_POST_MUL   1 // Scale, (x * operand) >> truncate
+#define NNA_POST_BN    2 // Add then scale, operands interleaved as SDP_OP_BOTH
+#define NNA_POST_RELU  3
+#define NNA_POST_PRELU 4 // Scale of negative values, slopes per kernel or one per layer
+#define NNA_POST_LUT   5
+
+#define NNA_MAX_POST_OPS 8
+
+struct nna_post_op {
+  uint8_t type;      // NNA_POST_*
+  uint8_t mode;      // SDP_OP_PER_LAYER, SDP_OP_PER_KERNEL or SDP_OP_PER_POINT
+  uint8_t precision; // Memory operand precision
+  uint8_t shift;     // Left shift of add operands
+  uint8_t truncate;  // Right shift after scale
+
+  int32_t alu_value; // Per layer operands
+  int32_t mul_value;
+
+  uint32_t address;  // Memory operand packed by nna_pack_sdp_kernel()/nna_pack_sdp_point()
+
+  struct nna_cvt_param cvt; // Set enable to convert an add operand, forces the op into Y
+  struct nna_lut_param* lut;
+};
+
+struct nna_post_chain {
+  nna_post_op ops[NNA_MAX_POST_OPS]; // Applied in order after conv or to src
+  uint8_t num_ops;
+  uint8_t src_precision;
+  uint8_t dst_precision;
+
+  struct nna_cvt_param out_cvt; // Final requantisation
+};
+
+int nna_plan_conv_tiles(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_conv_tile* tiles, int max_tiles);
+int nna_plan_conv_ksplit(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_conv_tile* tiles, int max_tiles);
+int nna_plan_conv(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_conv_tile* tiles, int max_tiles);
+int nna_group_slices(uint16_t c, uint16_t k, uint16_t groups, nna_group_slice* slices,
+  int max_slices);
+int nna_plan_conv_grouped(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint16_t groups, nna_conv_tile* tiles, int max_tiles);
+uint16_t nna_csplit_channels(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface);
+int nna_plan_conv_csplit(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint16_t slice_channels, nna_conv_tile* tiles, int max_tiles);
+uint32_t nna_csplit_partial_bytes(nna_sdp_surface_desc* sdp_surface);
+int nna_run_conv_csplit(nna_conv_tile* tiles, int num_tiles, nna_sdp_op_desc* sdp_op,
+  nna_sdp_surface_desc* sdp_surface, uint32_t partial_address);
+int nna_gemm_plan(nna_gemm_desc* gemm, nna_conv_tile* tiles, int max_tiles,
+  nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface);
+int nna_gemm(nna_gemm_desc* gemm);
+void nna_upsample_cube(nna_data_cube* cube, uint32_t address, nna_data_cube* src, uint8_t scale);
+int nna_plan_upsample(nna_data_cube* src, nna_data_cube* dst, uint8_t scale, uint8_t nearest,
+  nna_sdp_pass* passes, int max_passes);
+int nna_run_sdp_passes(nna_sdp_pass* passes, int num_passes);
+int nna_plan_deconv(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_data_cube* src, uint32_t zero_address, nna_data_cube* zero_data, uint32_t weight_address,
+  uint16_t k, uint8_t k_w, uint8_t k_h, uint8_t stride, uint8_t pad, uint8_t output_pad);
+int nna_eltwise_plan(nna_eltwise_desc* eltwise, nna_sdp_pass* pass);
+int nna_eltwise(nna_eltwise_desc* eltwise);
+void nna_sdp_output_precision(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface,
+  uint8_t precision);
+int nna_convert_plan(nna_convert_desc* convert, nna_sdp_pass* pass);
+int nna_convert(nna_convert_desc* convert);
+uint32_t nna_pool_scratch_bytes(nna_pool_desc* pool);
+int nna_plan_pool(nna_pool_desc* pool, nna_pdp_pass* passes, int max_passes);
+int nna_pool_submit(nna_pdp_pass* pass);
+int nna_pool_poll();
+int nna_pool_wait();
+int nna_run_pdp_passes(nna_pdp_pass* passes, int num_passes);
+int nna_pool(nna_pool_desc* pool);
+uint32_t nna_pyramid_bytes(nna_pyramid_desc* pyramid);
+int nna_plan_pyramid(nna_pyramid_desc* pyramid, nna_pdp_pass* passes, int max_passes);
+int nna_pyramid(nna_pyramid_desc* pyramid);
+int nna_sdp_tile_surface(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface,
+  nna_conv_tile* tile, nna_sdp_surface_desc* tile_surface);
+int nna_run_conv_tiles(nna_conv_tile* tiles, int num_tiles, nna_sdp_op_desc* sdp_op,
+  nna_sdp_surface_desc* sdp_surface);
+uint32_t nna_sdp_fusion_partial_bytes(nna_sdp_surface_desc* sdp_surface);
+int nna_plan_sdp_fusion(nna_post_chain* chain, nna_sdp_surface_desc* sdp_surface,
+  uint32_t partial_address, nna_sdp_pass* passes, int max_passes);
+int nna_run_conv_fused(nna_conv_tile* tiles, int num_tiles, nna_sdp_pass* passes, int num_passes);
+
+#endif // NNA_PLAN_H
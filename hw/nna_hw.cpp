@@ -45,6 +45,8 @@
 static int nna_fd;
 static void *nna_nmap;
 
+static int nna_pending; // Completion bits of ops started by nna_submit()
+
 void* xreg_open(void) {
   int fd;
   void *result;
@@ -163,6 +165,11 @@ int nna_off() {
 }
 
 void nna_reset() {
+
+  // Resetting would abort ops still running on another engine, they are
+  // waited for first so the next op always starts from a reset NNA
+  if (nna_pending)
+    nna_wait(nna_pending);
   nna_configure(nna_cmd_reset, 0);
 }
 
@@ -205,6 +212,51 @@ wait_event_timeout:
 int nna_wait_done(int event_mask, int event_value) {
 
   nna_wait_event_done(event_mask, event_value, 400000);
-  nna_clean_interrupt();
+
+  // Leave the completion bits of ops running on another engine
+  if (nna_pending)
+    xregw(0x100Cu, event_mask);
+  else
+    nna_clean_interrupt();
   return 0;
 }
+
+static void nna_complete(int event_mask) {
+
+  // Completion bits are write one to clear
+  xregw(0x100Cu, event_mask);
+  nna_pending &= ~event_mask;
+}
+
+void nna_submit(int event_mask) {
+
+  // An op has been enabled that will set event_mask when done, it's left
+  // running while other engines are used and waited for
+  nna_pending |= event_mask;
+}
+
+int nna_poll(int event_mask) {
+
+  // Returns 1 once an op started with nna_submit() has finished, ops already
+  // waited for by nna_reset() are done
+  if (!(nna_pending & event_mask))
+    return 1;
+
+  if ((xregr(0x100C) & event_mask) != event_mask)
+    return 0;
+
+  nna_complete(event_mask);
+  return 1;
+}
+
+int nna_wait(int event_mask) {
+
+  // Wait for an op started with nna_submit()
+  if (!(nna_pending & event_mask))
+    return 0;
+
+  int result = nna_wait_event_done(event_mask, event_mask, 400000);
+
+  nna_complete(event_mask);
+  return result < 0 ? -1 : 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Host side calibration of the SDP parameters of a conv layer. The layer is
+ * run over a calibration set with the bit exact CPU model of the datapath
+ * (conv accumulators, X1 bias and relu, output converter) and the parameters
+ * are chosen from the observed range:
+ *
+ * - the bias is converted to accumulator steps and the X1 shift_value is the
+ *   smallest that fits every kernel's bias in the int16 operand,
+ * - the output converter truncate (and scale unless only power of two shifts
+ *   are wanted) maps the largest magnitude seen to the int8 range, so nothing
+ *   in the set saturates while keeping as much resolution as possible.
+ *
+ * The int8 outputs (after the optional max pool) are the inputs of the next
+ * layer, so a network is calibrated layer by layer with the real scale of
+ * each output passed on as the input scale of the next layer.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+
+#define NNA_CALIB_MAX_TRUNCATE 31
+
+static uint16_t pool_size(uint16_t in, uint8_t pool, uint8_t stride) {
+
+  // Windows that start inside the input are kept and clipped at the edge
+  return pool ? (in + stride - 1) / stride : in;
+}
+
+void nna_calib_sdp_op(const nna_calib_layer* layer, const nna_calib_result* result,
+  nna_sdp_op_desc* sdp_op) {
+
+  // SDP op for the layer, X1 adds the per kernel bias and applies relu
+  memset(sdp_op, 0, sizeof(nna_sdp_op_desc));
+
+  sdp_op->x1_op.enable = 1;
+  sdp_op->x1_op.type = layer->bias ? SDP_OP_ADD : SDP_OP_NONE;
+  sdp_op->x1_op.alu_type = SDP_ALU_OP_SUM;
+  sdp_op->x1_op.mode = SDP_OP_PER_KERNEL;
+  sdp_op->x1_op.precision = PRECISION_INT16;
+  sdp_op->x1_op.shift_value = result->bias_shift;
+  sdp_op->x1_op.act = layer->act;
+
+  sdp_op->out_cvt = result->out_cvt;
+}
+
+static int64_t conv_acc(const nna_calib_layer* layer, const int8_t* in, uint16_t x, uint16_t y,
+  uint16_t k) {
+
+  int64_t acc = 0;
+
+  for (uint8_t ky = 0; ky < layer->k_h; ky++) {
+    for (uint8_t kx = 0; kx < layer->k_w; kx++) {
+      int iy = y * layer->stride - layer->pad + ky;
+      int ix = x * layer->stride - layer->pad + kx;
+      if (iy < 0 || iy >= layer->in_h || ix < 0 || ix >= layer->in_w)
+        continue;
+      const int8_t* src = in + ((uint32_t)iy * layer->in_w + ix) * layer->in_c;
+      const int8_t* wt = layer->khwc + (((uint32_t)k * layer->k_h + ky) * layer->k_w + kx) * layer->in_c;
+      for (uint16_t c = 0; c < layer->in_c; c++)
+        acc += src[c] * wt[c];
+    }
+  }
+
+  return acc;
+}
+
+static int run_layer(const nna_calib_layer* layer, const int8_t* in, int samples,
+  nna_calib_result* result, int8_t* out) {
+
+  // Run the layer with the parameters in result. Records the largest magnitude
+  // before the output converter and the number of saturated outputs, out can
+  // be NULL when only the range is needed.
+  nna_sdp_op_desc sdp_op;
+  uint32_t in_size = (uint32_t)layer->in_w * layer->in_h * layer->in_c;
+  uint32_t out_size = (uint32_t)result->pool_w * result->pool_h * layer->k;
+  int8_t* conv = out ? (int8_t*)malloc((uint32_t)result->out_w * result->out_h * layer->k) : 0;
+
+  if (out && !conv) {
+    printf("nna_calibrate_layer - out of memory\n");
+    return -1;
+  }
+
+  nna_calib_sdp_op(layer, result, &sdp_op);
+  result->max_abs = 0;
+  result->saturated = 0;
+
+  for (int s = 0; s < samples; s++) {
+    for (uint16_t y = 0; y < result->out_h; y++) {
+      for (uint16_t x = 0; x < result->out_w; x++) {
+        for (uint16_t k = 0; k < layer->k; k++) {
+          int64_t v = nna_ref_sdp_x(&sdp_op.x1_op, conv_acc(layer, in + s * in_size, x, y, k),
+            result->bias ? result->bias[k] : 0, 0);
+          int64_t q = nna_ref_cvt(&sdp_op.out_cvt, v);
+
+          result->max_abs = llabs(v) > result->max_abs ? llabs(v) : result->max_abs;
+          result->saturated += q > 127 || q < -128;
+          if (conv)
+            conv[((uint32_t)y * result->out_w + x) * layer->k + k] = nna_ref_sdp_out(&sdp_op, v);
+        }
+      }
+    }
+
+    if (!out)
+      continue;
+
+    // Max pool to the next layer's input
+    for (uint16_t y = 0; y < result->pool_h; y++) {
+      for (uint16_t x = 0; x < result->pool_w; x++) {
+        for (uint16_t k = 0; k < layer->k; k++) {
+          int8_t m = -128;
+          uint8_t pool = layer->pool ? layer->pool : 1;
+          uint8_t stride = layer->pool ? layer->pool_stride : 1;
+          for (uint16_t py = y * stride; py < y * stride + pool && py < result->out_h; py++)
+            for (uint16_t px = x * stride; px < x * stride + pool && px < result->out_w; px++)
+              m = conv[((uint32_t)py * result->out_w + px) * layer->k + k] > m ?
+                conv[((uint32_t)py * result->out_w + px) * layer->k + k] : m;
+          out[s * out_size + ((uint32_t)y * result->pool_w + x) * layer->k + k] = m;
+        }
+      }
+    }
+  }
+
+  free(conv);
+  return 0;
+}
+
+int nna_calib_eval(const nna_calib_layer* layer, const int8_t* in, int samples,
+  nna_calib_result* result, int8_t* out) {
+
+  // Run the layer with the bias and converter already in result (for example
+  // hand tuned values) to count saturation and produce the next inputs
+  result->out_w = (layer->in_w + 2 * layer->pad - layer->k_w) / layer->stride + 1;
+  result->out_h = (layer->in_h + 2 * layer->pad - layer->k_h) / layer->stride + 1;
+  result->pool_w = pool_size(result->out_w, layer->pool, layer->pool_stride);
+  result->pool_h = pool_size(result->out_h, layer->pool, layer->pool_stride);
+
+  return run_layer(layer, in, samples, result, out);
+}
+
+int nna_calibrate_layer(const nna_calib_layer* layer, float in_scale, const int8_t* in, int samples,
+  nna_calib_result* result, int8_t* out) {
+
+  // Choose the bias shift and output converter for the layer, result->bias
+  // must have room for the layer's kernels. out_scale is set to the real value
+  // of one output step.
+  float acc_scale = in_scale * layer->weight_scale;
+  int64_t max_bias = 0;
+  int64_t* bias = (int64_t*)malloc(layer->k * sizeof(int64_t));
+
+  if (!bias || (layer->bias && !result->bias)) {
+    printf("nna_calibrate_layer - no bias memory\n");
+    free(bias);
+    return -1;
+  }
+
+  // Bias in accumulator steps
+  result->bias_shift = 0;
+  for (uint16_t k = 0; k < layer->k; k++) {
+    bias[k] = layer->bias ? llroundf(layer->bias[k] / acc_scale) : 0;
+    max_bias = llabs(bias[k]) > max_bias ? llabs(bias[k]) : max_bias;
+  }
+  while (nna_ref_shift_right(max_bias, result->bias_shift) > 32767)
+    result->bias_shift++;
+  for (uint16_t k = 0; layer->bias && k < layer->k; k++)
+    result->bias[k] = nna_ref_saturate(nna_ref_shift_right(bias[k], result->bias_shift), 16);
+  free(bias);
+
+  // Range with the converter as identity
+  memset(&result->out_cvt, 0, sizeof(result->out_cvt));
+  result->out_cvt.scale = 1;
+  if (nna_calib_eval(layer, in, samples, result, 0))
+    return -1;
+
+  // Smallest power of two shift that avoids saturation, then if a scale is
+  // allowed the largest truncate that keeps the scale in int16
+  while (nna_ref_shift_right(result->max_abs, result->out_cvt.truncate) > 127 ||
+    nna_ref_shift_right(-result->max_abs, result->out_cvt.truncate) < -128)
+    result->out_cvt.truncate++;
+
+  for (uint8_t t = result->out_cvt.truncate; !layer->pow2 && result->max_abs &&
+    t <= NNA_CALIB_MAX_TRUNCATE; t++) {
+    int64_t scale = ((int64_t)127 << t) / result->max_abs;
+    if (scale > 32767)
+      break;
+    if (scale) {
+      result->out_cvt.truncate = t;
+      result->out_cvt.scale = (int16_t)scale;
+    }
+  }
+
+  result->out_scale = acc_scale * (float)(1ll << result->out_cvt.truncate) / result->out_cvt.scale;
+
+  return nna_calib_eval(layer, in, samples, result, out);
+}
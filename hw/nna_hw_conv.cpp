@@ -19,8 +19,10 @@
 */
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "nna_hw.h"
+#include "nna_config.h"
 #include "nna_interface.h"
 
 void nna_conv_set_producer(uint32_t group_id, uint32_t rdma_group_id) {
@@ -52,27 +54,55 @@ void nna_conv_enable(uint8_t enable_stats, uint8_t is_rdma_needed) {
 int processor_conv_program(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface) {
 
   uint32_t misc_cfg;
+  uint32_t precision;
   uint32_t padding;
+  uint8_t batch;
+
+  // Data and weights must both fit in CBUF, use nna_plan_conv_tiles() to split larger ops.
+  // The last bank holds the weight mask for compressed weights.
+  uint8_t banks = NNA_CBUF_BANK_NUMBER - (conv_op->weight_format == WEIGHT_FORMAT_COMPRESSED);
+  if (conv_op->data_bank + conv_op->weight_bank > banks) {
+    printf("processor_conv_program - %d data + %d weight banks exceeds %d\n", conv_op->data_bank,
+      conv_op->weight_bank, banks);
+    return -1;
+  }
+
+  batch = conv_op->batch ? conv_op->batch : 1;
+
+  if (batch > 1 && conv_op->data_format != FORMAT_FEATURE) {
+    printf("processor_conv_program - batch only supported for feature data\n");
+    return -1;
+  }
+
+  // Input and processing precision are the same, CACC output is int32 (int8) or int48 (int16)
+  precision = (conv_op->precision & 0x03) << 12;
 
   misc_cfg = ((conv_op->skip_weight_rls & 0x01) << 28) | ((conv_op->skip_data_rls  & 0x01) << 24) |
-  ((conv_op->weight_reuse & 0x01) << 20) | ((conv_op->data_reuse  & 0x01) << 16);
+  ((conv_op->weight_reuse & 0x01) << 20) | ((conv_op->data_reuse  & 0x01) << 16) |
+  ((conv_op->precision & 0x03) << 8) | precision | (conv_op->conv_mode & 0x01);
 
   padding = (conv_op->pad_y_bottom << 24) | (conv_op->pad_y_top << 20) |
   (conv_op->pad_x_right << 16) | conv_op->pad_x_left;
 
+  /* cacc */
+  xregw(0x701Cu, batch - 1); // CACC_D_BATCH_NUMBER_0
+  xregw(0x702Cu, conv_op->clip_truncate & 0x1F); // CACC_D_CLIP_CFG_0
+
+  xregw(0x700Cu, precision | (conv_op->conv_mode & 0x01)); // CACC_D_MISC_CFG_0
+
   /* cmac */
-  xregw(0x500Cu, 0);  // CMAC_A_D_MISC_CFG_0
-  xregw(0x600Cu, 0);  // CMAC_B_D_MISC_CFG_0
+  xregw(0x500Cu, precision | (conv_op->conv_mode & 0x01));  // CMAC_A_D_MISC_CFG_0
+  xregw(0x600Cu, precision | (conv_op->conv_mode & 0x01));  // CMAC_B_D_MISC_CFG_0
 
   /* csc */
   xregw(0x400Cu, misc_cfg);  // CSC_D_MISC_CFG_0
   xregw(0x4010u, conv_op-> data_format != FORMAT_FEATURE ); // CSC_D_DATAIN_FORMAT_0
   xregw(0x4014u, (conv_op->input_width_csc - 1) | ((conv_op->input_height_csc - 1) << 16));  // CSC_D_DATAIN_SIZE_EXT_0_0
   xregw(0x4018u, conv_op->input_channel_csc - 1);
-  xregw(0x401Cu, 0);
+  xregw(0x401Cu, batch - 1); // CSC_D_BATCH_NUMBER_0
   xregw(0x4020u, conv_op->post_extension); // CSC_D_POST_Y_EXTENSION_0
   xregw(0x4024u, conv_op->entry_per_slice -1); // CSC_D_ENTRY_PER_SLICE_0
-  xregw(0x4028u, 0);  // Uncompressed weights
+  xregw(0x4028u, conv_op->weight_format & 0x01); // CSC_D_WEIGHT_FORMAT_0
 
   if ( conv_op->data_format != FORMAT_FEATURE ) {
     // input is pixel data
@@ -85,14 +115,15 @@ int processor_conv_program(nna_conv_op_desc* conv_op, nna_conv_surface_desc* con
   }
 
   xregw(0x4034u, conv_surface->weight_data.size & 0xFFFFFFE0); // CSC_D_WEIGHT_BYTES_0
+  xregw(0x4038u, conv_op->weight_format ? conv_surface->wmb_data.size : 0); // CSC_D_WMB_BYTES_0
   xregw(0x403Cu, (conv_op->input_width_cmac - 1) | ((conv_op->input_height_cmac  - 1) << 16)); // CSC_D_DATAOUT_SIZE_0_0
   xregw(0x4040u, conv_surface->dst_data.channel - 1); // CSC_D_DATAOUT_SIZE_1_0
   xregw(0x4044u, conv_surface->dst_data.width * conv_surface->dst_data.height- 1); // // CSC_D_ATOMICS_0
   xregw(0x4048u, conv_op->release); // CSC_D_RELEASE_0
   xregw(0x404Cu, (conv_op->stride_x - 1) | ((conv_op->stride_y - 1) << 16));
-  xregw(0x4050u, (conv_op->dilation_x - 1) | ((conv_op->dilation_x - 1) << 16));
+  xregw(0x4050u, (conv_op->dilation_x - 1) | ((conv_op->dilation_y - 1) << 16));
   xregw(0x4054u, (conv_op->pad_y_top << 16)  | conv_op->pad_x_left); // CSC_D_ZERO_PADDING_0
-  xregw(0x4058u, 0);
+  xregw(0x4058u, (uint16_t)conv_op->pad_value); // CSC_D_ZERO_PADDING_VALUE_0
   xregw(0x405Cu, (conv_op->data_bank - 1) | ((conv_op->weight_bank - 1) << 16)); // CSC_D_BANK_0
   xregw(0x4060u, 0); // CSC_D_PRA_CFG_0
 
@@ -101,7 +132,18 @@ int processor_conv_program(nna_conv_op_desc* conv_op, nna_conv_surface_desc* con
   xregw(0x3014u, misc_cfg); // CDMA_D_MISC_CFG_0
 
   if (conv_op-> data_format != FORMAT_FEATURE  ) {
-    xregw(0x3018u, (conv_op->data_format << 8) | 1);
+    xregw(0x3018u, ((conv_op->pixel_sign_override & 0x01) << 20) | ((conv_op->pixel_mapping & 0x01) << 16) |
+      (conv_op->data_format << 8) | 1); // CDMA_D_DATAIN_FORMAT_0
+    xregw(0x3028u, 0); // CDMA_D_PIXEL_OFFSET_0
+
+    if (nna_pixel_is_semiplanar(conv_op->data_format)) {
+      // UV plane follows the Y plane at plane_stride
+      xregw(0x3038u, 0); // CDMA_D_DAIN_ADDR_HIGH_1_0
+      xregw(0x303Cu, conv_surface->src_data.address + conv_surface->src_data.plane_stride); // CDMA_D_DAIN_ADDR_LOW_1_0
+      // Full resolution interleaved UV is two bytes per pixel
+      xregw(0x3044u, conv_surface->src_data.line_stride * 2); // CDMA_D_LINE_UV_STRIDE_0
+    }
+
     if ( conv_op->mean_format==MEAN_FORMAT_ENABLE ) {
       xregw(0x3098u, 1u);
       xregw(0x309Cu, (conv_op->mean_ry) | (conv_op->mean_gu << 16));
@@ -116,6 +158,15 @@ int processor_conv_program(nna_conv_op_desc* conv_op, nna_conv_surface_desc* con
     xregw(0x3018u, 0x101000u);
   }
 
+  // Input conversion, for pixel data mean subtraction enables it with a scale of 1
+  if (conv_op->in_cvt.enable) {
+    xregw(0x30A4u, 1u | ((conv_op->in_cvt.truncate & 0x3F) << 4)); // CDMA_D_CVT_CFG_0
+    xregw(0x30A8u, (uint16_t)conv_op->in_cvt.offset); // CDMA_D_CVT_OFFSET_0
+    xregw(0x30ACu, (uint16_t)conv_op->in_cvt.scale); // CDMA_D_CVT_SCALE_0
+  } else if (conv_op->data_format == FORMAT_FEATURE) {
+    xregw(0x30A4u, 0); // CDMA_D_CVT_CFG_0
+  }
+
   xregw(0x304Cu, 1u); // CDMA_D_DAIN_MAP_0 line packed true
   xregw(0x301Cu, (conv_surface->src_data.width - 1) | ((conv_surface->src_data.height - 1) << 16));
   xregw(0x3020u, conv_surface->src_data.channel - 1);
@@ -127,18 +178,27 @@ int processor_conv_program(nna_conv_op_desc* conv_op, nna_conv_surface_desc* con
   xregw(0x3048u, conv_surface->src_data.surf_stride);
 
   xregw(0x304Cu, 1u);
-  xregw(0x3058u, 0);
+  xregw(0x3058u, batch - 1); // CDMA_D_BATCH_NUMBER_0
+  xregw(0x305Cu, batch > 1 ? conv_surface->src_data.batch_stride : 0); // CDMA_D_BATCH_STRIDE_0
   xregw(0x3060u, conv_op->entry_per_slice - 1); // CDMA_D_ENTRY_PER_SLICE_0
-  xregw(0x3068u, 0);
+  xregw(0x3068u, conv_op->weight_format & 0x01); // CDMA_D_WEIGHT_FORMAT_0
   xregw(0x306Cu, conv_op->bytes_per_kernel - 1); // CDMA_D_WEIGHT_SIZE_0_0
   xregw(0x3070u, conv_surface->dst_data.channel - 1);
   xregw(0x3074u, 0x01); // Ram type MC
   xregw(0x3078u, 0);
   xregw(0x307Cu, conv_surface->weight_data.address); // CDMA_D_WEIGHT_ADDR_LOW_0
   xregw(0x3080u, conv_surface->weight_data.size & 0xFFFFFFE0); // CDMA_D_WEIGHT_BYTES_0
+
+  if (conv_op->weight_format == WEIGHT_FORMAT_COMPRESSED) {
+    xregw(0x3084u, 0); // CDMA_D_WGS_ADDR_HIGH_0
+    xregw(0x3088u, conv_surface->wgs_data.address); // CDMA_D_WGS_ADDR_LOW_0
+    xregw(0x308Cu, 0); // CDMA_D_WMB_ADDR_HIGH_0
+    xregw(0x3090u, conv_surface->wmb_data.address); // CDMA_D_WMB_ADDR_LOW_0
+    xregw(0x3094u, conv_surface->wmb_data.size); // CDMA_D_WMB_BYTES_0
+  }
   xregw(0x30B0u, (conv_op->stride_x - 1) | ((conv_op->stride_y -1) << 16));
   xregw(0x30B4u, padding);  // // CDMA_D_ZERO_PADDING_0
-  xregw(0x30B8u, 0);
+  xregw(0x30B8u, (uint16_t)conv_op->pad_value); // CDMA_D_ZERO_PADDING_VALUE_0
   xregw(0x30BCu, (conv_op->data_bank - 1) | ((conv_op->weight_bank - 1) << 16));
   return 0;
 }
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Precision conversion of SDP output. SDP processes at the input precision
+ * and the output converter requantises to the output precision, so an int8
+ * pipeline can write int16 (e.g. partial sums or skip branches kept at full
+ * width) and an int16 cube can be narrowed back to int8 without leaving the
+ * NNA. A standalone conversion is an SDP pass with every stage bypassed.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+void nna_sdp_output_precision(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface,
+  uint8_t precision) {
+
+  // Write the SDP output at precision, the output cube keeps its address and
+  // shape and is re-described with the strides for precision
+  nna_data_cube* dst = &sdp_surface->dst_data;
+
+  sdp_op->dst_precision = precision;
+  nna_feature_cube(dst, dst->address, dst->width, dst->height, dst->channel, precision);
+}
+
+int nna_convert_plan(nna_convert_desc* convert, nna_sdp_pass* pass) {
+
+  // Build the SDP pass for a conversion of a cube in memory
+  nna_sdp_op_desc* sdp_op = &pass->sdp_op;
+  nna_sdp_surface_desc* sdp_surface = &pass->sdp_surface;
+
+  if (convert->src_precision > PRECISION_INT16 || convert->dst_precision > PRECISION_INT16) {
+    printf("nna_convert_plan - unsupported precision %d to %d\n", convert->src_precision,
+      convert->dst_precision);
+    return -1;
+  }
+
+  if (convert->src.width != convert->dst.width || convert->src.height != convert->dst.height ||
+    convert->src.channel != convert->dst.channel) {
+    printf("nna_convert_plan - input %dx%dx%d and output %dx%dx%d differ\n",
+      convert->src.width, convert->src.height, convert->src.channel,
+      convert->dst.width, convert->dst.height, convert->dst.channel);
+    return -1;
+  }
+
+  if (!convert->src.address || !convert->dst.address) {
+    printf("nna_convert_plan - input and output must be in memory\n");
+    return -1;
+  }
+
+  memset(pass, 0, sizeof(nna_sdp_pass));
+
+  sdp_surface->src_data = convert->src;
+  sdp_surface->dst_data = convert->dst;
+
+  sdp_op->src_precision = convert->src_precision;
+  sdp_op->dst_precision = convert->dst_precision;
+  sdp_op->out_cvt = convert->cvt;
+  if (sdp_op->out_cvt.scale == 0)
+    sdp_op->out_cvt.scale = 1;
+
+  return 0;
+}
+
+int nna_convert(nna_convert_desc* convert) {
+
+  // dst = saturate((src - offset) * scale >> truncate)
+  nna_sdp_pass pass;
+
+  if (nna_convert_plan(convert, &pass))
+    return -1;
+
+  return nna_run_sdp_passes(&pass, 1);
+}
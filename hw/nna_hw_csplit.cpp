@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Channel splitting of convolutions. When even a single kernel group with
+ * the rows needed for one output row doesn't fit in CBUF the input channels
+ * are split into slices, each slice is a convolution of its own (tiled by
+ * nna_plan_conv() if needed) and the partial sums are accumulated by SDP:
+ *
+ * - Every slice but the last writes an int16 partial cube, from the second
+ *   slice on the previous partial is added by X1 as a per point operand.
+ *   Two partial cubes are used in turn so SDP never reads what it writes.
+ * - The last slice adds the previous partial with X1 then runs the layer's
+ *   own SDP op, so requantisation, bias and activation are only done once.
+ *
+ * Partials are int16 so the accumulators normally need to be scaled down by
+ * CACC (conv_op->clip_truncate), the layer's SDP op then sees the scaled
+ * accumulators for all slices.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+static void slice_conv(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint16_t channel, uint16_t channels, uint32_t weight_address, nna_conv_op_desc* op,
+  nna_conv_surface_desc* surface) {
+
+  // Describe the convolution of input channels [channel, channel + channels) with all kernels
+  *op = *conv_op;
+  *surface = *conv_surface;
+
+  surface->src_data.address += (channel / NNA_ATOMIC_C_SIZE) * surface->src_data.surf_stride;
+  surface->src_data.channel = channels;
+
+  surface->weight_data.address = weight_address;
+  surface->weight_data.channel = channels;
+
+  op->input_channel_csc = channels;
+  op->kernel_channel_csc = channels;
+  op->bytes_per_kernel = channels * op->kernel_width_csc * op->kernel_height_csc * (1 << op->precision);
+  surface->weight_data.size = (surface->dst_data.channel * op->bytes_per_kernel) + 31;
+
+  op->entry_per_slice = calculate_eps(op, surface);
+  op->data_bank = calculate_data_bank(op, surface);
+  op->weight_bank = calculate_weight_bank(surface);
+}
+
+static int slice_fits(nna_conv_op_desc* op) {
+
+  // Same choices as nna_plan_conv(), true when one of them can plan the slice
+  uint32_t data_bank = op->data_bank;
+  uint32_t weight_bank = op->weight_bank;
+  int32_t kernel_h = (op->kernel_height_csc - 1) * op->dilation_y + 1;
+  uint32_t group_bytes = KERNEL_PER_GROUP * op->bytes_per_kernel + 32;
+
+  if (data_bank + weight_bank <= NNA_CBUF_BANK_NUMBER)
+    return 1;
+
+  if (weight_bank < NNA_CBUF_BANK_NUMBER / 2)
+    return (int32_t)(((NNA_CBUF_BANK_NUMBER - weight_bank) * NNA_CBUF_ENTRIES_PER_BANK) /
+      op->entry_per_slice) >= kernel_h;
+
+  if (data_bank < NNA_CBUF_BANK_NUMBER &&
+    (NNA_CBUF_BANK_NUMBER - data_bank) * NNA_CBUF_BANK_WEIGHT_SIZE >= group_bytes)
+    return 1;
+
+  return (NNA_CBUF_BANK_NUMBER / 2) * NNA_CBUF_BANK_WEIGHT_SIZE >= group_bytes &&
+    (int32_t)(((NNA_CBUF_BANK_NUMBER / 2) * NNA_CBUF_ENTRIES_PER_BANK) / op->entry_per_slice) >= kernel_h;
+}
+
+uint16_t nna_csplit_channels(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface) {
+
+  // Most input channels per slice (a multiple of NNA_ATOMIC_C_SIZE) that can
+  // be planned, returns 0 if not even one channel atom fits.
+  nna_conv_op_desc op;
+  nna_conv_surface_desc surface;
+  uint16_t c = conv_surface->src_data.channel;
+  uint16_t atoms = (c + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE;
+
+  for (uint16_t slices = 1; slices <= atoms; slices++) {
+    uint16_t channels = ((atoms + slices - 1) / slices) * NNA_ATOMIC_C_SIZE;
+    if (channels > c)
+      channels = c;
+
+    slice_conv(conv_op, conv_surface, 0, channels, 0, &op, &surface);
+    if (slice_fits(&op))
+      return channels;
+  }
+
+  return 0;
+}
+
+int nna_plan_conv_csplit(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint16_t slice_channels, nna_conv_tile* tiles, int max_tiles) {
+
+  // Split conv_op into slices of slice_channels input channels, weights must be
+  // packed by nna_pack_weights_csplit() with the same slice_channels. Returns
+  // the number of tiles or -1, the tiles of a slice follow each other.
+  nna_conv_op_desc op;
+  nna_conv_surface_desc surface;
+  uint32_t weight_address = conv_surface->weight_data.address;
+  uint16_t c = conv_surface->src_data.channel;
+  int num_tiles = 0;
+
+  if (conv_op->data_format != FORMAT_FEATURE) {
+    printf("nna_plan_conv_csplit - only feature input supported\n");
+    return -1;
+  }
+
+  if (slice_channels == 0 || (slice_channels % NNA_ATOMIC_C_SIZE && slice_channels < c)) {
+    printf("nna_plan_conv_csplit - %d channels per slice must be a multiple of %d\n",
+      slice_channels, NNA_ATOMIC_C_SIZE);
+    return -1;
+  }
+
+  for (uint16_t channel = 0; channel < c; channel += slice_channels) {
+    uint16_t channels = (c - channel) < slice_channels ? (c - channel) : slice_channels;
+
+    slice_conv(conv_op, conv_surface, channel, channels, weight_address, &op, &surface);
+
+    // Weight blocks of each slice start on a 32 byte boundary
+    weight_address += surface.weight_data.size & 0xFFFFFFE0;
+
+    int n = nna_plan_conv(&op, &surface, &tiles[num_tiles], max_tiles - num_tiles);
+    if (n < 0)
+      return -1;
+
+    for (int j = num_tiles; j < num_tiles + n; j++) {
+      tiles[j].in_channel = channel;
+      tiles[j].in_channels = channels;
+    }
+
+    num_tiles += n;
+  }
+
+  return num_tiles;
+}
+
+uint32_t nna_csplit_partial_bytes(nna_sdp_surface_desc* sdp_surface) {
+
+  // Bytes needed for the two int16 partial cubes used by nna_run_conv_csplit()
+  nna_data_cube partial;
+
+  nna_feature_cube(&partial, 0, sdp_surface->src_data.width, sdp_surface->src_data.height,
+    sdp_surface->src_data.channel, PRECISION_INT16);
+
+  return partial.size * 2;
+}
+
+static int slice_sdp(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface,
+  uint32_t partial_address, int slice, uint8_t last, nna_sdp_op_desc* op,
+  nna_sdp_surface_desc* surface) {
+
+  // SDP for a slice, partials alternate between the two cubes at partial_address
+  nna_data_cube partial[2];
+
+  for (int i = 0; i < 2; i++) {
+    nna_feature_cube(&partial[i], 0, sdp_surface->src_data.width, sdp_surface->src_data.height,
+      sdp_surface->src_data.channel, PRECISION_INT16);
+    partial[i].address = partial_address + i * partial[i].size;
+  }
+
+  if (last) {
+    *op = *sdp_op;
+    *surface = *sdp_surface;
+  } else {
+    memset(op, 0, sizeof(nna_sdp_op_desc));
+    memset(surface, 0, sizeof(nna_sdp_surface_desc));
+
+    op->src_precision = sdp_op->src_precision;
+    op->dst_precision = PRECISION_INT16;
+    op->out_cvt.scale = 1;
+
+    surface->src_data = sdp_surface->src_data;
+    surface->dst_data = partial[slice & 1];
+  }
+
+  if (slice == 0)
+    return 0;
+
+  // X1 adds the previous partial, the layer's own X1 moves to X2 (same function)
+  if (op->x1_op.enable) {
+    if (op->x2_op.enable) {
+      printf("nna_run_conv_csplit - X1 is needed to add partials, X1 and X2 both in use\n");
+      return -1;
+    }
+    op->x2_op = op->x1_op;
+    surface->x2_data = surface->x1_data;
+  }
+
+  memset(&op->x1_op, 0, sizeof(nna_sdp_op));
+  op->x1_op.enable = 1;
+  op->x1_op.type = SDP_OP_ADD;
+  op->x1_op.mode = SDP_OP_PER_POINT;
+  op->x1_op.precision = PRECISION_INT16;
+
+  nna_sdp_operand_cube(&surface->x1_data, partial[(slice - 1) & 1].address, &op->x1_op,
+    sdp_surface->src_data.width, sdp_surface->src_data.height, sdp_surface->src_data.channel);
+
+  return 0;
+}
+
+int nna_run_conv_csplit(nna_conv_tile* tiles, int num_tiles, nna_sdp_op_desc* sdp_op,
+  nna_sdp_surface_desc* sdp_surface, uint32_t partial_address) {
+
+  // Run the tiles from nna_plan_conv_csplit(), sdp_op/sdp_surface describe the
+  // layer output and are applied once after the last slice. partial_address
+  // needs nna_csplit_partial_bytes() of memory.
+  nna_sdp_op_desc op;
+  nna_sdp_surface_desc surface;
+  int slice = 0;
+
+  if (!sdp_surface->dst_data.address && tiles[0].in_channels != sdp_surface->src_data.channel) {
+    printf("nna_run_conv_csplit - output can't be passed to PDP on the fly\n");
+    return -1;
+  }
+
+  for (int i = 0; i < num_tiles; slice++) {
+    // Tiles of the same slice
+    int n = 1;
+    while (i + n < num_tiles && tiles[i + n].in_channel == tiles[i].in_channel)
+      n++;
+
+    if (slice_sdp(sdp_op, sdp_surface, partial_address, slice, i + n == num_tiles, &op, &surface))
+      return -1;
+
+    if (nna_run_conv_tiles(&tiles[i], n, &op, &surface))
+      return -1;
+
+    i += n;
+  }
+
+  return 0;
+}
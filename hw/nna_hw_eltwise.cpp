@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Elementwise binary ops of two cubes in memory run by SDP on its own. The
+ * first operand is the SDP input and the second is read by the Y RDMA as a
+ * per point operand, the Y ALU does add/max/min and the Y multiplier does mul.
+ * The second operand can be converted to the scale of the first by the Y
+ * operand converter and the result is requantised by the output converter.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+static int same_shape(nna_data_cube* a, nna_data_cube* b) {
+  return a->width == b->width && a->height == b->height && a->channel == b->channel;
+}
+
+int nna_eltwise_plan(nna_eltwise_desc* eltwise, nna_sdp_pass* pass) {
+
+  // Build the SDP pass for an elementwise op
+  nna_sdp_op_desc* sdp_op = &pass->sdp_op;
+  nna_sdp_surface_desc* sdp_surface = &pass->sdp_surface;
+  nna_sdp_op* y_op = &sdp_op->y_op;
+
+  if (eltwise->op > NNA_ELTWISE_MIN) {
+    printf("nna_eltwise_plan - unsupported op %d\n", eltwise->op);
+    return -1;
+  }
+
+  if (!same_shape(&eltwise->a, &eltwise->b) || !same_shape(&eltwise->a, &eltwise->out)) {
+    printf("nna_eltwise_plan - operands %dx%dx%d, %dx%dx%d and output %dx%dx%d differ\n",
+      eltwise->a.width, eltwise->a.height, eltwise->a.channel, eltwise->b.width, eltwise->b.height,
+      eltwise->b.channel, eltwise->out.width, eltwise->out.height, eltwise->out.channel);
+    return -1;
+  }
+
+  if (!eltwise->a.address || !eltwise->b.address || !eltwise->out.address) {
+    printf("nna_eltwise_plan - operands and output must be in memory\n");
+    return -1;
+  }
+
+  memset(pass, 0, sizeof(nna_sdp_pass));
+
+  sdp_surface->src_data = eltwise->a;
+  sdp_surface->y_data = eltwise->b;
+  sdp_surface->dst_data = eltwise->out;
+
+  sdp_op->src_precision = eltwise->precision;
+  sdp_op->dst_precision = eltwise->precision;
+  sdp_op->out_cvt = eltwise->out_cvt;
+  if (sdp_op->out_cvt.scale == 0)
+    sdp_op->out_cvt.scale = 1;
+
+  y_op->enable = 1;
+  y_op->mode = SDP_OP_PER_POINT;
+  y_op->precision = eltwise->precision;
+
+  if (eltwise->op == NNA_ELTWISE_MUL) {
+    y_op->type = SDP_OP_MUL;
+    y_op->cvt.mul_cvt = eltwise->b_cvt;
+  } else {
+    y_op->type = SDP_OP_ADD;
+    y_op->alu_type = eltwise->op == NNA_ELTWISE_ADD ? SDP_ALU_OP_SUM :
+      (eltwise->op == NNA_ELTWISE_MAX ? SDP_ALU_OP_MAX : SDP_ALU_OP_MIN);
+    y_op->cvt.alu_cvt = eltwise->b_cvt;
+  }
+
+  return 0;
+}
+
+int nna_eltwise(nna_eltwise_desc* eltwise) {
+
+  // out = a op b, requantised
+  nna_sdp_pass pass;
+
+  if (nna_eltwise_plan(eltwise, &pass))
+    return -1;
+
+  return nna_run_sdp_passes(&pass, 1);
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Fusion of the ops following a convolution (bias, batch norm, residual add,
+ * activation, requantisation) into as few SDP passes as possible. Each pass
+ * has three stages, X1, X2 (BS/BN) and Y (EW), each of which runs ALU, MUL
+ * then an activation (relu for X, LUT for Y) in that order:
+ *
+ * - Ops are placed greedily in order, an op goes in the current stage if its
+ *   slot comes after the slots already used, otherwise in the next stage.
+ * - A stage has one operand RDMA and its ALU and MUL share a source, so two
+ *   ops only share a stage when both use per layer operands (NNA_POST_BN
+ *   provides both operands interleaved in memory).
+ * - Converted add operands and LUTs need Y, relu in Y is an ALU max with 0 so
+ *   it has to be the first op of Y.
+ * - When the stages run out the pass writes an int16 partial cube and a new
+ *   pass reads it back, the final requantisation is done by the last pass.
+ *
+ * Partials are saturated to int16 so shifts in the chain need to keep the
+ * values in range where the chain is split.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+#define STAGE_X1 0
+#define STAGE_X2 1
+#define STAGE_Y  2
+
+// Slots within a stage
+#define SLOT_ALU 1
+#define SLOT_MUL 2
+#define SLOT_ACT 3
+
+uint32_t nna_sdp_fusion_partial_bytes(nna_sdp_surface_desc* sdp_surface) {
+
+  // Bytes needed for the two int16 partial cubes used between fused passes
+  nna_data_cube partial;
+
+  nna_feature_cube(&partial, 0, sdp_surface->src_data.width, sdp_surface->src_data.height,
+    sdp_surface->src_data.channel, PRECISION_INT16);
+
+  return partial.size * 2;
+}
+
+static uint8_t uses_operand(nna_sdp_op* op) {
+  return op->enable && op->type != SDP_OP_NONE && op->mode != SDP_OP_PER_LAYER;
+}
+
+static int64_t y_alu_value(nna_post_op* post) {
+
+  // Y has no operand shift so a per layer value is shifted up front, by a
+  // multiply as it can be negative. Any non zero value shifted by 16 or more
+  // is out of the int16 range.
+  if (post->shift >= 16)
+    return post->alu_value ? INT32_MAX : 0;
+  return (int64_t)post->alu_value * (1 << post->shift);
+}
+
+static int place_op(nna_post_op* post, nna_sdp_pass* pass, int stage, uint8_t* pos) {
+
+  // Put post into the stage if the slots it needs are still free, returns -1
+  // if it has to go in a later stage
+  nna_sdp_op* ops[3] = { &pass->sdp_op.x1_op, &pass->sdp_op.x2_op, &pass->sdp_op.y_op };
+  nna_data_cube* operands[3] = { &pass->sdp_surface.x1_data, &pass->sdp_surface.x2_data,
+    &pass->sdp_surface.y_data };
+  nna_sdp_op* op = ops[stage];
+  nna_data_cube* src = &pass->sdp_surface.src_data;
+  uint8_t slot;
+
+  switch (post->type) {
+    case NNA_POST_ADD:
+    case NNA_POST_BN:
+      slot = SLOT_ALU;
+      break;
+    case NNA_POST_MUL:
+    case NNA_POST_PRELU:
+      slot = SLOT_MUL;
+      break;
+    case NNA_POST_RELU:
+      slot = stage == STAGE_Y ? SLOT_ALU : SLOT_ACT;
+      break;
+    case NNA_POST_LUT:
+      slot = SLOT_ACT;
+      break;
+    default:
+      return -1;
+  }
+
+  if (slot <= *pos)
+    return -1;
+  if (post->type == NNA_POST_LUT && stage != STAGE_Y)
+    return -1;
+  if (post->type == NNA_POST_ADD && post->cvt.enable && stage != STAGE_Y)
+    return -1;
+  if ((post->type == NNA_POST_ADD || post->type == NNA_POST_BN) && stage == STAGE_Y &&
+    post->mode == SDP_OP_PER_LAYER && (y_alu_value(post) > 32767 || y_alu_value(post) < -32768))
+    return -1;
+  if ((post->type == NNA_POST_PRELU || post->type == NNA_POST_RELU || post->type == NNA_POST_LUT) &&
+    op->act != ACTIVATION_NONE)
+    return -1;
+
+  // Operands, other than for relu, share the stage source
+  if (post->type != NNA_POST_RELU && post->type != NNA_POST_LUT && op->enable &&
+    op->type != SDP_OP_NONE && (uses_operand(op) || post->mode != SDP_OP_PER_LAYER))
+    return -1;
+
+  op->enable = 1;
+
+  switch (post->type) {
+    case NNA_POST_ADD:
+    case NNA_POST_BN:
+      op->type = post->type == NNA_POST_BN ? SDP_OP_BOTH : SDP_OP_ADD;
+      op->alu_type = SDP_ALU_OP_SUM;
+      op->mode = post->mode;
+      op->precision = post->precision;
+      op->alu_operand = post->alu_value;
+      op->mul_operand = post->mul_value;
+      if (stage == STAGE_Y) {
+        if (post->mode == SDP_OP_PER_LAYER) {
+          op->alu_operand = (int32_t)y_alu_value(post);
+        } else if (post->cvt.enable) {
+          op->cvt.alu_cvt = post->cvt;
+        } else if (post->shift) {
+          // Y has no operand shift, the converter does it instead
+          op->cvt.alu_cvt.enable = 1;
+          op->cvt.alu_cvt.scale = 1 << post->shift;
+        }
+      } else {
+        op->shift_value = post->shift;
+      }
+      if (post->type == NNA_POST_BN)
+        op->truncate = post->truncate;
+      break;
+    case NNA_POST_MUL:
+    case NNA_POST_PRELU:
+      op->type = op->type == SDP_OP_ADD ? SDP_OP_BOTH : SDP_OP_MUL;
+      if (op->type == SDP_OP_MUL) {
+        op->mode = post->mode;
+        op->precision = post->precision;
+      }
+      op->mul_operand = post->mul_value;
+      op->truncate = post->truncate;
+      if (post->type == NNA_POST_PRELU)
+        op->act = ACTIVATION_PRELU;
+      break;
+    case NNA_POST_RELU:
+      if (stage == STAGE_Y) {
+        op->type = SDP_OP_ADD;
+        op->alu_type = SDP_ALU_OP_MAX;
+        op->mode = SDP_OP_PER_LAYER;
+        op->alu_operand = 0;
+      } else {
+        op->act = ACTIVATION_RELU;
+      }
+      break;
+    case NNA_POST_LUT:
+      op->act = ACTIVATION_LUT;
+      pass->sdp_op.lut = post->lut;
+      break;
+  }
+
+  if (post->mode != SDP_OP_PER_LAYER && post->type != NNA_POST_RELU && post->type != NNA_POST_LUT)
+    nna_sdp_operand_cube(operands[stage], post->address, op, src->width, src->height, src->channel);
+
+  *pos = (post->type == NNA_POST_BN) ? SLOT_MUL : slot;
+  return 0;
+}
+
+int nna_plan_sdp_fusion(nna_post_chain* chain, nna_sdp_surface_desc* sdp_surface,
+  uint32_t partial_address, nna_sdp_pass* passes, int max_passes) {
+
+  // Plan the passes for chain, the first pass reads sdp_surface->src_data
+  // (address 0 for conv on the fly) and the last writes sdp_surface->dst_data.
+  // More than one pass needs nna_sdp_fusion_partial_bytes() at partial_address.
+  nna_data_cube partial;
+  nna_sdp_pass* pass = passes;
+  int num_passes = 1;
+  int stage = STAGE_X1;
+  uint8_t pos = 0;
+
+  if (chain->num_ops > NNA_MAX_POST_OPS || max_passes < 1) {
+    printf("nna_plan_sdp_fusion - %d ops don't fit\n", chain->num_ops);
+    return -1;
+  }
+
+  nna_feature_cube(&partial, partial_address, sdp_surface->src_data.width,
+    sdp_surface->src_data.height, sdp_surface->src_data.channel, PRECISION_INT16);
+
+  memset(pass, 0, sizeof(nna_sdp_pass));
+  pass->sdp_surface.src_data = sdp_surface->src_data;
+  pass->sdp_op.src_precision = chain->src_precision;
+
+  for (int i = 0; i < chain->num_ops; i++) {
+    nna_post_op* post = &chain->ops[i];
+
+    if (post->type > NNA_POST_LUT) {
+      printf("nna_plan_sdp_fusion - unsupported op %d\n", post->type);
+      return -1;
+    }
+
+    while (place_op(post, pass, stage, &pos)) {
+      pos = 0;
+      if (++stage <= STAGE_Y)
+        continue;
+
+      // Out of stages, finish this pass with an int16 partial
+      if (num_passes == max_passes || !partial_address) {
+        printf("nna_plan_sdp_fusion - needs more than %d passes or no partial memory\n", num_passes);
+        return -1;
+      }
+
+      pass->sdp_surface.dst_data = partial;
+      pass->sdp_surface.dst_data.address = partial_address + ((num_passes - 1) & 1) * partial.size;
+      pass->sdp_op.dst_precision = PRECISION_INT16;
+      pass->sdp_op.out_cvt.scale = 1;
+
+      memset(pass + 1, 0, sizeof(nna_sdp_pass));
+      pass[1].sdp_surface.src_data = pass->sdp_surface.dst_data;
+      pass[1].sdp_op.src_precision = PRECISION_INT16;
+
+      pass++;
+      num_passes++;
+      stage = STAGE_X1;
+    }
+  }
+
+  pass->sdp_surface.dst_data = sdp_surface->dst_data;
+  pass->sdp_op.dst_precision = chain->dst_precision;
+  pass->sdp_op.out_cvt = chain->out_cvt;
+  if (pass->sdp_op.out_cvt.scale == 0)
+    pass->sdp_op.out_cvt.scale = 1;
+
+  return num_passes;
+}
+
+int nna_run_conv_fused(nna_conv_tile* tiles, int num_tiles, nna_sdp_pass* passes, int num_passes) {
+
+  // Run the conv with the first pass on the fly then any remaining passes
+  if (nna_run_conv_tiles(tiles, num_tiles, &passes[0].sdp_op, &passes[0].sdp_surface))
+    return -1;
+
+  return nna_run_sdp_passes(passes + 1, num_passes - 1);
+}
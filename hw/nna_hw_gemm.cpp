@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * int8 GEMM / fully connected layers run as a 1x1 convolution. The M rows
+ * of A are the height of a 1xMxK feature cube, the K columns are its
+ * channels and the N columns of B are the kernels. The output is a 1xMxN
+ * feature cube, each row of A is treated independently so large M is
+ * handled by height tiling and large N by kernel splitting.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+int nna_gemm_plan(nna_gemm_desc* gemm, nna_conv_tile* tiles, int max_tiles,
+  nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface) {
+
+  // Build the conv tiles and SDP descriptors for a GEMM, returns the number of tiles or -1
+  nna_data_cube a;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+
+  if (gemm->m == 0 || gemm->k == 0 || gemm->n == 0) {
+    printf("nna_gemm_plan - empty %dx%dx%d product\n", gemm->m, gemm->k, gemm->n);
+    return -1;
+  }
+
+  if (gemm->k > NNA_GEMM_MAX_K) {
+    printf("nna_gemm_plan - k of %d exceeds %d channels\n", gemm->k, NNA_GEMM_MAX_K);
+    return -1;
+  }
+
+  nna_feature_cube(&a, gemm->a_address, 1, gemm->m, gemm->k, PRECISION_INT8);
+  if (nna_conv_setup(&conv_op, &conv_surface, &a, gemm->b_address, gemm->n, 1, 1, 1, 0, 1))
+    return -1;
+  conv_surface.dst_data.address = gemm->c_address;
+
+  int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, max_tiles);
+  if (num_tiles < 0)
+    return -1;
+
+  memset(sdp_op, 0, sizeof(nna_sdp_op_desc));
+  memset(sdp_surface, 0, sizeof(nna_sdp_surface_desc));
+
+  sdp_surface->src_data = conv_surface.dst_data;
+  sdp_surface->src_data.address = 0; // Input is from conv hw
+  sdp_surface->dst_data = conv_surface.dst_data;
+
+  sdp_op->out_cvt = gemm->out_cvt;
+  if (sdp_op->out_cvt.scale == 0)
+    sdp_op->out_cvt.scale = 1;
+
+  // Bias and optional per column scale
+  if (gemm->bias_address) {
+    sdp_op->x1_op.enable = 1;
+    sdp_op->x1_op.type = gemm->bias_type ? gemm->bias_type : SDP_OP_ADD;
+    sdp_op->x1_op.alu_type = SDP_ALU_OP_SUM;
+    sdp_op->x1_op.mode = SDP_OP_PER_KERNEL;
+    sdp_op->x1_op.precision = PRECISION_INT16;
+    sdp_op->x1_op.shift_value = gemm->bias_shift;
+    sdp_op->x1_op.truncate = gemm->mul_shift;
+    sdp_op->x1_op.act = gemm->act;
+    nna_sdp_operand_cube(&sdp_surface->x1_data, gemm->bias_address, &sdp_op->x1_op, 1, gemm->m,
+      gemm->n);
+  } else if (gemm->act == ACTIVATION_RELU) {
+    // Relu only, x1 passes the data through
+    sdp_op->x1_op.enable = 1;
+    sdp_op->x1_op.type = SDP_OP_NONE;
+    sdp_op->x1_op.act = ACTIVATION_RELU;
+  }
+
+  return num_tiles;
+}
+
+int nna_gemm(nna_gemm_desc* gemm) {
+
+  // C = A.B + bias, requantised to int8
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+  nna_conv_tile* tiles = (nna_conv_tile*)malloc(NNA_GEMM_MAX_TILES * sizeof(nna_conv_tile));
+
+  if (!tiles) {
+    printf("nna_gemm - out of memory\n");
+    return -1;
+  }
+
+  int num_tiles = nna_gemm_plan(gemm, tiles, NNA_GEMM_MAX_TILES, &sdp_op, &sdp_surface);
+  int ret = (num_tiles < 0) ? -1 : nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface);
+
+  free(tiles);
+  return ret;
+}
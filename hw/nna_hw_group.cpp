@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Grouped and depthwise convolution lowering. CSC has no notion of groups
+ * so each group is run as a channel slice of the input cube, feature data
+ * stores 8 channels per surface so a slice is just an offset of surf_stride.
+ *
+ * Groups that cover whole surfaces (input and output channels per group are
+ * multiples of 8) are run one op per group. Smaller groups (depthwise) are
+ * packed 8 input channels per op, the weights for an op are block diagonal so
+ * each kernel only sees the channels of its own group. Ops are tiled and
+ * kernel split with nna_plan_conv(), keeping the input of a slice resident
+ * across kernel passes and the weights resident across height tiles.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+int nna_group_slices(uint16_t c, uint16_t k, uint16_t groups, nna_group_slice* slices,
+  int max_slices) {
+
+  // Split a grouped convolution into channel slices, returns the number of
+  // slices or -1 if the grouping can't be mapped onto feature surfaces
+  if (groups == 0 || c % groups || k % groups) {
+    printf("nna_group_slices - %d input and %d output channels not divisible into %d groups\n",
+      c, k, groups);
+    return -1;
+  }
+
+  uint16_t group_c = c / groups;
+  uint16_t group_k = k / groups;
+  int num_slices;
+
+  if ((group_c % NNA_ATOMIC_C_SIZE) == 0 && (group_k % NNA_ATOMIC_K_SIZE) == 0) {
+    // One op per group
+    num_slices = groups;
+    if (num_slices > max_slices)
+      goto too_many;
+
+    for (int i = 0; i < num_slices; i++) {
+      slices[i].in_channel = i * group_c;
+      slices[i].in_channels = group_c;
+      slices[i].out_kernel = i * group_k;
+      slices[i].out_kernels = group_k;
+    }
+    return num_slices;
+  }
+
+  if ((NNA_ATOMIC_C_SIZE % group_c) || (group_k % group_c)) {
+    printf("nna_group_slices - %d channels and %d kernels per group not supported\n",
+      group_c, group_k);
+    return -1;
+  }
+
+  // One op per input surface, each holding NNA_ATOMIC_C_SIZE / group_c groups
+  num_slices = (c + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE;
+  if (num_slices > max_slices)
+    goto too_many;
+
+  for (int i = 0; i < num_slices; i++) {
+    uint16_t in_channel = i * NNA_ATOMIC_C_SIZE;
+    uint16_t in_channels = (c - in_channel) < NNA_ATOMIC_C_SIZE ? (c - in_channel) : NNA_ATOMIC_C_SIZE;
+
+    slices[i].in_channel = in_channel;
+    slices[i].in_channels = in_channels;
+    slices[i].out_kernel = (in_channel / group_c) * group_k;
+    slices[i].out_kernels = (in_channels / group_c) * group_k;
+  }
+  return num_slices;
+
+too_many:
+  printf("nna_group_slices - needs %d slices, only %d available\n", num_slices, max_slices);
+  return -1;
+}
+
+int nna_plan_conv_grouped(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint16_t groups, nna_conv_tile* tiles, int max_tiles) {
+
+  // conv_op and conv_surface describe the convolution as if it was dense
+  // (all input channels, all kernels) with the weights packed by
+  // nna_pack_weights_grouped(). Returns the number of tiles or -1.
+  nna_group_slice slices[NNA_MAX_GROUP_SLICES];
+  nna_conv_op_desc op;
+  nna_conv_surface_desc surface;
+  uint32_t weight_address = conv_surface->weight_data.address;
+  int num_tiles = 0;
+
+  if (conv_op->data_format != FORMAT_FEATURE) {
+    printf("nna_plan_conv_grouped - only feature input supported\n");
+    return -1;
+  }
+
+  int num_slices = nna_group_slices(conv_surface->src_data.channel, conv_surface->dst_data.channel,
+    groups, slices, NNA_MAX_GROUP_SLICES);
+  if (num_slices < 0)
+    return -1;
+
+  for (int i = 0; i < num_slices; i++) {
+    nna_group_slice* slice = &slices[i];
+
+    op = *conv_op;
+    surface = *conv_surface;
+
+    surface.src_data.address += (slice->in_channel / NNA_ATOMIC_C_SIZE) * surface.src_data.surf_stride;
+    surface.src_data.channel = slice->in_channels;
+    surface.dst_data.address += (slice->out_kernel / NNA_ATOMIC_K_SIZE) * surface.dst_data.surf_stride;
+    surface.dst_data.channel = slice->out_kernels;
+
+    surface.weight_data.address = weight_address;
+    surface.weight_data.channel = slice->in_channels;
+
+    op.input_channel_csc = slice->in_channels;
+    op.kernel_channel_csc = slice->in_channels;
+    op.bytes_per_kernel = slice->in_channels * op.kernel_width_csc * op.kernel_height_csc *
+      (1 << op.precision);
+    surface.weight_data.size = (slice->out_kernels * op.bytes_per_kernel) + 31;
+
+    op.entry_per_slice = calculate_eps(&op, &surface);
+    op.data_bank = calculate_data_bank(&op, &surface);
+    op.weight_bank = calculate_weight_bank(&surface);
+
+    // Weight blocks of each slice start on a 32 byte boundary
+    weight_address += surface.weight_data.size & 0xFFFFFFE0;
+
+    int n = nna_plan_conv(&op, &surface, &tiles[num_tiles], max_tiles - num_tiles);
+    if (n < 0)
+      return -1;
+
+    // Kernel and channel offsets are relative to the slice
+    for (int j = num_tiles; j < num_tiles + n; j++) {
+      tiles[j].out_kernel += slice->out_kernel;
+      tiles[j].in_channel += slice->in_channel;
+    }
+
+    num_tiles += n;
+  }
+
+  return num_tiles;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Host side generation of SDP lookup tables for nonlinear activations. The
+ * LUT input is the integer output of Y (after its ALU/MUL), in_scale gives the
+ * real value of one input step and out_scale the real value of one output step.
+ *
+ * The density (LO) table covers the range where the function curves with 257
+ * entries, the raw (LE) table covers four times that range more coarsely and
+ * beyond both the output follows the function's asymptotic slope. Values
+ * between entries are linearly interpolated by the hardware.
+ *
+ * nna_lut_eval() models the hardware lookup so tables can be checked against
+ * the float functions with nna_lut_accuracy() before being used. Entries are
+ * int16 so out_scale needs to keep the function in range for the inputs used,
+ * a table that saturates shows up as a large error.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+
+float nna_lut_reference(uint8_t function, float x) {
+
+  switch (function) {
+    case NNA_LUT_SIGMOID:
+      return 1.0f / (1.0f + expf(-x));
+    case NNA_LUT_TANH:
+      return tanhf(x);
+    case NNA_LUT_SWISH:
+      return x / (1.0f + expf(-x));
+    case NNA_LUT_HARD_SWISH:
+      return x * fminf(fmaxf(x + 3.0f, 0.0f), 6.0f) / 6.0f;
+    default:
+      return 0.0f;
+  }
+}
+
+static float lut_range(uint8_t function) {
+
+  // Real input range either side of zero where the function isn't yet linear
+  switch (function) {
+    case NNA_LUT_TANH:
+    case NNA_LUT_HARD_SWISH:
+      return 4.0f;
+    default:
+      return 8.0f;
+  }
+}
+
+static void lut_slope(float slope, int16_t* scale, uint8_t* shift) {
+
+  // Express slope as scale >> shift using the largest shift that fits int16
+  *shift = 0;
+  while (*shift < 31 && fabsf(slope) * (1u << (*shift + 1)) < 32767.0f)
+    (*shift)++;
+  *scale = (int16_t)lrintf(slope * (1u << *shift));
+}
+
+static uint8_t lut_select(float half_range, uint16_t half_entries) {
+
+  // Smallest power of 2 entry spacing so the table covers +/- half_range,
+  // limited so the ends of the table still fit int32
+  uint8_t select = 0;
+  while (((int64_t)half_entries << (select + 1)) <= INT32_MAX &&
+    (float)half_entries * (float)(1ll << select) < half_range)
+    select++;
+  return select;
+}
+
+static int16_t lut_value(uint8_t function, float x, float out_scale) {
+
+  float v = roundf(nna_lut_reference(function, x) / out_scale);
+  return v > 32767.0f ? 32767 : (v < -32768.0f ? -32768 : (int16_t)v);
+}
+
+int nna_lut_generate(nna_lut_param* lut, uint8_t function, float in_scale, float out_scale) {
+
+  // Build linear LE and LO tables centred on zero for function
+  if (function > NNA_LUT_HARD_SWISH || in_scale <= 0.0f || out_scale <= 0.0f) {
+    printf("nna_lut_generate - invalid function %d or scales %f/%f\n", function, in_scale, out_scale);
+    return -1;
+  }
+
+  float range = lut_range(function) / in_scale;
+
+  memset(lut, 0, sizeof(nna_lut_param));
+
+  lut->le_function = LUT_FUNCTION_LINEAR;
+  lut->lo_index_select = lut_select(range, (NNA_LUT_LO_ENTRIES - 1) / 2);
+  lut->le_index_select = lut_select(range * 4, (NNA_LUT_LE_ENTRIES - 1) / 2);
+
+  int64_t lo_step = 1ll << lut->lo_index_select;
+  int64_t le_step = 1ll << lut->le_index_select;
+
+  lut->lo_start = -((NNA_LUT_LO_ENTRIES - 1) / 2) * lo_step;
+  lut->lo_end = lut->lo_start + (NNA_LUT_LO_ENTRIES - 1) * lo_step;
+  lut->le_start = -((NNA_LUT_LE_ENTRIES - 1) / 2) * le_step;
+  lut->le_end = lut->le_start + (NNA_LUT_LE_ENTRIES - 1) * le_step;
+
+  for (int i = 0; i < NNA_LUT_LO_ENTRIES; i++)
+    lut->lo_table[i] = lut_value(function, (float)(lut->lo_start + i * lo_step) * in_scale, out_scale);
+  for (int i = 0; i < NNA_LUT_LE_ENTRIES; i++)
+    lut->le_table[i] = lut_value(function, (float)(lut->le_start + i * le_step) * in_scale, out_scale);
+
+  // Inside LO use it, outside both extrapolate from LE
+  lut->hybrid_priority = LUT_PRIORITY_LO;
+  lut->uflow_priority = LUT_PRIORITY_LE;
+  lut->oflow_priority = LUT_PRIORITY_LE;
+
+  // Sigmoid and tanh are flat at both ends, swish and hard swish become 0 and x
+  float oflow = (function == NNA_LUT_SWISH || function == NNA_LUT_HARD_SWISH) ? in_scale / out_scale : 0.0f;
+  lut_slope(0.0f, &lut->le_uflow_scale, &lut->le_uflow_shift);
+  lut_slope(oflow, &lut->le_oflow_scale, &lut->le_oflow_shift);
+  lut_slope(0.0f, &lut->lo_uflow_scale, &lut->lo_uflow_shift);
+  lut_slope(oflow, &lut->lo_oflow_scale, &lut->lo_oflow_shift);
+
+  return 0;
+}
+
+static int lut_index(const nna_lut_param* lut, uint8_t table, int32_t x, int32_t* index,
+  int64_t* frac, uint8_t* bits) {
+
+  // Locate x in a table, returns -1 for underflow, 1 for overflow or 0 with
+  // the entry index and the fraction (of 2^bits) towards the next entry
+  int64_t d = (int64_t)x - (table == LUT_PRIORITY_LE ? lut->le_start : lut->lo_start);
+  int32_t last = (table == LUT_PRIORITY_LE ? NNA_LUT_LE_ENTRIES : NNA_LUT_LO_ENTRIES) - 1;
+
+  if (table == LUT_PRIORITY_LE && lut->le_function == LUT_FUNCTION_EXPONENT) {
+    // Entry i is at start + 2^(i + offset)
+    if (d <= 0)
+      return -1;
+    int exponent = 63 - __builtin_clzll(d);
+    *index = exponent - lut->le_index_offset;
+    *bits = exponent;
+    *frac = d - (1LL << exponent);
+  } else {
+    if (d < 0)
+      return -1;
+    *bits = table == LUT_PRIORITY_LE ? lut->le_index_select : lut->lo_index_select;
+    *index = d >> *bits;
+    *frac = d & ((1LL << *bits) - 1);
+  }
+
+  if (*index < 0)
+    return -1;
+  if (*index > last || (*index == last && *frac))
+    return 1;
+  return 0;
+}
+
+int32_t nna_lut_eval(const nna_lut_param* lut, int32_t x) {
+
+  // Model of the hardware lookup for input x
+  int32_t index[2];
+  int64_t frac[2];
+  uint8_t bits[2];
+  int state[2];
+
+  state[LUT_PRIORITY_LE] = lut_index(lut, LUT_PRIORITY_LE, x, &index[0], &frac[0], &bits[0]);
+  state[LUT_PRIORITY_LO] = lut_index(lut, LUT_PRIORITY_LO, x, &index[1], &frac[1], &bits[1]);
+
+  uint8_t table;
+  if (state[0] == 0 && state[1] == 0)
+    table = lut->hybrid_priority;
+  else if (state[0] == 0 || state[1] == 0)
+    table = state[0] == 0 ? LUT_PRIORITY_LE : LUT_PRIORITY_LO;
+  else if (state[0] > 0 && state[1] > 0)
+    table = lut->oflow_priority;
+  else
+    table = lut->uflow_priority;
+
+  const int16_t* values = table == LUT_PRIORITY_LE ? lut->le_table : lut->lo_table;
+  int32_t last = (table == LUT_PRIORITY_LE ? NNA_LUT_LE_ENTRIES : NNA_LUT_LO_ENTRIES) - 1;
+
+  if (state[table] < 0) {
+    int32_t start = table == LUT_PRIORITY_LE ? lut->le_start : lut->lo_start;
+    int16_t scale = table == LUT_PRIORITY_LE ? lut->le_uflow_scale : lut->lo_uflow_scale;
+    uint8_t shift = table == LUT_PRIORITY_LE ? lut->le_uflow_shift : lut->lo_uflow_shift;
+    return values[0] + (int32_t)((((int64_t)x - start) * scale) >> shift);
+  }
+
+  if (state[table] > 0) {
+    int32_t end = table == LUT_PRIORITY_LE ? lut->le_end : lut->lo_end;
+    int16_t scale = table == LUT_PRIORITY_LE ? lut->le_oflow_scale : lut->lo_oflow_scale;
+    uint8_t shift = table == LUT_PRIORITY_LE ? lut->le_oflow_shift : lut->lo_oflow_shift;
+    return values[last] + (int32_t)((((int64_t)x - end) * scale) >> shift);
+  }
+
+  int32_t i = index[table];
+  if (!frac[table])
+    return values[i];
+
+  // Rounded linear interpolation to the next entry
+  int64_t step = (int64_t)(values[i + 1] - values[i]) * frac[table];
+  return values[i] + (int32_t)((step + (1LL << (bits[table] - 1))) >> bits[table]);
+}
+
+void nna_lut_accuracy(const nna_lut_param* lut, uint8_t function, float in_scale, float out_scale,
+  int32_t first, int32_t last, float* max_err, float* mean_err) {
+
+  // Error of the table against the float function for inputs [first, last] in
+  // output steps (before any output conversion)
+  double sum = 0.0;
+
+  *max_err = 0.0f;
+  for (int32_t x = first; x <= last; x++) {
+    float err = fabsf(nna_lut_eval(lut, x) - nna_lut_reference(function, x * in_scale) / out_scale);
+    *max_err = err > *max_err ? err : *max_err;
+    sum += err;
+  }
+
+  *mean_err = (float)(sum / ((int64_t)last - first + 1));
+}
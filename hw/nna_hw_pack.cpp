@@ -0,0 +1,720 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+uint32_t nna_weight_bytes(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c) {
+
+  // Total weight bytes need to padded to next 32 byte boundary
+  return ((uint32_t)k * k_w * k_h * c + 31) & 0xFFFFFFE0;
+}
+
+int nna_pixel_channel_order(uint8_t format, int8_t* order) {
+
+  // For each channel presented to CSC (memory byte order) return the source
+  // channel it is taken from, 0 = R/Y, 1 = G/U, 2 = B/V, -1 = alpha or unused.
+  // Formats are named MSB first so A8B8G8R8 is stored as R,G,B,A in memory.
+  static const int8_t rgba[4] = { 0, 1, 2, -1};
+  static const int8_t bgra[4] = { 2, 1, 0, -1};
+  static const int8_t argb[4] = {-1, 0, 1, 2};
+  static const int8_t abgr[4] = {-1, 2, 1, 0};
+  static const int8_t yvu[3] = { 0, 2, 1};
+  const int8_t* map;
+
+  switch (format) {
+    case FORMAT_T_R8:
+      order[0] = 0;
+      return 1;
+    case FORMAT_T_A8B8G8R8:
+    case FORMAT_T_X8B8G8R8:
+      map = rgba;
+      break;
+    case FORMAT_T_A8R8G8B8:
+    case FORMAT_T_X8R8G8B8:
+    case FORMAT_T_A8Y8U8V8:
+      map = bgra;
+      break;
+    case FORMAT_T_B8G8R8A8:
+    case FORMAT_T_B8G8R8X8:
+    case FORMAT_T_V8U8Y8A8:
+      map = argb;
+      break;
+    case FORMAT_T_R8G8B8A8:
+    case FORMAT_T_R8G8B8X8:
+      map = abgr;
+      break;
+    case FORMAT_T_Y8___U8V8_N444:
+      map = rgba;
+      break;
+    case FORMAT_T_Y8___V8U8_N444:
+      map = yvu;
+      break;
+    default:
+      printf("nna_pixel_channel_order - unsupported pixel format %d\n", format);
+      return -1;
+  }
+
+  memcpy(order, map, calculate_pixel_channels(format));
+  return calculate_pixel_channels(format);
+}
+
+uint32_t nna_weight_bytes_int16(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c) {
+  return ((uint32_t)k * k_w * k_h * c * sizeof(int16_t) + 31) & 0xFFFFFFE0;
+}
+
+static uint32_t pack_weights_direct(const uint8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h,
+  uint16_t c, uint8_t bpe, uint8_t* out) {
+
+  // Kernels are split into groups of NNA_ATOMIC_K_SIZE (last group can have less
+  // kernels) and each kernel is broken into 1x1xNNA_ATOMIC_C_SIZE cubes. Within a
+  // kernel group the cubes are laid out C'->K->W->H->C where C' is a channel
+  // within a cube. Returns the bytes written before padding.
+  uint8_t* start = out;
+
+  for (uint16_t kg = 0; kg < k; kg += NNA_ATOMIC_K_SIZE) {
+    uint16_t kn = (k - kg) < NNA_ATOMIC_K_SIZE ? (k - kg) : NNA_ATOMIC_K_SIZE;
+    for (uint16_t cb = 0; cb < c; cb += NNA_ATOMIC_C_SIZE) {
+      uint16_t cn = (c - cb) < NNA_ATOMIC_C_SIZE ? (c - cb) : NNA_ATOMIC_C_SIZE;
+      for (uint8_t h = 0; h < k_h; h++) {
+        for (uint8_t w = 0; w < k_w; w++) {
+          for (uint16_t kk = kg; kk < kg + kn; kk++) {
+            memcpy(out, khwc + ((((uint32_t)kk * k_h + h) * k_w + w) * c + cb) * bpe, cn * bpe);
+            out += cn * bpe;
+          }
+        }
+      }
+    }
+  }
+
+  return out - start;
+}
+
+int nna_pack_weights(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int8_t* weights) {
+
+  // Convert KHWC weights to the direct convolution layout
+  uint32_t bytes = nna_weight_bytes(k, k_w, k_h, c);
+  uint32_t packed = pack_weights_direct((const uint8_t*)khwc, k, k_w, k_h, c, 1, (uint8_t*)weights);
+
+  memset(weights + packed, 0, bytes - packed);
+  return bytes;
+}
+
+int nna_pack_weights_int16(const int16_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int16_t* weights) {
+
+  // Same layout as nna_pack_weights() with 2 byte weights, so a 1x1x8 cube is 16 bytes
+  uint32_t bytes = nna_weight_bytes_int16(k, k_w, k_h, c);
+  uint32_t packed = pack_weights_direct((const uint8_t*)khwc, k, k_w, k_h, c, sizeof(int16_t),
+    (uint8_t*)weights);
+
+  memset((uint8_t*)weights + packed, 0, bytes - packed);
+  return bytes;
+}
+
+int nna_zero_point_bias(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int16_t zero_point, const int32_t* bias, int16_t* operand) {
+
+  // For an input with a zero point (padded with pad_value = zero_point) the
+  // accumulators include zero_point * sum of the kernel weights. Subtract it
+  // from each kernel's bias (NULL for none) so no correction is needed on the
+  // CPU. The corrected bias rarely fits the int16 X1 operand, it's written
+  // shifted right by the returned X1 shift_value (rounded as the hardware
+  // rounds) or -1 if no shift fits it.
+  uint32_t taps = (uint32_t)k_w * k_h * c;
+  int64_t max_abs = 0;
+  int shift = 0;
+
+  for (uint16_t kk = 0; kk < k; kk++) {
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < taps; i++)
+      sum += khwc[kk * taps + i];
+    int64_t corrected = (bias ? bias[kk] : 0) - zero_point * sum;
+    max_abs = llabs(corrected) > max_abs ? llabs(corrected) : max_abs;
+  }
+
+  while (nna_ref_shift_right(max_abs, shift) > 32767 && shift < NNA_SDP_MAX_SHIFT)
+    shift++;
+  if (nna_ref_shift_right(max_abs, shift) > 32767) {
+    printf("nna_zero_point_bias - corrected bias out of range\n");
+    return -1;
+  }
+
+  for (uint16_t kk = 0; kk < k; kk++) {
+    int64_t sum = 0;
+    for (uint32_t i = 0; i < taps; i++)
+      sum += khwc[kk * taps + i];
+    operand[kk] = nna_ref_shift_right((bias ? bias[kk] : 0) - zero_point * sum, shift);
+  }
+
+  return shift;
+}
+
+uint32_t nna_wmb_bytes(uint16_t k, uint32_t bytes_per_kernel) {
+
+  // One mask bit per weight, padded to the next 32 byte boundary
+  return (((uint32_t)k * bytes_per_kernel + 7) / 8 + 31) & 0xFFFFFFE0;
+}
+
+int nna_compress_weights(const int8_t* weights, uint16_t k, uint32_t bytes_per_kernel, int8_t* wt,
+  uint8_t* wmb, uint32_t* wgs) {
+
+  // Compress weights already in the direct convolution layout (nna_pack_weights()).
+  // wt receives the non zero weights, wmb a bit per weight (LSB first) set when
+  // the weight is non zero and wgs the bytes of wt used by each kernel group.
+  // Returns the bytes of wt padded to 32 bytes, wmb needs nna_wmb_bytes().
+  uint32_t total = (uint32_t)k * bytes_per_kernel;
+  uint32_t bytes = 0;
+  uint32_t bit = 0;
+
+  memset(wmb, 0, nna_wmb_bytes(k, bytes_per_kernel));
+
+  for (uint16_t kg = 0; kg < k; kg += NNA_ATOMIC_K_SIZE) {
+    uint16_t kn = (k - kg) < NNA_ATOMIC_K_SIZE ? (k - kg) : NNA_ATOMIC_K_SIZE;
+    uint32_t group_end = bit + kn * bytes_per_kernel;
+    uint32_t group_bytes = bytes;
+
+    for (; bit < group_end && bit < total; bit++) {
+      if (weights[bit]) {
+        wmb[bit >> 3] |= 1 << (bit & 7);
+        wt[bytes++] = weights[bit];
+      }
+    }
+
+    wgs[kg / NNA_ATOMIC_K_SIZE] = bytes - group_bytes;
+  }
+
+  memset(wt + bytes, 0, ((bytes + 31) & 0xFFFFFFE0) - bytes);
+  return (bytes + 31) & 0xFFFFFFE0;
+}
+
+int nna_pack_gemm_b(const int8_t* kn, uint16_t k, uint16_t n, int8_t* weights) {
+
+  // Convert a row major KxN matrix to N kernels of 1x1xK, fully connected
+  // weights stored NxK can be passed straight to nna_pack_weights(w, n, 1, 1, k)
+  int8_t* nk = (int8_t*)malloc((uint32_t)n * k);
+
+  if (!nk) {
+    printf("nna_pack_gemm_b - out of memory\n");
+    return -1;
+  }
+
+  for (uint16_t i = 0; i < k; i++)
+    for (uint16_t j = 0; j < n; j++)
+      nk[(uint32_t)j * k + i] = kn[(uint32_t)i * n + j];
+
+  int bytes = nna_pack_weights(nk, n, 1, 1, k, weights);
+  free(nk);
+  return bytes;
+}
+
+int nna_pack_weights_pixel(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint8_t c,
+  uint8_t format, int8_t* weights) {
+
+  // Convert KHWC weights (c is 1 for greyscale or 3 for RGB/YUV) for a pixel
+  // input convolution. Pixel input uses channel extension so each kernel row is
+  // treated as a single 1x1x(k_w * format channels) cube with the channels in
+  // the memory order of the pixel format. Unused channels get a zero weight.
+  int8_t order[4];
+  int pc = nna_pixel_channel_order(format, order);
+
+  if (pc < 0)
+    return -1;
+
+  uint16_t ext_c = k_w * pc;
+  int8_t* out = weights;
+  uint32_t bytes = nna_weight_bytes(k, k_w, k_h, pc);
+
+  for (uint16_t kg = 0; kg < k; kg += NNA_ATOMIC_K_SIZE) {
+    uint16_t kn = (k - kg) < NNA_ATOMIC_K_SIZE ? (k - kg) : NNA_ATOMIC_K_SIZE;
+    for (uint16_t cb = 0; cb < ext_c; cb += NNA_ATOMIC_C_SIZE) {
+      uint16_t cn = (ext_c - cb) < NNA_ATOMIC_C_SIZE ? (ext_c - cb) : NNA_ATOMIC_C_SIZE;
+      for (uint8_t h = 0; h < k_h; h++) {
+        for (uint16_t kk = kg; kk < kg + kn; kk++) {
+          for (uint16_t e = cb; e < cb + cn; e++) {
+            int8_t src = order[e % pc];
+            *out++ = (src < 0 || src >= c) ? 0 :
+              khwc[(((uint32_t)kk * k_h + h) * k_w + (e / pc)) * c + src];
+          }
+        }
+      }
+    }
+  }
+
+  memset(out, 0, bytes - (out - weights));
+  return bytes;
+}
+
+uint32_t nna_weight_bytes_grouped(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c, uint16_t groups) {
+
+  // Bytes needed by nna_pack_weights_grouped(), 0 if the grouping isn't supported
+  nna_group_slice slices[NNA_MAX_GROUP_SLICES];
+  int num_slices = nna_group_slices(c, k, groups, slices, NNA_MAX_GROUP_SLICES);
+  uint32_t bytes = 0;
+
+  for (int i = 0; i < num_slices; i++)
+    bytes += nna_weight_bytes(slices[i].out_kernels, k_w, k_h, slices[i].in_channels);
+
+  return bytes;
+}
+
+int nna_pack_weights_grouped(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  uint16_t groups, int8_t* weights) {
+
+  // Convert grouped KHWC weights (each kernel has c / groups channels) to the
+  // layout used by nna_plan_conv_grouped(), one direct convolution block per
+  // slice. Kernels are expanded to all channels of their slice with zero
+  // weights for channels outside their group. Returns the total bytes.
+  nna_group_slice slices[NNA_MAX_GROUP_SLICES];
+  int num_slices = nna_group_slices(c, k, groups, slices, NNA_MAX_GROUP_SLICES);
+
+  if (num_slices < 0)
+    return -1;
+
+  uint16_t group_c = c / groups;
+  uint16_t group_k = k / groups;
+  uint32_t bytes = 0;
+
+  for (int i = 0; i < num_slices; i++) {
+    nna_group_slice* slice = &slices[i];
+    uint32_t kernel_bytes = (uint32_t)k_h * k_w * slice->in_channels;
+    int8_t* dense = (int8_t*)calloc(slice->out_kernels, kernel_bytes);
+
+    if (!dense) {
+      printf("nna_pack_weights_grouped - out of memory\n");
+      return -1;
+    }
+
+    for (uint16_t kk = 0; kk < slice->out_kernels; kk++) {
+      uint16_t kernel = slice->out_kernel + kk;
+      for (uint8_t h = 0; h < k_h; h++) {
+        for (uint8_t w = 0; w < k_w; w++) {
+          for (uint16_t ci = 0; ci < slice->in_channels; ci++) {
+            uint16_t channel = slice->in_channel + ci;
+            if (channel / group_c != kernel / group_k)
+              continue;
+            dense[((kk * k_h + h) * k_w + w) * slice->in_channels + ci] =
+              khwc[(((uint32_t)kernel * k_h + h) * k_w + w) * group_c + (channel % group_c)];
+          }
+        }
+      }
+    }
+
+    bytes += nna_pack_weights(dense, slice->out_kernels, k_w, k_h, slice->in_channels, weights + bytes);
+    free(dense);
+  }
+
+  return bytes;
+}
+
+uint32_t nna_weight_bytes_csplit(uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c, uint16_t slice_c) {
+
+  // Bytes needed by nna_pack_weights_csplit()
+  uint32_t bytes = 0;
+
+  for (uint16_t cb = 0; cb < c; cb += slice_c)
+    bytes += nna_weight_bytes(k, k_w, k_h, (c - cb) < slice_c ? (c - cb) : slice_c);
+
+  return bytes;
+}
+
+int nna_pack_weights_csplit(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  uint16_t slice_c, int8_t* weights) {
+
+  // Convert KHWC weights to the layout used by nna_plan_conv_csplit(), one
+  // direct convolution block of all kernels for every slice_c input channels.
+  // Returns the total bytes.
+  uint32_t bytes = 0;
+  int8_t* slice = (int8_t*)malloc((uint32_t)k * k_h * k_w * slice_c);
+
+  if (!slice) {
+    printf("nna_pack_weights_csplit - out of memory\n");
+    return -1;
+  }
+
+  for (uint16_t cb = 0; cb < c; cb += slice_c) {
+    uint16_t cn = (c - cb) < slice_c ? (c - cb) : slice_c;
+    int8_t* out = slice;
+
+    for (uint32_t kk = 0; kk < (uint32_t)k * k_h * k_w; kk++) {
+      memcpy(out, khwc + kk * c + cb, cn);
+      out += cn;
+    }
+
+    bytes += nna_pack_weights(slice, k, k_w, k_h, cn, weights + bytes);
+  }
+
+  free(slice);
+  return bytes;
+}
+
+int nna_pack_weights_winograd(const int8_t* khwc, uint16_t k, uint16_t c, int8_t* weights,
+  uint8_t* shift) {
+
+  // Transform KHWC 3x3 weights to 4x4 Winograd F(2x2,3x3) weights G.g.Gt and
+  // convert to the direct convolution layout. G has halves so 2G is used which
+  // scales the weights by 4, they are then shifted right by *shift (same for
+  // all kernels) to fit int8. Accumulators are 4 / 2^shift times the direct ones.
+  static const int8_t g2[4][3] = { {2, 0, 0}, {1, 1, 1}, {1, -1, 1}, {0, 0, 2} };
+  uint32_t count = (uint32_t)k * 16 * c;
+  int16_t* wide = (int16_t*)malloc(count * sizeof(int16_t));
+  int8_t* transformed = (int8_t*)malloc(count);
+  int16_t max = 0;
+
+  if (!wide || !transformed) {
+    printf("nna_pack_weights_winograd - out of memory\n");
+    free(wide);
+    free(transformed);
+    return -1;
+  }
+
+  for (uint16_t kk = 0; kk < k; kk++) {
+    for (uint16_t ch = 0; ch < c; ch++) {
+      const int8_t* g = khwc + (uint32_t)kk * 9 * c + ch;
+      int16_t tmp[4][3];
+
+      // 2G.g
+      for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 3; j++)
+          tmp[i][j] = g2[i][0] * g[j * c] + g2[i][1] * g[(3 + j) * c] + g2[i][2] * g[(6 + j) * c];
+
+      // (2G.g).2Gt
+      for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+          int16_t v = tmp[i][0] * g2[j][0] + tmp[i][1] * g2[j][1] + tmp[i][2] * g2[j][2];
+          wide[((uint32_t)kk * 16 + i * 4 + j) * c + ch] = v;
+          max = (v > max) ? v : ((-v > max) ? -v : max);
+        }
+      }
+    }
+  }
+
+  *shift = 0;
+  while (((max + ((1 << *shift) >> 1)) >> *shift) > 127)
+    (*shift)++;
+
+  for (uint32_t i = 0; i < count; i++) {
+    int32_t v = *shift ? (wide[i] + (1 << (*shift - 1))) >> *shift : wide[i];
+    transformed[i] = v > 127 ? 127 : (v < -128 ? -128 : v);
+  }
+
+  int bytes = nna_pack_weights(transformed, k, 4, 4, c, weights);
+
+  free(wide);
+  free(transformed);
+  return bytes;
+}
+
+int nna_pack_weights_deconv(const int8_t* khwc, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int8_t* weights) {
+
+  // Convert transposed convolution weights for nna_plan_deconv(). Weights are
+  // KHWC with k output channels, each kernel is rotated 180 degrees so the
+  // transposed convolution becomes a direct one over the zero inserted input.
+  uint32_t kernel_bytes = (uint32_t)k_h * k_w * c;
+  int8_t* flipped = (int8_t*)malloc((uint32_t)k * kernel_bytes);
+
+  if (!flipped) {
+    printf("nna_pack_weights_deconv - out of memory\n");
+    return -1;
+  }
+
+  for (uint16_t kk = 0; kk < k; kk++)
+    for (uint8_t h = 0; h < k_h; h++)
+      for (uint8_t w = 0; w < k_w; w++)
+        memcpy(flipped + kk * kernel_bytes + ((k_h - 1 - h) * k_w + (k_w - 1 - w)) * c,
+          khwc + kk * kernel_bytes + (h * k_w + w) * c, c);
+
+  int bytes = nna_pack_weights(flipped, k, k_w, k_h, c, weights);
+  free(flipped);
+
+  return bytes;
+}
+
+int nna_pack_weights_bilinear(uint16_t c, int8_t* weights) {
+
+  // Depthwise 4x4 weights for 2x bilinear upsampling as a transposed convolution
+  // (stride 2, pad 1). Each output is a [1 3 3 1] x [1 3 3 1] weighting of its
+  // neighbours so SDP needs to shift the result right by 4. The kernel is
+  // symmetric so no flip is needed.
+  static const int8_t taps[4] = {1, 3, 3, 1};
+  int8_t* khwc = (int8_t*)malloc(c * 16);
+
+  if (!khwc) {
+    printf("nna_pack_weights_bilinear - out of memory\n");
+    return -1;
+  }
+
+  for (uint16_t kk = 0; kk < c; kk++)
+    for (uint8_t h = 0; h < 4; h++)
+      for (uint8_t w = 0; w < 4; w++)
+        khwc[(kk * 4 + h) * 4 + w] = taps[h] * taps[w];
+
+  int bytes = nna_pack_weights_grouped(khwc, c, 4, 4, c, c, weights);
+  free(khwc);
+
+  return bytes;
+}
+
+static inline void copy_atom(uint8_t* dst, const uint8_t* src, uint32_t bytes) {
+
+  // Move a single 1x1xNNA_ATOMIC_C_SIZE atom (8 bytes int8, 16 bytes int16)
+#ifdef __ARM_NEON
+  if (bytes == 8) {
+    vst1_u8(dst, vld1_u8(src));
+    return;
+  }
+  if (bytes == 16) {
+    vst1q_u8(dst, vld1q_u8(src));
+    return;
+  }
+#endif
+  memcpy(dst, src, bytes);
+}
+
+void nna_pack_feature_rows(const void* hwc, nna_data_cube* cube, uint8_t precision, void* feature,
+  uint16_t first_row, uint16_t last_row) {
+
+  // Convert rows [first_row, last_row) of a HWC tensor to feature format using
+  // the strides of cube. Channels beyond the end of the last atom are zeroed.
+  uint8_t bpe = 1 << precision;
+  uint32_t atom = NNA_ATOMIC_C_SIZE * bpe;
+  uint32_t pixel = cube->channel * bpe;
+  const uint8_t* src = (const uint8_t*)hwc;
+  uint8_t* dst = (uint8_t*)feature;
+
+  for (uint16_t c = 0; c < cube->channel; c += NNA_ATOMIC_C_SIZE) {
+    uint32_t bytes = ((cube->channel - c) < NNA_ATOMIC_C_SIZE ? (cube->channel - c) : NNA_ATOMIC_C_SIZE) * bpe;
+    uint8_t* surface = dst + (c / NNA_ATOMIC_C_SIZE) * cube->surf_stride;
+
+    for (uint16_t h = first_row; h < last_row; h++) {
+      const uint8_t* in = src + ((uint32_t)h * cube->width) * pixel + c * bpe;
+      uint8_t* out = surface + h * cube->line_stride;
+
+      if (pixel == atom) {
+        // Single full atom per pixel so the line is already in feature order
+        memcpy(out, in, cube->width * atom);
+      } else if (bytes == atom) {
+        for (uint16_t w = 0; w < cube->width; w++, in += pixel, out += atom)
+          copy_atom(out, in, atom);
+      } else {
+        for (uint16_t w = 0; w < cube->width; w++, in += pixel, out += atom) {
+          memcpy(out, in, bytes);
+          memset(out + bytes, 0, atom - bytes);
+        }
+      }
+    }
+  }
+}
+
+void nna_unpack_feature_rows(const void* feature, nna_data_cube* cube, uint8_t precision, void* hwc,
+  uint16_t first_row, uint16_t last_row) {
+
+  // Convert rows [first_row, last_row) of a feature format cube back to HWC
+  uint8_t bpe = 1 << precision;
+  uint32_t atom = NNA_ATOMIC_C_SIZE * bpe;
+  uint32_t pixel = cube->channel * bpe;
+  const uint8_t* src = (const uint8_t*)feature;
+  uint8_t* dst = (uint8_t*)hwc;
+
+  for (uint16_t c = 0; c < cube->channel; c += NNA_ATOMIC_C_SIZE) {
+    uint32_t bytes = ((cube->channel - c) < NNA_ATOMIC_C_SIZE ? (cube->channel - c) : NNA_ATOMIC_C_SIZE) * bpe;
+    const uint8_t* surface = src + (c / NNA_ATOMIC_C_SIZE) * cube->surf_stride;
+
+    for (uint16_t h = first_row; h < last_row; h++) {
+      const uint8_t* in = surface + h * cube->line_stride;
+      uint8_t* out = dst + ((uint32_t)h * cube->width) * pixel + c * bpe;
+
+      if (pixel == atom) {
+        memcpy(out, in, cube->width * atom);
+      } else if (bytes == atom) {
+        for (uint16_t w = 0; w < cube->width; w++, in += atom, out += pixel)
+          copy_atom(out, in, atom);
+      } else {
+        for (uint16_t w = 0; w < cube->width; w++, in += atom, out += pixel)
+          memcpy(out, in, bytes);
+      }
+    }
+  }
+}
+
+void nna_pack_feature(const void* hwc, nna_data_cube* cube, uint8_t precision, void* feature) {
+  nna_pack_feature_rows(hwc, cube, precision, feature, 0, cube->height);
+}
+
+void nna_unpack_feature(const void* feature, nna_data_cube* cube, uint8_t precision, void* hwc) {
+  nna_unpack_feature_rows(feature, cube, precision, hwc, 0, cube->height);
+}
+
+static void flip_sign(uint8_t* data, uint32_t bytes) {
+
+  // x ^ 0x80 maps uint8 x to int8 x - 128 and back
+  uint32_t i = 0;
+#ifdef __ARM_NEON
+  uint8x16_t bit = vdupq_n_u8(0x80);
+  for (; i + 16 <= bytes; i += 16)
+    vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), bit));
+#endif
+  for (; i < bytes; i++)
+    data[i] ^= 0x80;
+}
+
+void nna_pack_feature_uint8(const uint8_t* hwc, nna_data_cube* cube, int8_t* feature) {
+
+  // The NNA has no uint8 feature precision, uint8 data is packed as int8 with
+  // 128 subtracted so a zero point zp becomes zp - 128. Padding channels read
+  // as -128, they only meet the zero weights of padded channels.
+  nna_pack_feature(hwc, cube, PRECISION_INT8, feature);
+  flip_sign((uint8_t*)feature, cube->size);
+}
+
+void nna_unpack_feature_uint8(const int8_t* feature, nna_data_cube* cube, uint8_t* hwc) {
+
+  // Inverse of nna_pack_feature_uint8(), 128 is added back
+  nna_unpack_feature(feature, cube, PRECISION_INT8, hwc);
+  flip_sign(hwc, (uint32_t)cube->width * cube->height * cube->channel);
+}
+
+static void pack_operand_values(const int16_t* alu, const int16_t* mul, uint32_t count,
+  nna_sdp_op* op, uint8_t* out) {
+
+  // Write count operand values, narrowing to int8 with saturation if needed
+  // and interleaving ALU then MUL values when both are read from memory.
+  uint32_t i = 0;
+  uint8_t both = (op->type == SDP_OP_BOTH);
+  const int16_t* single = (op->type == SDP_OP_MUL) ? mul : alu;
+
+  if (op->precision == PRECISION_INT16) {
+    int16_t* dst = (int16_t*)out;
+#ifdef __ARM_NEON
+    for (; i + 8 <= count; i += 8) {
+      if (both) {
+        int16x8x2_t v = {{ vld1q_s16(alu + i), vld1q_s16(mul + i) }};
+        vst2q_s16(dst + 2 * i, v);
+      } else {
+        vst1q_s16(dst + i, vld1q_s16(single + i));
+      }
+    }
+#endif
+    for (; i < count; i++) {
+      if (both) {
+        dst[2 * i] = alu[i];
+        dst[2 * i + 1] = mul[i];
+      } else {
+        dst[i] = single[i];
+      }
+    }
+  } else {
+    int8_t* dst = (int8_t*)out;
+#ifdef __ARM_NEON
+    for (; i + 8 <= count; i += 8) {
+      if (both) {
+        int8x8x2_t v = {{ vqmovn_s16(vld1q_s16(alu + i)), vqmovn_s16(vld1q_s16(mul + i)) }};
+        vst2_s8(dst + 2 * i, v);
+      } else {
+        vst1_s8(dst + i, vqmovn_s16(vld1q_s16(single + i)));
+      }
+    }
+#endif
+    for (; i < count; i++) {
+      int16_t a = both ? alu[i] : single[i];
+      a = a > 127 ? 127 : (a < -128 ? -128 : a);
+      if (both) {
+        int16_t m = mul[i] > 127 ? 127 : (mul[i] < -128 ? -128 : mul[i]);
+        dst[2 * i] = a;
+        dst[2 * i + 1] = m;
+      } else {
+        dst[i] = a;
+      }
+    }
+  }
+}
+
+int nna_pack_sdp_kernel(const int16_t* alu, const int16_t* mul, uint16_t channel, nna_sdp_op* op,
+  void* operand) {
+
+  // Pack a per kernel operand (one value per output channel) for X1, X2 or Y.
+  // The operand is a 1x1xK feature cube so values are contiguous, the last atom
+  // is zero padded.
+  uint8_t bpe = calculate_sdp_operand_bytes(op);
+  uint32_t bytes = ((channel + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE) * NNA_ATOMIC_C_SIZE * bpe;
+
+  if ((op->type == SDP_OP_MUL || op->type == SDP_OP_BOTH) && !mul) {
+    printf("nna_pack_sdp_kernel - missing mul operand\n");
+    return -1;
+  }
+  if ((op->type == SDP_OP_ADD || op->type == SDP_OP_BOTH) && !alu) {
+    printf("nna_pack_sdp_kernel - missing alu operand\n");
+    return -1;
+  }
+
+  memset(operand, 0, bytes);
+  pack_operand_values(alu, mul, channel, op, (uint8_t*)operand);
+  return bytes;
+}
+
+int nna_pack_sdp_point(const int16_t* alu_hwc, const int16_t* mul_hwc, nna_data_cube* cube,
+  nna_sdp_op* op, void* operand) {
+
+  // Pack a per point operand from HWC values into the feature layout described
+  // by cube (see nna_sdp_operand_cube), each element may hold ALU and MUL values.
+  uint8_t bpe = calculate_sdp_operand_bytes(op);
+  uint8_t values = (op->type == SDP_OP_BOTH) ? 2 : 1;
+  const int16_t* alu = alu_hwc;
+  const int16_t* mul = mul_hwc;
+  uint8_t* dst = (uint8_t*)operand;
+
+  if ((values == 2 || op->type == SDP_OP_MUL) && !mul_hwc) {
+    printf("nna_pack_sdp_point - missing mul operand\n");
+    return -1;
+  }
+  if (op->type != SDP_OP_MUL && !alu_hwc) {
+    printf("nna_pack_sdp_point - missing alu operand\n");
+    return -1;
+  }
+
+  memset(operand, 0, cube->size);
+
+  for (uint16_t c = 0; c < cube->channel; c += NNA_ATOMIC_C_SIZE) {
+    uint16_t cn = (cube->channel - c) < NNA_ATOMIC_C_SIZE ? (cube->channel - c) : NNA_ATOMIC_C_SIZE;
+    for (uint16_t h = 0; h < cube->height; h++) {
+      uint8_t* out = dst + (c / NNA_ATOMIC_C_SIZE) * cube->surf_stride + h * cube->line_stride;
+      for (uint16_t w = 0; w < cube->width; w++, out += NNA_ATOMIC_C_SIZE * bpe) {
+        uint32_t pos = ((uint32_t)h * cube->width + w) * cube->channel + c;
+        pack_operand_values(alu ? alu + pos : 0, mul ? mul + pos : 0, cn, op, out);
+      }
+    }
+  }
+
+  return cube->size;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Worker pool for feature format pack/unpack. Each call splits the frame into
+ * one band of rows per worker, the submitting thread only waits for the bands
+ * to complete so the workers can be pinned away from it using a core mask.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+
+#define NNA_PACK_MAX_THREADS 8
+
+enum nna_pack_job { nna_job_pack, nna_job_unpack, nna_job_exit };
+
+struct nna_pack_worker {
+  nna_pack_pool* pool;
+  pthread_t thread;
+  uint8_t index;
+};
+
+struct nna_pack_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+
+  uint8_t threads;
+  uint32_t generation; // Incremented for each job submitted
+  uint8_t pending;     // Bands still being processed
+
+  /* Current job */
+  nna_pack_job job;
+  const void* src;
+  void* dst;
+  nna_data_cube* cube;
+  uint8_t precision;
+
+  nna_pack_worker workers[NNA_PACK_MAX_THREADS];
+};
+
+static void* nna_pack_worker_main(void* arg) {
+
+  nna_pack_worker* worker = (nna_pack_worker*)arg;
+  nna_pack_pool* pool = worker->pool;
+  uint32_t seen = 0;
+
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->generation == seen)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pool->job == nna_job_exit)
+      break;
+
+    // Split rows evenly, earlier bands take the remainder
+    uint16_t rows = pool->cube->height / pool->threads;
+    uint16_t extra = pool->cube->height % pool->threads;
+    uint16_t first = worker->index * rows + (worker->index < extra ? worker->index : extra);
+    uint16_t last = first + rows + (worker->index < extra);
+
+    if (first < last) {
+      if (pool->job == nna_job_pack)
+        nna_pack_feature_rows(pool->src, pool->cube, pool->precision, pool->dst, first, last);
+      else
+        nna_unpack_feature_rows(pool->src, pool->cube, pool->precision, pool->dst, first, last);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+      pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+static void nna_pack_pool_run(nna_pack_pool* pool, nna_pack_job job, const void* src,
+  nna_data_cube* cube, uint8_t precision, void* dst) {
+
+  pthread_mutex_lock(&pool->lock);
+  pool->job = job;
+  pool->src = src;
+  pool->dst = dst;
+  pool->cube = cube;
+  pool->precision = precision;
+  pool->pending = pool->threads;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+
+  if (job != nna_job_exit) {
+    while (pool->pending)
+      pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+nna_pack_pool* nna_pack_pool_create(uint8_t threads, uint32_t core_mask) {
+
+  // Create threads workers, if core_mask is non zero workers are restricted to
+  // the cores set in the mask (bit 0 is cpu0)
+  nna_pack_pool* pool;
+
+  if (threads == 0 || threads > NNA_PACK_MAX_THREADS) {
+    printf("nna_pack_pool_create - thread count %d not in range 1 to %d\n", threads,
+      NNA_PACK_MAX_THREADS);
+    return NULL;
+  }
+
+  pool = (nna_pack_pool*)calloc(1, sizeof(nna_pack_pool));
+  if (!pool) {
+    printf("nna_pack_pool_create - out of memory\n");
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (uint8_t i = 0; i < threads; i++) {
+    nna_pack_worker* worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+
+    if (pthread_create(&worker->thread, NULL, nna_pack_worker_main, worker)) {
+      printf("nna_pack_pool_create - failed to create worker %d\n", i);
+      pool->threads = i;
+      nna_pack_pool_destroy(pool);
+      return NULL;
+    }
+    pool->threads = i + 1;
+
+    if (core_mask) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for (int cpu = 0; cpu < 32; cpu++) {
+        if (core_mask & (1u << cpu))
+          CPU_SET(cpu, &cpus);
+      }
+      if (pthread_setaffinity_np(worker->thread, sizeof(cpus), &cpus))
+        printf("nna_pack_pool_create - unable to set core mask %x\n", core_mask);
+    }
+  }
+
+  return pool;
+}
+
+void nna_pack_pool_destroy(nna_pack_pool* pool) {
+
+  if (!pool)
+    return;
+
+  if (pool->threads) {
+    nna_pack_pool_run(pool, nna_job_exit, NULL, NULL, 0, NULL);
+    for (uint8_t i = 0; i < pool->threads; i++)
+      pthread_join(pool->workers[i].thread, NULL);
+  }
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+void nna_pack_feature_mt(nna_pack_pool* pool, const void* hwc, nna_data_cube* cube, uint8_t precision,
+  void* feature) {
+  nna_pack_pool_run(pool, nna_job_pack, hwc, cube, precision, feature);
+}
+
+void nna_unpack_feature_mt(nna_pack_pool* pool, const void* feature, nna_data_cube* cube,
+  uint8_t precision, void* hwc) {
+  nna_pack_pool_run(pool, nna_job_unpack, feature, cube, precision, hwc);
+}
@@ -20,14 +20,17 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "nna_hw.h"
+#include "nna_config.h"
 #include "nna_interface.h"
+#include "nna_plan.h"
 
 /* The reciprocal of kernel width: 1/1, 1/2, 1/3, ... */
 static const uint32_t recip_kernel_size[8] =
 	/*
-	 * INT8
+	 * INT8 and INT16
 	 * 1      1/2     1/3     1/4     1/5     1/6     1/7     1/8
 	 */
 	{0x10000, 0x8000, 0x5555, 0x4000, 0x3333, 0x2aaa, 0x2492, 0x2000};
@@ -51,13 +54,131 @@ void nna_pdp_enable(uint8_t enable_stats, uint8_t is_rdma_needed) {
   xregw(0xB008u, 0x01); // PDP_D_OP_ENABLE_0
 }
 
+int nna_pdp_plan_split(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_surface) {
+
+  // The line buffer holds the rows of partially pooled output that overlapping
+  // kernels are still adding to, wider outputs are pooled in splits of whole
+  // output columns. The first split starts at the left padding and ends at its
+  // last kernel, each following split moves on by its outputs * stride and the
+  // hardware re-reads the kernel - stride columns that overlap the previous
+  // split. The last split takes the remaining input up to its last kernel and
+  // the right padding, input columns after the last kernel aren't read.
+  uint16_t in_w = pdp_surface->src_data.width;
+  uint16_t out_w = pdp_surface->dst_data.width;
+  uint8_t lines = (pdp_op->pool_height + pdp_op->stride_y - 1) / pdp_op->stride_y;
+  uint16_t max_out = NNA_PDP_BUFFER_SIZE / (NNA_ATOMIC_C_SIZE * (2 << (pdp_op->precision & 0x01)) * lines);
+
+  if ((in_w + pdp_op->pad_left + pdp_op->pad_right - pdp_op->pool_width) / pdp_op->stride_x + 1 != out_w) {
+    printf("nna_pdp_plan_split - input width %d with %dx%d kernel stride %d pad %d/%d isn't output width %d\n",
+      in_w, pdp_op->pool_width, pdp_op->pool_height, pdp_op->stride_x, pdp_op->pad_left, pdp_op->pad_right,
+      out_w);
+    return -1;
+  }
+
+  // Input widths must also fit the split width registers, a first split
+  // reads up to its last kernel and a mid split moves on by outputs * stride
+  if ((max_out - 1) * pdp_op->stride_x + pdp_op->pool_width > NNA_PDP_MAX_SPLIT_WIDTH)
+    max_out = (NNA_PDP_MAX_SPLIT_WIDTH - pdp_op->pool_width) / pdp_op->stride_x + 1;
+  if (max_out * pdp_op->stride_x > NNA_PDP_MAX_SPLIT_WIDTH)
+    max_out = NNA_PDP_MAX_SPLIT_WIDTH / pdp_op->stride_x;
+
+  uint16_t splits = (out_w + max_out - 1) / max_out;
+  if (splits > NNA_PDP_MAX_SPLITS) {
+    printf("nna_pdp_plan_split - output width %d needs %d splits\n", out_w, splits);
+    return -1;
+  }
+
+  // On the fly the input streams from SDP once so splits can't overlap
+  if (splits > 1 && !pdp_surface->src_data.address && pdp_op->pool_width > pdp_op->stride_x) {
+    printf("nna_pdp_plan_split - output width %d needs overlapping splits, pool from memory instead\n",
+      out_w);
+    return -1;
+  }
+
+  pdp_op->split_num = splits;
+
+  if (splits == 1) {
+    pdp_op->partial_in_width_first = in_w;
+    pdp_op->partial_in_width_mid = 0;
+    pdp_op->partial_in_width_last = 0;
+    pdp_op->partial_out_width_first = out_w;
+    pdp_op->partial_out_width_mid = 0;
+    pdp_op->partial_out_width_last = 0;
+    return 0;
+  }
+
+  // Input read up to the end of the last kernel
+  int32_t used_w = (out_w - 1) * pdp_op->stride_x + pdp_op->pool_width - pdp_op->pad_left;
+  if (used_w > in_w)
+    used_w = in_w;
+
+  // Outputs shared out evenly, the last split takes what's left. It must
+  // still read a column past the previous split, when its kernels are all in
+  // the overlap or right padding the splits are made smaller.
+  uint16_t out_split = (out_w + splits - 1) / splits;
+  int32_t in_first;
+  int32_t in_last;
+  int32_t out_last;
+
+  while (1) {
+    in_first = (out_split - 1) * pdp_op->stride_x + pdp_op->pool_width - pdp_op->pad_left;
+    in_last = used_w - in_first - (splits - 2) * out_split * pdp_op->stride_x;
+    out_last = out_w - (splits - 1) * out_split;
+    if ((in_last > 0 && out_last > 0) || out_split == 1)
+      break;
+    out_split--;
+    splits = (out_w + out_split - 1) / out_split;
+  }
+
+  if (splits > NNA_PDP_MAX_SPLITS || in_last < 1 || out_last < 1 || in_first > NNA_PDP_MAX_SPLIT_WIDTH ||
+    in_last > NNA_PDP_MAX_SPLIT_WIDTH) {
+    printf("nna_pdp_plan_split - output width %d can't be split (%d splits, last input width %d)\n",
+      out_w, splits, in_last);
+    return -1;
+  }
+
+  pdp_op->split_num = splits;
+
+  pdp_op->partial_out_width_first = out_split;
+  pdp_op->partial_out_width_mid = splits > 2 ? out_split : 0;
+  pdp_op->partial_out_width_last = out_last;
+
+  pdp_op->partial_in_width_first = in_first;
+  pdp_op->partial_in_width_mid = splits > 2 ? out_split * pdp_op->stride_x : 0;
+  pdp_op->partial_in_width_last = in_last;
+
+  return 0;
+}
+
 int processor_pdp_program(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_surface) {
 
 
   uint8_t fly_mode_off;
+  uint32_t partial_in;
+  uint32_t partial_out;
 
   fly_mode_off = pdp_surface->src_data.address != 0;
 
+  if (pdp_op->pool_width < 1 || pdp_op->pool_width > 8 || pdp_op->pool_height < 1 ||
+    pdp_op->pool_height > 8) {
+    printf("processor_pdp_program - %dx%d kernel not supported, see nna_plan_pool()\n",
+      pdp_op->pool_width, pdp_op->pool_height);
+    return -1;
+  }
+
+  if (nna_pdp_plan_split(pdp_op, pdp_surface))
+    return -1;
+
+  // Widths are programmed less one, first in [9:0], last in [19:10], mid in [29:20]
+  partial_in = 0;
+  partial_out = 0;
+  if (pdp_op->split_num > 1) {
+    partial_in = (pdp_op->partial_in_width_first - 1) | (pdp_op->partial_in_width_last - 1) << 10 |
+      (pdp_op->partial_in_width_mid ? pdp_op->partial_in_width_mid - 1 : 0) << 20;
+    partial_out = (pdp_op->partial_out_width_first - 1) | (pdp_op->partial_out_width_last - 1) << 10 |
+      (pdp_op->partial_out_width_mid ? pdp_op->partial_out_width_mid - 1 : 0) << 20;
+  }
+
   xregw(0xA018u, fly_mode_off);  // PDP_RDMA_D_FLYING_MODE_0  (input from sdp or memory)
 
   if (fly_mode_off) {
@@ -68,9 +189,11 @@ int processor_pdp_program(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_sur
     xregw(0xA024u, pdp_surface->src_data.line_stride);  // PDP_RDMA_D_SRC_LINE_STRIDE_0
     xregw(0xA028u, pdp_surface->src_data.surf_stride);  // PDP_RDMA_D_SRC_SURFACE_STRIDE_0
     xregw(0xA02Cu, 1u); // PDP_RDMA_D_SRC_RAM_CFG_0 (from MC)
-    xregw(0xA030u, 0u); //PDP_RDMA_D_DATA_FORMAT_0 (int8)
+    xregw(0xA030u, pdp_op->precision & 0x03); //PDP_RDMA_D_DATA_FORMAT_0 (int8 or int16)
     xregw(0xA038u, (pdp_op->pool_width - 1) | ((pdp_op->stride_x - 1) << 4));  // PDP_RDMA_D_POOLING_KERNEL_CFG_0
     xregw(0xA03Cu, pdp_op->pad_left); // PDP_RDMA_D_POOLING_PADDING_CFG_0
+    xregw(0xA034u, pdp_op->split_num - 1); // PDP_RDMA_D_OPERATION_MODE_CFG_0
+    xregw(0xA040u, partial_in); // PDP_RDMA_D_PARTIAL_WIDTH_IN_0
     xregw(0xB068u, pdp_surface->src_data.line_stride); // PDP_D_SRC_LINE_STRIDE_0
     xregw(0xB06Cu, pdp_surface->src_data.surf_stride); // PDP_D_SRC_SURFACE_STRIDE_0
   }
@@ -83,25 +206,24 @@ int processor_pdp_program(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_sur
   xregw(0xB020u, pdp_surface->dst_data.channel - 1); // PDP_D_DATA_CUBE_OUT_CHANNEL_0
 
   xregw(0xB024u, pdp_op->pool_mode | (fly_mode_off << 4) | ((pdp_op->split_num - 1) << 8));  // PDP_D_OPERATION_MODE_CFG_0
+  xregw(0xB02Cu, partial_in); // PDP_D_PARTIAL_WIDTH_IN_0
+  xregw(0xB030u, partial_out); // PDP_D_PARTIAL_WIDTH_OUT_0
   xregw(0xB034u, (pdp_op->pool_width - 1) | ((pdp_op->pool_height - 1) << 8) | ((pdp_op->stride_x - 1) << 16 ) |
     (pdp_op->stride_y - 1) <<20 ); // PDP_D_POOLING_KERNEL_CFG_0
 
-  xregw(0xB038u, recip_kernel_size[pdp_op->pool_width-1]); // PDP_D_RECIP_KERNEL_WIDTH_0
-  xregw(0xB03Cu, recip_kernel_size[pdp_op->pool_height-1]); // PDP_D_RECIP_KERNEL_HEIGHT_0
+  xregw(0xB038u, pdp_op->recip_width ? pdp_op->recip_width :
+    recip_kernel_size[pdp_op->pool_width-1]); // PDP_D_RECIP_KERNEL_WIDTH_0
+  xregw(0xB03Cu, pdp_op->recip_height ? pdp_op->recip_height :
+    recip_kernel_size[pdp_op->pool_height-1]); // PDP_D_RECIP_KERNEL_HEIGHT_0
 //  xregw(0xB038u, pdp_op->pool_width-1); // PDP_D_RECIP_KERNEL_WIDTH_0
 //  xregw(0xB03Cu, pdp_op->pool_height-1); // PDP_D_RECIP_KERNEL_HEIGHT_0
 
   xregw(0xB040u, pdp_op->pad_left | (pdp_op->pad_top << 4) | (pdp_op->pad_right << 8) |
     (pdp_op->pad_bottom << 12)); // PDP_D_POOLING_PADDING_CFG_0
 
-  // Set all padding values to zeros for (now)
-  xregw(0xB044u, 0); // PDP_D_POOLING_PADDING_VALUE_1_CFG_0
-  xregw(0xB048u, 0); // PDP_D_POOLING_PADDING_VALUE_2_CFG_0
-  xregw(0xB04Cu, 0); // PDP_D_POOLING_PADDING_VALUE_3_CFG_0
-  xregw(0xB050u, 0); // PDP_D_POOLING_PADDING_VALUE_4_CFG_0
-  xregw(0xB054u, 0); // PDP_D_POOLING_PADDING_VALUE_5_CFG_0
-  xregw(0xB058u, 0); // PDP_D_POOLING_PADDING_VALUE_6_CFG_0
-  xregw(0xB05Cu, 0); // PDP_D_POOLING_PADDING_VALUE_7_CFG_0
+  // Padding value n is the sum of n padded elements, used by average pooling
+  for (int n = 1; n <= 7; n++)
+    xregw(0xB044u + (n - 1) * 4, (pdp_op->pad_value * n) & 0x7FFFF); // PDP_D_POOLING_PADDING_VALUE_n_CFG_0
 
   xregw(0xB028u, 0); // PDP_D_NAN_FLUSH_TO_ZERO_0 ( 0 - disable, 1 - enable )
 
@@ -110,11 +232,19 @@ int processor_pdp_program(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_sur
   xregw(0xB078u, pdp_surface->dst_data.line_stride);  // PDP_D_DST_LINE_STRIDE_0
   xregw(0xB07Cu, pdp_surface->dst_data.surf_stride);  // PDP_D_DST_SURFACE_STRIDE_0
   xregw(0xB080u, 1u); // PDP_D_DST_RAM_CFG_0  (set to MC)
-  xregw(0xB084u, 0); // PDP_D_DATA_FORMAT_0 (set to int8)
+  xregw(0xB084u, pdp_op->precision & 0x03); // PDP_D_DATA_FORMAT_0 (int8 or int16)
 
   return 0;
 }
 
 int nna_pdp_program(nna_pdp_op_desc* pdp_op, nna_pdp_surface_desc* pdp_surface) {
+
+  // Ops started by nna_pool_submit() use the same register group, it can't be
+  // reprogrammed until they finish
+  if (!nna_poll(NNA_POOL_DONE)) {
+    printf("nna_pdp_program - submitted pooling op still running\n");
+    return -1;
+  }
+
   return processor_pdp_program(pdp_op,pdp_surface);
 }
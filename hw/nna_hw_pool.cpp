@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Pooling from memory on PDP. Kernels up to 8x8 are a single PDP op with any
+ * stride and padding. Larger kernels that don't overlap (stride of the kernel
+ * size, such as global pooling) are pooled in stages, each stage pooling
+ * with a factor of the kernel:
+ *
+ * - avg(k1 * k2) = avg(k2) of avg(k1) and max/min likewise, results between
+ *   stages go to a scratch buffer at the pool precision.
+ * - A global pool of a size with no factors up to 8 (11, 13, 17 ...) pads
+ *   the input on the right/bottom with zeros to one that has, the last
+ *   stage's reciprocal is scaled so the average is over the real elements.
+ *
+ * An image pyramid is repeated 2x2 average pooling, each level read from
+ * the one before and written as a feature cube that conv can read directly.
+ * uint8 frames are packed with nna_pack_feature_uint8() and the levels read
+ * back with nna_unpack_feature_uint8(), the 128 subtracted on packing passes
+ * through the averages unchanged. PDP rounds after each of its width and
+ * height reciprocals, halves of negative values away from zero, so levels
+ * can differ by one in either direction from a rounded uint8 average.
+ *
+ * Pooling ops run in PDP register group 0 and complete on PDP_DONE_STATUS0,
+ * which the conv/SDP waits don't include. nna_pool_submit() starts one and
+ * returns so conv/SDP can work on another tensor in the meantime, but only
+ * until the next nna_reset(). That waits for the pooling first, so it
+ * overlaps a single conv/SDP op (the first tile of nna_run_conv_tiles() or
+ * nna_gemm()). No other PDP op can be programmed until it finishes.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+#define PDP_MAX_STRIDE 16
+#define PDP_MAX_PAD 7
+
+static uint8_t pool_running; // An op started by nna_pool_submit() not yet waited for
+
+struct pool_stages {
+  uint8_t num;
+  uint8_t k_w[NNA_MAX_POOL_STAGES]; // Kernel of each stage
+  uint8_t k_h[NNA_MAX_POOL_STAGES];
+  uint16_t padded_w;                // Kernel size after padding
+  uint16_t padded_h;
+};
+
+static int factor_kernel(uint16_t size, int stages, uint8_t* factors) {
+
+  // Factors of size up to NNA_PDP_MAX_KERNEL, largest first, padded with 1s
+  if (size == 1) {
+    for (int i = 0; i < stages; i++)
+      factors[i] = 1;
+    return 1;
+  }
+
+  if (!stages)
+    return 0;
+
+  for (uint8_t f = NNA_PDP_MAX_KERNEL; f >= 2; f--) {
+    if (size % f == 0 && factor_kernel(size / f, stages - 1, factors + 1)) {
+      factors[0] = f;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int plan_kernel(uint16_t kernel, uint8_t global, uint8_t* factors, uint16_t* padded) {
+
+  // Fewest stages for a kernel then the least padding, only a global pool can
+  // be padded and the padding must be less than the first kernel
+  for (int stages = 1; stages <= NNA_MAX_POOL_STAGES; stages++) {
+    for (uint16_t size = kernel; size <= kernel + (global ? PDP_MAX_PAD : 0); size++) {
+      if (factor_kernel(size, stages, factors) && size - kernel < factors[0]) {
+        for (int i = stages; i < NNA_MAX_POOL_STAGES; i++)
+          factors[i] = 1;
+        *padded = size;
+        return stages;
+      }
+    }
+  }
+  return -1;
+}
+
+static int plan_stages(nna_pool_desc* pool, pool_stages* stages) {
+
+  uint8_t global_w = pool->kernel_w == pool->src.width;
+  uint8_t global_h = pool->kernel_h == pool->src.height;
+
+  if (pool->kernel_w <= NNA_PDP_MAX_KERNEL && pool->kernel_h <= NNA_PDP_MAX_KERNEL) {
+    stages->num = 1;
+    stages->k_w[0] = pool->kernel_w;
+    stages->k_h[0] = pool->kernel_h;
+    stages->padded_w = pool->kernel_w;
+    stages->padded_h = pool->kernel_h;
+    return 1;
+  }
+
+  if (pool->stride_x != pool->kernel_w || pool->stride_y != pool->kernel_h || pool->pad_left ||
+    pool->pad_right || pool->pad_top || pool->pad_bottom) {
+    printf("nna_plan_pool - %dx%d kernel needs a stride of the kernel size and no padding\n",
+      pool->kernel_w, pool->kernel_h);
+    return -1;
+  }
+
+  int stages_w = plan_kernel(pool->kernel_w, global_w, stages->k_w, &stages->padded_w);
+  int stages_h = plan_kernel(pool->kernel_h, global_h, stages->k_h, &stages->padded_h);
+  if (stages_w < 0 || stages_h < 0) {
+    printf("nna_plan_pool - %dx%d kernel can't be split into %dx%d kernels\n", pool->kernel_w,
+      pool->kernel_h, NNA_PDP_MAX_KERNEL, NNA_PDP_MAX_KERNEL);
+    return -1;
+  }
+
+  stages->num = stages_w > stages_h ? stages_w : stages_h;
+  return stages->num;
+}
+
+static uint32_t stage_bytes(nna_pool_desc* pool, pool_stages* stages, int stage) {
+
+  // Size of the output of a stage before the last
+  uint16_t w = pool->dst.width * stages->padded_w;
+  uint16_t h = pool->dst.height * stages->padded_h;
+
+  for (int i = 0; i <= stage; i++) {
+    w /= stages->k_w[i];
+    h /= stages->k_h[i];
+  }
+
+  uint32_t bytes = w * h * NNA_ATOMIC_C_SIZE * (1 << pool->precision) *
+    ((pool->src.channel + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE);
+  return (bytes + 31) & ~31;
+}
+
+uint32_t nna_pool_scratch_bytes(nna_pool_desc* pool) {
+
+  // Stages write alternately to the start of the scratch buffer and after
+  // the first stage output
+  pool_stages stages;
+
+  if (plan_stages(pool, &stages) <= 1)
+    return 0;
+
+  return stage_bytes(pool, &stages, 0) + (stages.num > 2 ? stage_bytes(pool, &stages, 1) : 0);
+}
+
+int nna_plan_pool(nna_pool_desc* pool, nna_pdp_pass* passes, int max_passes) {
+
+  // Plan the PDP ops for a pooling op, returns the number of passes
+  pool_stages stages;
+  nna_data_cube in;
+
+  if (!pool->src.address || !pool->dst.address) {
+    printf("nna_plan_pool - input and output must be in memory\n");
+    return -1;
+  }
+
+  if (plan_stages(pool, &stages) < 0)
+    return -1;
+
+  if (stages.num > max_passes) {
+    printf("nna_plan_pool - needs %d passes, only %d available\n", stages.num, max_passes);
+    return -1;
+  }
+
+  if (stages.num == 1) {
+    nna_pdp_op_desc* pdp_op = &passes->pdp_op;
+
+    if (pool->stride_x > PDP_MAX_STRIDE || pool->stride_y > PDP_MAX_STRIDE) {
+      printf("nna_plan_pool - stride %dx%d not supported\n", pool->stride_x, pool->stride_y);
+      return -1;
+    }
+
+    memset(passes, 0, sizeof(nna_pdp_pass));
+    pdp_op->precision = pool->precision;
+    pdp_op->pool_mode = pool->mode;
+    pdp_op->pool_width = pool->kernel_w;
+    pdp_op->pool_height = pool->kernel_h;
+    pdp_op->stride_x = pool->stride_x;
+    pdp_op->stride_y = pool->stride_y;
+    pdp_op->pad_left = pool->pad_left;
+    pdp_op->pad_right = pool->pad_right;
+    pdp_op->pad_top = pool->pad_top;
+    pdp_op->pad_bottom = pool->pad_bottom;
+    pdp_op->pad_value = pool->pad_value;
+    passes->pdp_surface.src_data = pool->src;
+    passes->pdp_surface.dst_data = pool->dst;
+    return 1;
+  }
+
+  if (!pool->scratch_address) {
+    printf("nna_plan_pool - %dx%d kernel needs a scratch buffer\n", pool->kernel_w, pool->kernel_h);
+    return -1;
+  }
+
+  if (pool->src.width / pool->kernel_w != pool->dst.width ||
+    pool->src.height / pool->kernel_h != pool->dst.height || pool->src.channel != pool->dst.channel) {
+    printf("nna_plan_pool - output %dx%dx%d doesn't match input %dx%dx%d\n", pool->dst.width,
+      pool->dst.height, pool->dst.channel, pool->src.width, pool->src.height, pool->src.channel);
+    return -1;
+  }
+
+  // Columns and rows past the last whole kernel are dropped
+  in = pool->src;
+  in.width = pool->dst.width * pool->kernel_w;
+  in.height = pool->dst.height * pool->kernel_h;
+
+  uint32_t second = stage_bytes(pool, &stages, 0);
+
+  for (int i = 0; i < stages.num; i++) {
+    nna_pdp_op_desc* pdp_op = &passes[i].pdp_op;
+    nna_pdp_surface_desc* pdp_surface = &passes[i].pdp_surface;
+
+    memset(&passes[i], 0, sizeof(nna_pdp_pass));
+    pdp_op->precision = pool->precision;
+    pdp_op->pool_mode = pool->mode;
+    pdp_op->pool_width = stages.k_w[i];
+    pdp_op->pool_height = stages.k_h[i];
+    pdp_op->stride_x = stages.k_w[i];
+    pdp_op->stride_y = stages.k_h[i];
+
+    if (i == 0) {
+      pdp_op->pad_right = stages.padded_w - pool->kernel_w;
+      pdp_op->pad_bottom = stages.padded_h - pool->kernel_h;
+    }
+
+    // The padding is zeros, the last stage of each dimension averages over
+    // the real elements instead of the padded kernel
+    if (stages.padded_w != pool->kernel_w && (i == stages.num - 1 || stages.k_w[i + 1] == 1) &&
+      stages.k_w[i] != 1)
+      pdp_op->recip_width = (0x10000 * stages.padded_w + pool->kernel_w * stages.k_w[i] / 2) /
+        (pool->kernel_w * stages.k_w[i]);
+    if (stages.padded_h != pool->kernel_h && (i == stages.num - 1 || stages.k_h[i + 1] == 1) &&
+      stages.k_h[i] != 1)
+      pdp_op->recip_height = (0x10000 * stages.padded_h + pool->kernel_h * stages.k_h[i] / 2) /
+        (pool->kernel_h * stages.k_h[i]);
+
+    pdp_surface->src_data = in;
+    if (i == stages.num - 1) {
+      pdp_surface->dst_data = pool->dst;
+    } else {
+      nna_feature_cube(&pdp_surface->dst_data, pool->scratch_address + (i & 1 ? second : 0),
+        (in.width + pdp_op->pad_right) / stages.k_w[i], (in.height + pdp_op->pad_bottom) / stages.k_h[i],
+        in.channel, pool->precision);
+    }
+    in = pdp_surface->dst_data;
+  }
+
+  return stages.num;
+}
+
+int nna_pool_submit(nna_pdp_pass* pass) {
+
+  // Start a PDP op from memory in register group 0 and return, its completion
+  // bit is PDP's own so conv/SDP ops can run and be waited for before it
+  // finishes. The next nna_reset() waits for it, so it only overlaps the
+  // conv/SDP op up to the first reset.
+  if (!pass->pdp_surface.src_data.address) {
+    printf("nna_pool_submit - input must be in memory\n");
+    return -1;
+  }
+
+  if (pool_running) {
+    printf("nna_pool_submit - previous pooling op not waited for\n");
+    return -1;
+  }
+
+  nna_pdp_set_producer(0,0);
+
+  if (nna_pdp_program(&pass->pdp_op, &pass->pdp_surface))
+    return -1;
+
+  nna_submit(NNA_POOL_DONE);
+  pool_running = 1;
+
+  nna_pdp_enable(0,1);
+
+  return 0;
+}
+
+int nna_pool_poll() {
+
+  // Returns 1 once the submitted op has finished
+  if (!pool_running)
+    return 1;
+
+  if (!nna_poll(NNA_POOL_DONE))
+    return 0;
+
+  pool_running = 0;
+  return 1;
+}
+
+int nna_pool_wait() {
+
+  if (!pool_running)
+    return 0;
+
+  pool_running = 0;
+  return nna_wait(NNA_POOL_DONE);
+}
+
+int nna_run_pdp_passes(nna_pdp_pass* passes, int num_passes) {
+
+  // Run PDP on its own reading from and writing to memory
+  for (int i = 0; i < num_passes; i++) {
+    if (nna_pool_submit(&passes[i]) || nna_pool_wait())
+      return -1;
+    nna_reset();
+  }
+
+  return 0;
+}
+
+int nna_pool(nna_pool_desc* pool) {
+
+  nna_pdp_pass passes[NNA_MAX_POOL_STAGES];
+
+  int num_passes = nna_plan_pool(pool, passes, NNA_MAX_POOL_STAGES);
+  if (num_passes < 0)
+    return -1;
+
+  return nna_run_pdp_passes(passes, num_passes);
+}
+
+static int pyramid_levels(nna_pyramid_desc* pyramid, uint32_t address) {
+
+  // Describe the level cubes from address, odd rows and columns are dropped
+  // by the 2x2 kernel
+  nna_data_cube* prev = &pyramid->image;
+
+  if (pyramid->levels < 1 || pyramid->levels > NNA_MAX_PYRAMID_LEVELS) {
+    printf("nna_plan_pyramid - %d levels not supported\n", pyramid->levels);
+    return -1;
+  }
+
+  for (int i = 0; i < pyramid->levels; i++) {
+    if (prev->width < 2 || prev->height < 2) {
+      printf("nna_plan_pyramid - %dx%d image too small for %d levels\n", pyramid->image.width,
+        pyramid->image.height, pyramid->levels);
+      return -1;
+    }
+
+    nna_feature_cube(&pyramid->level[i], address, prev->width / 2, prev->height / 2,
+      prev->channel, pyramid->precision);
+    address += (pyramid->level[i].size + 31) & ~31;
+    prev = &pyramid->level[i];
+  }
+
+  return 0;
+}
+
+uint32_t nna_pyramid_bytes(nna_pyramid_desc* pyramid) {
+
+  // Levels are laid out from 0 to size them, nna_plan_pyramid() places them
+  if (pyramid_levels(pyramid, 0))
+    return 0;
+
+  nna_data_cube* last = &pyramid->level[pyramid->levels - 1];
+  return last->address + ((last->size + 31) & ~31);
+}
+
+int nna_plan_pyramid(nna_pyramid_desc* pyramid, nna_pdp_pass* passes, int max_passes) {
+
+  // One offline PDP op per level, returns the number of passes
+  nna_pool_desc pool;
+
+  if (!pyramid->image.address || !pyramid->address) {
+    printf("nna_plan_pyramid - image and levels must be in memory\n");
+    return -1;
+  }
+
+  if (pyramid_levels(pyramid, pyramid->address))
+    return -1;
+
+  if (pyramid->levels > max_passes) {
+    printf("nna_plan_pyramid - needs %d passes, only %d available\n", pyramid->levels, max_passes);
+    return -1;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pool.mode = POOL_MODE_AVG;
+  pool.precision = pyramid->precision;
+  pool.kernel_w = 2;
+  pool.kernel_h = 2;
+  pool.stride_x = 2;
+  pool.stride_y = 2;
+
+  for (int i = 0; i < pyramid->levels; i++) {
+    pool.src = i ? pyramid->level[i - 1] : pyramid->image;
+    pool.dst = pyramid->level[i];
+    if (nna_plan_pool(&pool, &passes[i], 1) != 1)
+      return -1;
+  }
+
+  return pyramid->levels;
+}
+
+int nna_pyramid(nna_pyramid_desc* pyramid) {
+
+  nna_pdp_pass passes[NNA_MAX_PYRAMID_LEVELS];
+
+  int num_passes = nna_plan_pyramid(pyramid, passes, NNA_MAX_PYRAMID_LEVELS);
+  if (num_passes < 0)
+    return -1;
+
+  return nna_run_pdp_passes(passes, num_passes);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Model load time folding of conv bias, batch norm and per channel
+ * quantisation into the SDP X1/X2 per kernel operands. For kernel k the real
+ * conv output is acc * in_scale * weight_scale[k], batch norm and the output
+ * scale make the int8 output an affine function of the accumulator
+ *
+ *   out = acc * M[k] + B[k] + zero_point
+ *
+ * X1 multiplies by M[k] as an int16 with a common right shift, keeping
+ * NNA_REQUANT_FRAC fraction bits, X2 adds B[k] in the same fixed point (and
+ * applies relu) and the output converter removes the fraction bits and adds
+ * the zero point. This runs networks quantised per channel on the NNA without
+ * requantising on the CPU.
+ *
+ * PReLU and leaky relu slopes are quantised for any X or Y stage multiplier
+ * in PReLU mode, which scales negative values only. The truncate of the stage
+ * is chosen so the largest slope uses the full int16 range, positive values
+ * bypass it so the stage doesn't change their scale.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+
+#define NNA_REQUANT_FRAC 8
+#define NNA_REQUANT_MAX_SHIFT 48
+#define NNA_SLOPE_MAX_SHIFT 31
+
+static int16_t round_int16(float x) {
+  x = roundf(x);
+  return x > 32767.0f ? 32767 : (x < -32768.0f ? -32768 : (int16_t)x);
+}
+
+int nna_fold_requant(const nna_requant_desc* requant, nna_sdp_op_desc* sdp_op, void* x1_operand,
+  void* x2_operand) {
+
+  // Fold the per kernel scales and offsets into X1 (mul) and X2 (add) operands
+  // and configure both stages and the output converter. Each operand holds one
+  // int16 per kernel zero padded to the atom, the packed size is returned.
+  float* m = (float*)malloc(requant->k * sizeof(float));
+  float* b = (float*)malloc(requant->k * sizeof(float));
+  int16_t* mul = (int16_t*)malloc(requant->k * sizeof(int16_t));
+  int16_t* alu = (int16_t*)malloc(requant->k * sizeof(int16_t));
+  float max_m = 0.0f;
+  float max_b = 0.0f;
+  int shift;
+  int frac;
+  uint8_t bias_shift = 0;
+  int bytes = -1;
+
+  if (!m || !b || !mul || !alu) {
+    printf("nna_fold_requant - out of memory\n");
+    goto done;
+  }
+
+  if (requant->act != ACTIVATION_NONE && requant->act != ACTIVATION_RELU) {
+    printf("nna_fold_requant - unsupported activation %d\n", requant->act);
+    goto done;
+  }
+
+  for (uint16_t k = 0; k < requant->k; k++) {
+    float acc_scale = requant->in_scale * requant->weight_scale[k];
+    float gamma = 1.0f;
+    float beta = 0.0f;
+
+    if (requant->bn_gamma) {
+      gamma = requant->bn_gamma[k] / sqrtf(requant->bn_var[k] + requant->bn_eps);
+      beta = requant->bn_beta[k] - gamma * requant->bn_mean[k];
+    }
+
+    m[k] = acc_scale * gamma / requant->out_scale;
+    b[k] = ((requant->bias ? requant->bias[k] * acc_scale : 0.0f) * gamma + beta) / requant->out_scale;
+    if (!isfinite(m[k]) || !isfinite(b[k])) {
+      printf("nna_fold_requant - kernel %d scale %f bias %f not finite\n", k, m[k], b[k]);
+      goto done;
+    }
+    max_m = fabsf(m[k]) > max_m ? fabsf(m[k]) : max_m;
+  }
+
+  // Largest shift that keeps every multiplier within int16
+  if (max_m > 32767.0f) {
+    printf("nna_fold_requant - scale %f too large\n", max_m);
+    goto done;
+  }
+  for (shift = 0; shift < NNA_REQUANT_MAX_SHIFT && max_m * (float)(1ll << (shift + 1)) <= 32767.0f;
+    shift++);
+  frac = shift < NNA_REQUANT_FRAC ? shift : NNA_REQUANT_FRAC;
+
+  // Bias in the X1 output fixed point, shifted left by X2 if it exceeds int16
+  for (uint16_t k = 0; k < requant->k; k++) {
+    b[k] *= (float)(1 << frac);
+    max_b = fabsf(b[k]) > max_b ? fabsf(b[k]) : max_b;
+  }
+  while (bias_shift < NNA_SDP_MAX_SHIFT && max_b / (float)(1ull << bias_shift) > 32767.0f)
+    bias_shift++;
+  if (max_b / (float)(1ull << bias_shift) > 32767.0f) {
+    printf("nna_fold_requant - bias %f too large\n", max_b);
+    goto done;
+  }
+
+  for (uint16_t k = 0; k < requant->k; k++) {
+    mul[k] = round_int16(m[k] * (float)(1ll << shift));
+    alu[k] = round_int16(b[k] / (float)(1ull << bias_shift));
+  }
+
+  memset(&sdp_op->x1_op, 0, sizeof(sdp_op->x1_op));
+  sdp_op->x1_op.enable = 1;
+  sdp_op->x1_op.type = SDP_OP_MUL;
+  sdp_op->x1_op.mode = SDP_OP_PER_KERNEL;
+  sdp_op->x1_op.precision = PRECISION_INT16;
+  sdp_op->x1_op.truncate = shift - frac;
+
+  memset(&sdp_op->x2_op, 0, sizeof(sdp_op->x2_op));
+  sdp_op->x2_op.enable = 1;
+  sdp_op->x2_op.type = SDP_OP_ADD;
+  sdp_op->x2_op.alu_type = SDP_ALU_OP_SUM;
+  sdp_op->x2_op.mode = SDP_OP_PER_KERNEL;
+  sdp_op->x2_op.precision = PRECISION_INT16;
+  sdp_op->x2_op.shift_value = bias_shift;
+  sdp_op->x2_op.act = requant->act;
+
+  memset(&sdp_op->out_cvt, 0, sizeof(sdp_op->out_cvt));
+  sdp_op->out_cvt.scale = 1;
+  sdp_op->out_cvt.truncate = frac;
+  nna_cvt_zero_point(&sdp_op->out_cvt, requant->out_zero_point);
+
+  bytes = nna_pack_sdp_kernel(0, mul, requant->k, &sdp_op->x1_op, x1_operand);
+  nna_pack_sdp_kernel(alu, 0, requant->k, &sdp_op->x2_op, x2_operand);
+
+done:
+  free(m);
+  free(b);
+  free(mul);
+  free(alu);
+  return bytes;
+}
+
+static uint8_t slope_truncate(float max_slope) {
+
+  // Largest truncate that keeps the slope within int16
+  uint8_t truncate = 0;
+
+  while (truncate < NNA_SLOPE_MAX_SHIFT && max_slope * (float)(1ll << (truncate + 1)) <= 32767.0f)
+    truncate++;
+  return truncate;
+}
+
+int nna_prelu_op(nna_sdp_op* op, const float* slope, uint16_t channel, void* operand) {
+
+  // Configure op as a per channel PReLU and pack its slopes, the packed size is
+  // returned
+  int16_t* mul = (int16_t*)malloc(channel * sizeof(int16_t));
+  float max_slope = 0.0f;
+  int bytes;
+
+  if (!mul) {
+    printf("nna_prelu_op - out of memory\n");
+    return -1;
+  }
+
+  for (uint16_t c = 0; c < channel; c++)
+    max_slope = fabsf(slope[c]) > max_slope ? fabsf(slope[c]) : max_slope;
+
+  memset(op, 0, sizeof(*op));
+  op->enable = 1;
+  op->type = SDP_OP_MUL;
+  op->mode = SDP_OP_PER_KERNEL;
+  op->act = ACTIVATION_PRELU;
+  op->precision = PRECISION_INT16;
+  op->truncate = slope_truncate(max_slope);
+
+  for (uint16_t c = 0; c < channel; c++)
+    mul[c] = round_int16(slope[c] * (float)(1ll << op->truncate));
+
+  bytes = nna_pack_sdp_kernel(0, mul, channel, op, operand);
+  free(mul);
+  return bytes;
+}
+
+void nna_leaky_relu_op(nna_sdp_op* op, float slope) {
+
+  // Configure op as a leaky relu, the slope is a per layer operand
+  memset(op, 0, sizeof(*op));
+  op->enable = 1;
+  op->type = SDP_OP_MUL;
+  op->mode = SDP_OP_PER_LAYER;
+  op->act = ACTIVATION_PRELU;
+  op->precision = PRECISION_INT16;
+  op->truncate = slope_truncate(fabsf(slope));
+  op->mul_operand = round_int16(slope * (float)(1ll << op->truncate));
+}
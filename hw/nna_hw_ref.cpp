@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Bit exact CPU models of the SDP integer datapath, used by tests to check
+ * results without tolerances. Right shifts round to nearest with ties away
+ * from zero, each X stage (BS/BN) is ALU, MUL then relu saturated to int32 and
+ * the Y stage (EW) converts memory operands before its ALU and MUL. With
+ * PReLU the multiplier and its truncate only apply to negative values,
+ * positive values pass through unchanged.
+ *
+ * PDP average pooling sums the kernel, padded elements adding pad_value, then
+ * multiplies by the width and the height reciprocals (16 fraction bits) in
+ * turn, rounding each. Max and min pooling ignore padding.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+
+int64_t nna_ref_shift_right(int64_t x, uint8_t shift) {
+
+  if (!shift)
+    return x;
+
+  // Round half away from zero, negative ties round down
+  int64_t half = (int64_t)1 << (shift - 1);
+  int64_t r = x >> shift;
+  int64_t rem = x & (((int64_t)1 << shift) - 1);
+
+  if (rem > half || (rem == half && x >= 0))
+    r++;
+  return r;
+}
+
+int64_t nna_ref_saturate(int64_t x, uint8_t bits) {
+
+  int64_t max = ((int64_t)1 << (bits - 1)) - 1;
+  return x > max ? max : (x < -max - 1 ? -max - 1 : x);
+}
+
+int64_t nna_ref_cvt(const nna_cvt_param* cvt, int64_t x) {
+  return nna_ref_shift_right((x - cvt->offset) * cvt->scale, cvt->truncate);
+}
+
+static int64_t ref_alu(uint8_t alu_type, int64_t x, int64_t operand) {
+
+  switch (alu_type) {
+    case SDP_ALU_OP_MAX:
+      return x > operand ? x : operand;
+    case SDP_ALU_OP_MIN:
+      return x < operand ? x : operand;
+    case SDP_ALU_OP_EQL:
+      return x == operand;
+    default:
+      return x + operand;
+  }
+}
+
+static int64_t ref_mul(const nna_sdp_op* op, int64_t x, int64_t operand) {
+
+  if (op->act == ACTIVATION_PRELU && x >= 0)
+    return x;
+  return nna_ref_shift_right(x * operand, op->truncate);
+}
+
+int64_t nna_ref_sdp_x(const nna_sdp_op* op, int64_t x, int32_t alu, int32_t mul) {
+
+  // One X stage, alu and mul are the memory operands for this element and are
+  // ignored for per layer ops
+  if (!op->enable)
+    return x;
+
+  if (op->mode == SDP_OP_PER_LAYER) {
+    alu = op->alu_operand;
+    mul = op->mul_operand;
+  }
+
+  if (op->type == SDP_OP_ADD || op->type == SDP_OP_BOTH)
+    x = ref_alu(op->alu_type, x, (int64_t)alu << op->shift_value);
+  if (op->type == SDP_OP_MUL || op->type == SDP_OP_BOTH)
+    x = ref_mul(op, x, mul);
+  if (op->act == ACTIVATION_RELU && x < 0)
+    x = 0;
+
+  return nna_ref_saturate(x, 32);
+}
+
+int64_t nna_ref_sdp_y(const nna_sdp_op* op, int64_t x, int32_t alu, int32_t mul) {
+
+  // The Y stage without its LUT, memory operands go through the operand
+  // converters when enabled
+  int64_t a = alu;
+  int64_t m = mul;
+
+  if (!op->enable)
+    return x;
+
+  if (op->mode == SDP_OP_PER_LAYER) {
+    a = op->alu_operand;
+    m = op->mul_operand;
+  } else {
+    if (op->cvt.alu_cvt.enable)
+      a = nna_ref_cvt(&op->cvt.alu_cvt, a);
+    if (op->cvt.mul_cvt.enable)
+      m = nna_ref_cvt(&op->cvt.mul_cvt, m);
+  }
+
+  if (op->type == SDP_OP_ADD || op->type == SDP_OP_BOTH)
+    x = ref_alu(op->alu_type, x, a);
+  if (op->type == SDP_OP_MUL || op->type == SDP_OP_BOTH)
+    x = ref_mul(op, x, m);
+
+  return nna_ref_saturate(x, 32);
+}
+
+int32_t nna_ref_sdp_out(const nna_sdp_op_desc* sdp_op, int64_t x) {
+
+  // Output converter and saturation to the output precision
+  return (int32_t)nna_ref_saturate(nna_ref_cvt(&sdp_op->out_cvt, x),
+    sdp_op->dst_precision == PRECISION_INT16 ? 16 : 8);
+}
+
+static int32_t ref_feature(const void* hwc, uint8_t precision, uint32_t i) {
+  return precision == PRECISION_INT16 ? ((const int16_t*)hwc)[i] : ((const int8_t*)hwc)[i];
+}
+
+void nna_ref_pdp(const nna_pdp_op_desc* pdp_op, const nna_pdp_surface_desc* pdp_surface,
+  const void* hwc, void* out) {
+
+  // One PDP op over HWC data at the op precision
+  uint16_t in_w = pdp_surface->src_data.width;
+  uint16_t in_h = pdp_surface->src_data.height;
+  uint16_t c = pdp_surface->src_data.channel;
+  uint16_t out_w = pdp_surface->dst_data.width;
+  uint16_t out_h = pdp_surface->dst_data.height;
+  uint8_t bits = pdp_op->precision == PRECISION_INT16 ? 16 : 8;
+  int64_t recip_w = pdp_op->recip_width ? pdp_op->recip_width : 0x10000 / pdp_op->pool_width;
+  int64_t recip_h = pdp_op->recip_height ? pdp_op->recip_height : 0x10000 / pdp_op->pool_height;
+
+  for (int y = 0; y < out_h; y++) {
+    for (int x = 0; x < out_w; x++) {
+      for (int ch = 0; ch < c; ch++) {
+        int64_t r = pdp_op->pool_mode == POOL_MODE_MAX ? INT32_MIN :
+          (pdp_op->pool_mode == POOL_MODE_MIN ? INT32_MAX : 0);
+        for (int ky = 0; ky < pdp_op->pool_height; ky++) {
+          for (int kx = 0; kx < pdp_op->pool_width; kx++) {
+            int iy = y * pdp_op->stride_y - pdp_op->pad_top + ky;
+            int ix = x * pdp_op->stride_x - pdp_op->pad_left + kx;
+            if (iy < 0 || iy >= in_h || ix < 0 || ix >= in_w) {
+              if (pdp_op->pool_mode == POOL_MODE_AVG)
+                r += pdp_op->pad_value;
+              continue;
+            }
+            int32_t v = ref_feature(hwc, pdp_op->precision, (iy * in_w + ix) * c + ch);
+            if (pdp_op->pool_mode == POOL_MODE_AVG)
+              r += v;
+            else if (pdp_op->pool_mode == POOL_MODE_MAX)
+              r = v > r ? v : r;
+            else
+              r = v < r ? v : r;
+          }
+        }
+        if (pdp_op->pool_mode == POOL_MODE_AVG)
+          r = nna_ref_shift_right(nna_ref_shift_right(r * recip_w, 16) * recip_h, 16);
+        r = nna_ref_saturate(r, bits);
+
+        uint32_t o = (y * out_w + x) * c + ch;
+        if (bits == 16)
+          ((int16_t*)out)[o] = r;
+        else
+          ((int8_t*)out)[o] = r;
+      }
+    }
+  }
+}
@@ -20,8 +20,10 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "nna_hw.h"
+#include "nna_config.h"
 #include "nna_interface.h"
 
 void nna_sdp_set_producer(uint32_t group_id, uint32_t rdma_group_id) {
@@ -43,6 +45,20 @@ void nna_sdp_enable(uint8_t enable_stats, uint8_t is_rdma_needed) {
   xregw(0x9038u, 0x01);
 }
 
+static uint32_t sdp_rdma_cfg(nna_sdp_op* op, uint32_t address) {
+
+  // Common layout of the BRDMA, NRDMA and ERDMA config registers
+  uint8_t data_use;
+
+  if (!address)
+    return 1; // Disabled, operand from register
+
+  data_use = (op->type == SDP_OP_BOTH) ? 2 : (op->type == SDP_OP_ADD);
+
+  return 1u << 5 | (op->mode == SDP_OP_PER_POINT) << 4 | (op->precision & 0x01) << 3 |
+    data_use << 1;
+}
+
 void processor_x1_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface) {
 
   struct nna_sdp_op *x1_op;
@@ -54,6 +70,7 @@ void processor_x1_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_sur
   uint8_t mul_prelu;
   uint8_t relu_bypass;
   uint8_t alu_src;
+  uint8_t mul_src;
 
   // Configure x1
 
@@ -80,24 +97,24 @@ void processor_x1_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_sur
 
     /* config x1 input source */
     if (x1_op->mode == SDP_OP_PER_LAYER) {
+      xregw(0x8028u, 1);                 // SDP_RDMA_D_BRDMA_CFG_0 disabled
       xregw(0x9060u,x1_op->alu_operand); // SDP_D_DP_BS_ALU_SRC_VALUE_0
       xregw(0x9068u,x1_op->mul_operand); // SDP_D_DP_BS_MUL_SRC_VALUE_0
     } else {
+      xregw(0x8028u, sdp_rdma_cfg(x1_op, sdp_surface->x1_data.address)); // SDP_RDMA_D_BRDMA_CFG_0
       if (sdp_surface->x1_data.address) {
-        xregw(0x8028u, 0x1 << 5 | (x1_op->mode ==SDP_OP_PER_POINT) << 4 | 1 << 3 |
-          1 << 1);
         xregw(0x802Cu, sdp_surface->x1_data.address);     // SDP_RDMA_D_BS_BASE_ADDR_LOW_0
         xregw(0x8034u, sdp_surface->x1_data.line_stride);
         xregw(0x8038u, sdp_surface->x1_data.surf_stride);
-        xregw(0x803Cu, 0);
+        xregw(0x803Cu, sdp_op->batch_num > 1 ? sdp_surface->x1_data.batch_stride : 0); // SDP_RDMA_D_BS_BATCH_STRIDE_0
       } else {
-        xregw(0x8028u, 1);
         xregw(0x802Cu, 0);
       }
     }
 
     // Truncate value always takes effect
-    xregw(0x9064u, alu_src | x1_op->truncate << 8); // SDP_D_DP_BS_MUL_CFG_0
+    mul_src = (x1_op->mode != SDP_OP_PER_LAYER);
+    xregw(0x9064u, mul_src | x1_op->truncate << 8); // SDP_D_DP_BS_MUL_CFG_0
   }
 }
 
@@ -112,6 +129,7 @@ void processor_x2_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_sur
   uint8_t mul_prelu;
   uint8_t relu_bypass;
   uint8_t alu_src;
+  uint8_t mul_src;
 
   // Configure x2
 
@@ -137,23 +155,54 @@ void processor_x2_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_sur
 
     /* config x2 source */
     if (x2_op->mode == SDP_OP_PER_LAYER) {
+      xregw(0x8040u, 1);                 // SDP_RDMA_D_NRDMA_CFG_0 disabled
       xregw(0x9074u,x2_op->alu_operand); // SDP_D_DP_BN_ALU_SRC_VALUE_0
       xregw(0x907cu,x2_op->mul_operand); // SDP_D_DP_BN_MUL_SRC_VALUE_0
     } else {
+      xregw(0x8040u, sdp_rdma_cfg(x2_op, sdp_surface->x2_data.address)); // SDP_RDMA_D_NRDMA_CFG_0
       if (sdp_surface->x2_data.address) {
         xregw(0x8044u, sdp_surface->x2_data.address);     // SDP_RDMA_D_BN_BASE_ADDR_LOW_0
         xregw(0x804Cu, sdp_surface->x2_data.line_stride);
         xregw(0x8050u, sdp_surface->x2_data.surf_stride);
-        xregw(0x8054u, 0);
+        xregw(0x8054u, sdp_op->batch_num > 1 ? sdp_surface->x2_data.batch_stride : 0); // SDP_RDMA_D_BN_BATCH_STRIDE_0
       } else {
         xregw(0x8044u, 0);
       }
     }
     // Trucate value always takes effect
-    xregw(0x9078u, alu_src | x2_op->truncate << 8); // SDP_D_DP_BN_MUL_CFG_0
+    mul_src = (x2_op->mode != SDP_OP_PER_LAYER);
+    xregw(0x9078u, mul_src | x2_op->truncate << 8); // SDP_D_DP_BN_MUL_CFG_0
   }
 }
 
+void processor_lut_program(nna_lut_param* lut) {
+
+  // LUT registers are not double buffered so only program between ops. Each
+  // table is written through the access port, the address auto increments.
+  xregw(0x9008u, 1u << 17 | LUT_PRIORITY_LE << 16); // SDP_S_LUT_ACCESS_CFG_0 write LE from 0
+  for (int i = 0; i < NNA_LUT_LE_ENTRIES; i++)
+    xregw(0x900Cu, (uint16_t)lut->le_table[i]); // SDP_S_LUT_ACCESS_DATA_0
+
+  xregw(0x9008u, 1u << 17 | LUT_PRIORITY_LO << 16); // SDP_S_LUT_ACCESS_CFG_0 write LO from 0
+  for (int i = 0; i < NNA_LUT_LO_ENTRIES; i++)
+    xregw(0x900Cu, (uint16_t)lut->lo_table[i]); // SDP_S_LUT_ACCESS_DATA_0
+
+  xregw(0x9010u, (lut->le_function & 0x01) | (lut->uflow_priority & 0x01) << 4 |
+    (lut->oflow_priority & 0x01) << 5 | (lut->hybrid_priority & 0x01) << 6); // SDP_S_LUT_CFG_0
+  xregw(0x9014u, (uint8_t)lut->le_index_offset | lut->le_index_select << 8 |
+    lut->lo_index_select << 16); // SDP_S_LUT_INFO_0
+
+  xregw(0x9018u, lut->le_start); // SDP_S_LUT_LE_START_0
+  xregw(0x901Cu, lut->le_end);   // SDP_S_LUT_LE_END_0
+  xregw(0x9020u, lut->lo_start); // SDP_S_LUT_LO_START_0
+  xregw(0x9024u, lut->lo_end);   // SDP_S_LUT_LO_END_0
+
+  xregw(0x9028u, (uint16_t)lut->le_uflow_scale | (uint32_t)(uint16_t)lut->le_oflow_scale << 16); // SDP_S_LUT_LE_SLOPE_SCALE_0
+  xregw(0x902Cu, (lut->le_uflow_shift & 0x1F) | (lut->le_oflow_shift & 0x1F) << 5); // SDP_S_LUT_LE_SLOPE_SHIFT_0
+  xregw(0x9030u, (uint16_t)lut->lo_uflow_scale | (uint32_t)(uint16_t)lut->lo_oflow_scale << 16); // SDP_S_LUT_LO_SLOPE_SCALE_0
+  xregw(0x9034u, (lut->lo_uflow_shift & 0x1F) | (lut->lo_oflow_shift & 0x1F) << 5); // SDP_S_LUT_LO_SLOPE_SHIFT_0
+}
+
 void processor_y_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface) {
 
   struct nna_sdp_op *y_op;
@@ -177,7 +226,7 @@ void processor_y_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surf
   mul_bypass = (y_op->type == SDP_OP_ADD) || (y_op->type == SDP_OP_NONE);
   alu_algo = y_op->alu_type & 0x03;
   mul_prelu = y_op->act == ACTIVATION_PRELU;
-  lut_bypass = 1; // For now bypass
+  lut_bypass = !(y_op->act == ACTIVATION_LUT);
   xregw(0x9080u,  bypass | alu_bypass << 1 | alu_algo << 2 | mul_bypass << 4 |
     mul_prelu <<5 | lut_bypass << 6 ); // SDP_D_DP_EW_CFG_0
 
@@ -214,12 +263,15 @@ void processor_y_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surf
     }
 
     /* config y source address if required */
-    if (y_op->mode != SDP_OP_PER_LAYER) {
+    if (y_op->mode == SDP_OP_PER_LAYER) {
+      xregw(0x8058u, 1); // SDP_RDMA_D_ERDMA_CFG_0 disabled
+    } else {
+      xregw(0x8058u, sdp_rdma_cfg(y_op, sdp_surface->y_data.address)); // SDP_RDMA_D_ERDMA_CFG_0
       if (sdp_surface->y_data.address) {
         xregw(0x805Cu, sdp_surface->y_data.address);     // SDP_RDMA_D_EW_BASE_ADDR_LOW_0
         xregw(0x8064u, sdp_surface->y_data.line_stride);
         xregw(0x8068u, sdp_surface->y_data.surf_stride);
-        xregw(0x806Cu, 0);
+        xregw(0x806Cu, sdp_op->batch_num > 1 ? sdp_surface->y_data.batch_stride : 0); // SDP_RDMA_D_EW_BATCH_STRIDE_0
       } else {
         xregw(0x805Cu,0);
       }
@@ -238,6 +290,8 @@ int processor_sdp_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_sur
 
   uint8_t fly_mode;
   uint8_t output_dst;
+  uint8_t batch;
+  uint8_t precision;
 
   x1_op = &sdp_op->x1_op;
   x2_op = &sdp_op->x2_op;
@@ -245,8 +299,42 @@ int processor_sdp_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_sur
 
   fly_mode = sdp_surface->src_data.address == 0;
   output_dst = sdp_surface->dst_data.address == 0; // Memory or PDP
+  batch = sdp_op->batch_num ? sdp_op->batch_num : 1;
+
+  // Batches are only produced by conv and PDP can't take them on the fly
+  if (batch > 1 && (!fly_mode || output_dst)) {
+    printf("processor_sdp_program - batch needs input from conv and output to memory\n");
+    return -1;
+  }
+
+  // Memory cubes have to be laid out for the precision they are read or
+  // written at, an int8 cube can't be read as int16 or the other way round
+  if (!fly_mode && sdp_surface->src_data.line_stride <
+    (uint32_t)sdp_surface->src_data.width * NNA_ATOMIC_C_SIZE << (sdp_op->src_precision & 0x01)) {
+    printf("processor_sdp_program - src line stride %d too small for precision %d\n",
+      sdp_surface->src_data.line_stride, sdp_op->src_precision);
+    return -1;
+  }
+  if (!output_dst && sdp_surface->dst_data.line_stride <
+    (uint32_t)sdp_surface->dst_data.width * NNA_ATOMIC_C_SIZE << (sdp_op->dst_precision & 0x01)) {
+    printf("processor_sdp_program - dst line stride %d too small for precision %d\n",
+      sdp_surface->dst_data.line_stride, sdp_op->dst_precision);
+    return -1;
+  }
+
+  if (y_op->enable && y_op->act == ACTIVATION_LUT) {
+    if (!sdp_op->lut) {
+      printf("processor_sdp_program - no lookup table for LUT activation\n");
+      return -1;
+    }
+    processor_lut_program(sdp_op->lut);
+  }
+
+  // Processing is done at the input precision
+  precision = (sdp_op->src_precision & 0x03) << 2 | (sdp_op->src_precision & 0x03) << 4 |
+    (sdp_op->dst_precision & 0x03) << 6;
 
-  xregw(0x8070u, fly_mode);                         // SDP_RDMA_D_FEATURE_MODE_CFG_0
+  xregw(0x8070u, fly_mode | (sdp_op->conv_mode & 0x01) << 1 | precision | (batch - 1) << 8); // SDP_RDMA_D_FEATURE_MODE_CFG_0
   xregw(0x8074u, 1u);                               // SDP_RDMA_D_SRC_DMA_CFG_0
 
   xregw(0x800Cu, sdp_surface->src_data.width - 1);   // SDP_RDMA_D_DATA_CUBE_WIDTH_0
@@ -264,13 +352,14 @@ int processor_sdp_program(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_sur
     xregw(0x9050u, sdp_surface->dst_data.line_stride); // SDP_D_DST_LINE_STRIDE_0
     xregw(0x9054u, sdp_surface->dst_data.surf_stride); // SDP_D_DST_SURFACE_STRIDE_0
     xregw(0x90B4u, 1u);                                // SDP_D_DST_DMA_CFG_0
+    xregw(0x90B8u, batch > 1 ? sdp_op->batch_stride : 0); // SDP_D_DST_BATCH_STRIDE_0
   }
 
   xregw(0x903Cu, sdp_surface->src_data.width - 1);    // SDP_D_DATA_CUBE_WIDTH_0
   xregw(0x9040u, sdp_surface->src_data.height - 1);   // SDP_D_DATA_CUBE_HEIGHT_0
   xregw(0x9044u, sdp_surface->src_data.channel - 1);  // SDP_D_DATA_CUBE_CHANNEL_0
-  xregw(0x90B0u, fly_mode | (output_dst << 1));       // SDP_D_FEATURE_MODE_CFG
-  xregw(0x90BCu, 0);                                  // SDP_D_DATA_FORMAT_0_0 int8
+  xregw(0x90B0u, fly_mode | (output_dst << 1) | (sdp_op->conv_mode & 0x01) << 2 | (batch - 1) << 8); // SDP_D_FEATURE_MODE_CFG
+  xregw(0x90BCu, (sdp_op->src_precision & 0x03) | (sdp_op->dst_precision & 0x03) << 2); // SDP_D_DATA_FORMAT_0
   xregw(0x90C0u, sdp_op->out_cvt.offset);             // SDP_D_CVT_OFFSET_0
   xregw(0x90C4u, sdp_op->out_cvt.scale);              // SDP_D_CVT_SCALE_0
   xregw(0x90C8u, sdp_op->out_cvt.truncate);           // SDP_D_CVT_SHIFT_0
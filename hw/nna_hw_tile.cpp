@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Height tiling of convolutions. Input data and weights for an op must both
+ * be held in CBUF (NNA_CBUF_BANK_NUMBER banks), when the input is too large
+ * the output is split into bands of rows. Each band reads the input rows it
+ * needs (including the halo rows shared with its neighbours) and only pads
+ * at the real top/bottom edges of the input.
+ *
+ * When the weights are too large the kernels are split into passes instead.
+ * The input is fetched once by the first pass and held in CBUF for the
+ * following passes (data_reuse / skip_data_rls), likewise weights are held
+ * across height tiles (weight_reuse / skip_weight_rls) when all kernels fit.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+static void tile_rows(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint16_t out_row, uint16_t out_rows, nna_conv_tile* tile) {
+
+  // Fill tile for output rows [out_row, out_row + out_rows)
+  int32_t kernel_h = (conv_op->kernel_height_csc - 1) * conv_op->dilation_y + 1;
+  int32_t first = out_row * conv_op->stride_y - conv_op->pad_y_top;
+  int32_t last = (out_row + out_rows - 1) * conv_op->stride_y - conv_op->pad_y_top + kernel_h;
+  int32_t in_first = first < 0 ? 0 : first;
+  int32_t in_last = last > conv_surface->src_data.height ? conv_surface->src_data.height : last;
+
+  tile->conv_op = *conv_op;
+  tile->conv_surface = *conv_surface;
+  tile->out_row = out_row;
+  tile->out_rows = out_rows;
+  tile->out_kernel = 0;
+  tile->out_kernels = conv_surface->dst_data.channel;
+  tile->in_channel = 0;
+  tile->in_channels = conv_surface->src_data.channel;
+
+  nna_conv_op_desc* op = &tile->conv_op;
+  nna_conv_surface_desc* surface = &tile->conv_surface;
+
+  // Halo rows are read from memory, only the real edges are padded
+  op->pad_y_top = in_first - first;
+  op->pad_y_bottom = last - in_last;
+
+  surface->src_data.address += in_first * conv_surface->src_data.line_stride;
+  surface->src_data.height = in_last - in_first;
+  if (nna_pixel_is_semiplanar(conv_op->data_format)) {
+    // UV lines are twice the size of Y lines
+    surface->src_data.plane_stride += in_first * conv_surface->src_data.line_stride;
+  }
+  op->input_height_csc = surface->src_data.height;
+
+  surface->dst_data.address += out_row * conv_surface->dst_data.line_stride;
+  surface->dst_data.height = out_rows;
+  op->input_height_cmac = out_rows;
+
+  op->data_bank = calculate_data_bank(op, surface);
+
+  // Each tile loads its own input, pixel input releases all slices at the end
+  if (conv_op->data_format != FORMAT_FEATURE)
+    op->release = op->input_height_csc;
+}
+
+static uint32_t cbuf_banks(nna_conv_op_desc* conv_op) {
+
+  // Banks for data and weights, the last bank holds the mask of compressed weights
+  return NNA_CBUF_BANK_NUMBER - (conv_op->weight_format == WEIGHT_FORMAT_COMPRESSED);
+}
+
+static int plan_rows(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint32_t weight_bank, nna_conv_tile* tiles, int max_tiles) {
+
+  // Split conv_op along the output height leaving weight_bank banks for weights
+  uint32_t data_bank = calculate_data_bank(conv_op, conv_surface);
+  uint32_t banks = cbuf_banks(conv_op);
+  uint16_t out_h = conv_surface->dst_data.height;
+  int32_t kernel_h = (conv_op->kernel_height_csc - 1) * conv_op->dilation_y + 1;
+
+  if (max_tiles < 1)
+    return -1;
+
+  if (data_bank + weight_bank <= banks) {
+    // Fits as is
+    tiles[0].conv_op = *conv_op;
+    tiles[0].conv_surface = *conv_surface;
+    tiles[0].out_row = 0;
+    tiles[0].out_rows = out_h;
+    tiles[0].out_kernel = 0;
+    tiles[0].out_kernels = conv_surface->dst_data.channel;
+    tiles[0].in_channel = 0;
+    tiles[0].in_channels = conv_surface->src_data.channel;
+    return 1;
+  }
+
+  if (conv_op->conv_mode == CONV_MODE_WINOGRAD) {
+    printf("nna_plan_conv_tiles - winograd ops can't be tiled by height\n");
+    return -1;
+  }
+
+  if (weight_bank >= banks) {
+    printf("nna_plan_conv_tiles - weights need %d banks, kernels must be split\n", weight_bank);
+    return -1;
+  }
+
+  if (conv_op->entry_per_slice == 0) {
+    printf("nna_plan_conv_tiles - entry_per_slice not set\n");
+    return -1;
+  }
+
+  // Most input rows that fit in the banks left after the weights
+  uint32_t max_in_rows = ((banks - weight_bank) * NNA_CBUF_ENTRIES_PER_BANK) /
+    conv_op->entry_per_slice;
+
+  if ((int32_t)max_in_rows < kernel_h) {
+    printf("nna_plan_conv_tiles - %d entries per slice too wide to tile by height\n",
+      conv_op->entry_per_slice);
+    return -1;
+  }
+
+  uint32_t max_out_rows = (max_in_rows - kernel_h) / conv_op->stride_y + 1;
+  uint32_t num_tiles = (out_h + max_out_rows - 1) / max_out_rows;
+
+  if ((int)num_tiles > max_tiles) {
+    printf("nna_plan_conv_tiles - needs %d tiles, only %d available\n", num_tiles, max_tiles);
+    return -1;
+  }
+
+  // Balance the rows between the tiles
+  uint16_t rows = out_h / num_tiles;
+  uint16_t extra = out_h % num_tiles;
+  uint16_t out_row = 0;
+
+  uint8_t max_data_bank = 0;
+
+  for (uint32_t i = 0; i < num_tiles; i++) {
+    uint16_t out_rows = rows + (i < extra);
+    tile_rows(conv_op, conv_surface, out_row, out_rows, &tiles[i]);
+    if (tiles[i].conv_op.data_bank > max_data_bank)
+      max_data_bank = tiles[i].conv_op.data_bank;
+    out_row += out_rows;
+  }
+
+  // Keep the data/weight partition of CBUF the same for every tile so weights can stay resident
+  for (uint32_t i = 0; i < num_tiles; i++)
+    tiles[i].conv_op.data_bank = max_data_bank;
+
+  return num_tiles;
+}
+
+int nna_plan_conv_tiles(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_conv_tile* tiles, int max_tiles) {
+
+  // Split conv_op along the output height so data and weight banks fit in CBUF,
+  // returns the number of tiles written or -1 if the op can't be tiled.
+  int num_tiles = plan_rows(conv_op, conv_surface, calculate_weight_bank(conv_surface), tiles,
+    max_tiles);
+
+  // Every tile uses the same weights so only the first needs to fetch them
+  for (int i = 0; i < num_tiles && num_tiles > 1; i++) {
+    tiles[i].conv_op.weight_reuse = (i > 0);
+    tiles[i].conv_op.skip_weight_rls = (i < num_tiles - 1);
+  }
+
+  return num_tiles;
+}
+
+static uint32_t kernels_per_pass(nna_conv_op_desc* conv_op, uint32_t weight_bank) {
+
+  // Most kernels whose weights fit in weight_bank banks, in whole kernel groups
+  uint32_t kernels = ((weight_bank * NNA_CBUF_BANK_WEIGHT_SIZE) - 32) / conv_op->bytes_per_kernel;
+  return kernels & ~(KERNEL_PER_GROUP - 1);
+}
+
+static void tile_kernels(nna_conv_tile* tile, uint16_t kernel, uint16_t kernels,
+  nna_conv_tile* pass) {
+
+  // Fill pass for kernels [kernel, kernel + kernels) of tile
+  *pass = *tile;
+  pass->out_kernel = tile->out_kernel + kernel;
+  pass->out_kernels = kernels;
+
+  nna_conv_op_desc* op = &pass->conv_op;
+  nna_conv_surface_desc* surface = &pass->conv_surface;
+
+  // Kernel groups are stored one after the other, each group of 8 is an output surface
+  surface->weight_data.address += kernel * op->bytes_per_kernel;
+  surface->weight_data.size = (kernels * op->bytes_per_kernel) + 31;
+  surface->dst_data.address += (kernel / NNA_ATOMIC_C_SIZE) * surface->dst_data.surf_stride;
+  surface->dst_data.channel = kernels;
+
+  op->weight_bank = calculate_weight_bank(surface);
+}
+
+static int split_kernels(nna_conv_tile* tile, uint32_t max_kernels, nna_conv_tile* passes,
+  int max_passes) {
+
+  // Split a tile into kernel passes that share the input held in CBUF
+  uint16_t k = tile->conv_surface.dst_data.channel;
+  int num_passes = (k + max_kernels - 1) / max_kernels;
+
+  // Compressed kernel groups vary in size so can't be addressed by kernel
+  if (num_passes > 1 && tile->conv_op.weight_format == WEIGHT_FORMAT_COMPRESSED) {
+    printf("nna_plan_conv_ksplit - compressed weights can't be split by kernel\n");
+    return -1;
+  }
+
+  if (num_passes > max_passes) {
+    printf("nna_plan_conv_ksplit - needs %d passes, only %d available\n", num_passes, max_passes);
+    return -1;
+  }
+
+  for (int i = 0; i < num_passes; i++) {
+    uint16_t kernel = i * max_kernels;
+    uint32_t remaining = k - kernel;
+    tile_kernels(tile, kernel, remaining < max_kernels ? remaining : max_kernels, &passes[i]);
+
+    // First pass fetches the input, the rest reuse it. Release at the end of the last pass.
+    passes[i].conv_op.data_reuse = (i > 0) ? 1 : tile->conv_op.data_reuse;
+    passes[i].conv_op.skip_data_rls = (i < num_passes - 1) ? 1 : tile->conv_op.skip_data_rls;
+    // Each pass has its own weights
+    passes[i].conv_op.weight_reuse = 0;
+    passes[i].conv_op.skip_weight_rls = 0;
+  }
+
+  return num_passes;
+}
+
+int nna_plan_conv_ksplit(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_conv_tile* tiles, int max_tiles) {
+
+  // Split conv_op into passes of kernel groups so each pass fits in the banks
+  // left after the input data, returns the number of passes or -1.
+  uint32_t data_bank = calculate_data_bank(conv_op, conv_surface);
+  nna_conv_tile tile;
+
+  if (max_tiles < 1)
+    return -1;
+
+  if (data_bank >= NNA_CBUF_BANK_NUMBER) {
+    printf("nna_plan_conv_ksplit - input needs %d banks, height must be tiled\n", data_bank);
+    return -1;
+  }
+
+  uint32_t max_kernels = kernels_per_pass(conv_op, NNA_CBUF_BANK_NUMBER - data_bank);
+  if (max_kernels == 0) {
+    printf("nna_plan_conv_ksplit - %d bytes per kernel too large for %d banks\n",
+      conv_op->bytes_per_kernel, NNA_CBUF_BANK_NUMBER - data_bank);
+    return -1;
+  }
+
+  tile.conv_op = *conv_op;
+  tile.conv_surface = *conv_surface;
+  tile.conv_op.data_bank = data_bank;
+  tile.out_row = 0;
+  tile.out_rows = conv_surface->dst_data.height;
+  tile.out_kernel = 0;
+  tile.out_kernels = conv_surface->dst_data.channel;
+  tile.in_channel = 0;
+  tile.in_channels = conv_surface->src_data.channel;
+
+  return split_kernels(&tile, max_kernels, tiles, max_tiles);
+}
+
+int nna_plan_conv(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_conv_tile* tiles, int max_tiles) {
+
+  // Choose between height tiling, kernel splitting or both. Kernel splitting is
+  // preferred as the input is only read once, when the input doesn't fit with a
+  // single kernel group the height is tiled with half of CBUF kept for weights.
+  uint32_t data_bank = calculate_data_bank(conv_op, conv_surface);
+  uint32_t weight_bank = calculate_weight_bank(conv_surface);
+
+  if (data_bank + weight_bank <= cbuf_banks(conv_op) || weight_bank < NNA_CBUF_BANK_NUMBER / 2 ||
+    conv_op->weight_format == WEIGHT_FORMAT_COMPRESSED)
+    return nna_plan_conv_tiles(conv_op, conv_surface, tiles, max_tiles);
+
+  if (data_bank < NNA_CBUF_BANK_NUMBER &&
+    kernels_per_pass(conv_op, NNA_CBUF_BANK_NUMBER - data_bank) > 0)
+    return nna_plan_conv_ksplit(conv_op, conv_surface, tiles, max_tiles);
+
+  // Tile the height first then split the kernels of every tile
+  uint32_t max_kernels = kernels_per_pass(conv_op, NNA_CBUF_BANK_NUMBER / 2);
+  if (max_kernels == 0) {
+    printf("nna_plan_conv - %d bytes per kernel too large\n", conv_op->bytes_per_kernel);
+    return -1;
+  }
+
+  int num_rows = plan_rows(conv_op, conv_surface, NNA_CBUF_BANK_NUMBER / 2, tiles, max_tiles);
+  if (num_rows < 0)
+    return -1;
+
+  // Passes are written from the end so the row tiles aren't overwritten
+  int passes_per_row = (conv_surface->dst_data.channel + max_kernels - 1) / max_kernels;
+  if (num_rows * passes_per_row > max_tiles) {
+    printf("nna_plan_conv - needs %d tiles, only %d available\n", num_rows * passes_per_row,
+      max_tiles);
+    return -1;
+  }
+
+  for (int i = num_rows - 1; i >= 0; i--) {
+    nna_conv_tile tile = tiles[i];
+    split_kernels(&tile, max_kernels, &tiles[i * passes_per_row], passes_per_row);
+  }
+
+  return num_rows * passes_per_row;
+}
+
+int nna_sdp_tile_surface(nna_sdp_op_desc* sdp_op, nna_sdp_surface_desc* sdp_surface,
+  nna_conv_tile* tile, nna_sdp_surface_desc* tile_surface) {
+
+  // Derive the SDP surface for a conv tile, the output and operands are offset
+  // to the rows and kernels produced by the tile
+  nna_sdp_op* ops[3] = { &sdp_op->x1_op, &sdp_op->x2_op, &sdp_op->y_op };
+  nna_data_cube* operands[3] = { &tile_surface->x1_data, &tile_surface->x2_data, &tile_surface->y_data };
+
+  if (!sdp_surface->dst_data.address && tile->out_rows != sdp_surface->src_data.height) {
+    printf("nna_sdp_tile_surface - tiled output can't be passed to PDP on the fly\n");
+    return -1;
+  }
+
+  if (!sdp_surface->dst_data.address && tile->out_kernels != sdp_surface->src_data.channel) {
+    printf("nna_sdp_tile_surface - kernel split output can't be passed to PDP on the fly\n");
+    return -1;
+  }
+
+  *tile_surface = *sdp_surface;
+
+  uint16_t surface = tile->out_kernel / NNA_ATOMIC_C_SIZE;
+
+  tile_surface->src_data.height = tile->out_rows;
+  tile_surface->src_data.channel = tile->out_kernels;
+  tile_surface->dst_data.height = tile->out_rows;
+  tile_surface->dst_data.channel = tile->out_kernels;
+  if (tile_surface->dst_data.address)
+    tile_surface->dst_data.address += tile->out_row * sdp_surface->dst_data.line_stride +
+      surface * sdp_surface->dst_data.surf_stride;
+
+  for (int i = 0; i < 3; i++) {
+    if (!ops[i]->enable || ops[i]->mode == SDP_OP_PER_LAYER || !operands[i]->address)
+      continue;
+
+    // Per kernel operands are 1x1 so only the surface offset applies
+    operands[i]->address += surface * operands[i]->surf_stride;
+    operands[i]->channel = tile->out_kernels;
+    if (ops[i]->mode == SDP_OP_PER_POINT) {
+      operands[i]->address += tile->out_row * operands[i]->line_stride;
+      operands[i]->height = tile->out_rows;
+    }
+  }
+
+  return 0;
+}
+
+int nna_run_conv_tiles(nna_conv_tile* tiles, int num_tiles, nna_sdp_op_desc* sdp_op,
+  nna_sdp_surface_desc* sdp_surface) {
+
+  // Run each tile as conv + sdp writing to memory. CBUF is only reset once
+  // nothing is held for the next op.
+  nna_sdp_surface_desc tile_surface;
+
+  for (int i = 0; i < num_tiles; i++) {
+    if (nna_sdp_tile_surface(sdp_op, sdp_surface, &tiles[i], &tile_surface))
+      return -1;
+
+    nna_conv_set_producer(0,0);
+    nna_sdp_set_producer(0,0);
+
+    if (nna_conv_program(&tiles[i].conv_op, &tiles[i].conv_surface))
+      return -1;
+    nna_sdp_program(sdp_op, &tile_surface);
+
+    nna_conv_enable(0,0);
+    nna_sdp_enable(0,1);
+
+    nna_wait_done(0x150001,0x150001);
+    if (!tiles[i].conv_op.skip_data_rls && !tiles[i].conv_op.skip_weight_rls)
+      nna_reset();
+  }
+
+  return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Upsampling and transposed convolution. Neither CDMA nor SDP can write
+ * with a stride along the width, however every atom (1x1x8) of a feature
+ * cube can be treated as a line of its own. Viewing a surface as a cube of
+ * width 1, height W (line_stride of one atom) and one 8 channel "surface"
+ * per row, SDP can copy it to a destination with line_stride scale atoms and
+ * surf_stride scale rows, scattering the atoms on a scale x scale grid.
+ *
+ * - Nearest upsampling is scale x scale of these copies, one for each phase
+ *   of the grid.
+ * - Zero insertion is the copy at phase 0 into a zeroed buffer, the gaps
+ *   are never written so the buffer only needs clearing once.
+ * - Transposed convolution is zero insertion followed by a stride 1
+ *   convolution with the kernels flipped and padding of k - 1 - pad.
+ * - Bilinear 2x upsampling is a depthwise transposed convolution with the
+ *   separable [1 3 3 1] kernel.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_plan.h"
+
+#define SDP_MAX_CUBE_CHANNEL 8192
+
+void nna_upsample_cube(nna_data_cube* cube, uint32_t address, nna_data_cube* src, uint8_t scale) {
+
+  // Describe src upsampled by scale, each input atom lands at the top left
+  // of a scale x scale block
+  nna_feature_cube(cube, address, src->width * scale, src->height * scale, src->channel,
+    PRECISION_INT8);
+}
+
+static void copy_pass(nna_data_cube* src, nna_data_cube* dst, uint8_t scale, uint16_t surface,
+  uint16_t row, uint16_t rows, uint8_t dx, uint8_t dy, nna_sdp_pass* pass) {
+
+  // One strided copy of rows of a surface, atoms are written at phase dx,dy
+  nna_sdp_op_desc* sdp_op = &pass->sdp_op;
+  nna_sdp_surface_desc* sdp_surface = &pass->sdp_surface;
+
+  memset(pass, 0, sizeof(nna_sdp_pass));
+
+  sdp_surface->src_data.type = 1;
+  sdp_surface->src_data.address = src->address + surface * src->surf_stride + row * src->line_stride;
+  sdp_surface->src_data.width = 1;
+  sdp_surface->src_data.height = src->width;
+  sdp_surface->src_data.channel = rows * NNA_ATOMIC_C_SIZE;
+  sdp_surface->src_data.line_stride = NNA_ATOMIC_C_SIZE;
+  sdp_surface->src_data.surf_stride = src->line_stride;
+
+  sdp_surface->dst_data = sdp_surface->src_data;
+  sdp_surface->dst_data.address = dst->address + surface * dst->surf_stride +
+    (row * scale + dy) * dst->line_stride + dx * NNA_ATOMIC_C_SIZE;
+  sdp_surface->dst_data.line_stride = scale * NNA_ATOMIC_C_SIZE;
+  sdp_surface->dst_data.surf_stride = scale * dst->line_stride;
+
+  // Straight copy, all stages bypassed
+  sdp_op->out_cvt.scale = 1;
+}
+
+int nna_plan_upsample(nna_data_cube* src, nna_data_cube* dst, uint8_t scale, uint8_t nearest,
+  nna_sdp_pass* passes, int max_passes) {
+
+  // Plan the SDP copies to upsample src into dst (see nna_upsample_cube), nearest
+  // fills every phase, otherwise only the top left phase is written (zero insertion).
+  uint16_t surfaces = (src->channel + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE;
+  uint16_t max_rows = SDP_MAX_CUBE_CHANNEL / NNA_ATOMIC_C_SIZE;
+  uint8_t phases = nearest ? scale : 1;
+  int num_passes = 0;
+
+  if (scale < 2) {
+    printf("nna_plan_upsample - scale %d not supported\n", scale);
+    return -1;
+  }
+
+  int needed = surfaces * ((src->height + max_rows - 1) / max_rows) * phases * phases;
+  if (needed > max_passes) {
+    printf("nna_plan_upsample - needs %d passes, only %d available\n", needed, max_passes);
+    return -1;
+  }
+
+  for (uint16_t s = 0; s < surfaces; s++) {
+    for (uint16_t row = 0; row < src->height; row += max_rows) {
+      uint16_t rows = (src->height - row) < max_rows ? (src->height - row) : max_rows;
+      for (uint8_t dy = 0; dy < phases; dy++)
+        for (uint8_t dx = 0; dx < phases; dx++)
+          copy_pass(src, dst, scale, s, row, rows, dx, dy, &passes[num_passes++]);
+    }
+  }
+
+  return num_passes;
+}
+
+int nna_run_sdp_passes(nna_sdp_pass* passes, int num_passes) {
+
+  // Run SDP on its own reading from and writing to memory
+  for (int i = 0; i < num_passes; i++) {
+    nna_sdp_set_producer(0,0);
+
+    if (nna_sdp_program(&passes[i].sdp_op, &passes[i].sdp_surface))
+      return -1;
+
+    nna_sdp_enable(0,1);
+
+    nna_wait_done(0x1,0x1);
+    nna_reset();
+  }
+
+  return 0;
+}
+
+int nna_plan_deconv(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_data_cube* src, uint32_t zero_address, nna_data_cube* zero_data, uint32_t weight_address,
+  uint16_t k, uint8_t k_w, uint8_t k_h, uint8_t stride, uint8_t pad, uint8_t output_pad) {
+
+  // Describe a transposed convolution of src as a convolution of the zero
+  // inserted input (zero_data at zero_address, filled by nna_plan_upsample()
+  // with nearest set to 0). Weights must be packed by nna_pack_weights_deconv().
+  nna_data_cube up;
+
+  if (pad > k_w - 1 || pad > k_h - 1 || output_pad >= stride) {
+    printf("nna_plan_deconv - pad %d/%d invalid for %dx%d kernel stride %d\n", pad, output_pad,
+      k_w, k_h, stride);
+    return -1;
+  }
+
+  // Trailing zero rows/columns of the last block aren't part of the input
+  if (stride > 1) {
+    nna_upsample_cube(zero_data, zero_address, src, stride);
+    up = *zero_data;
+    up.width = (src->width - 1) * stride + 1;
+    up.height = (src->height - 1) * stride + 1;
+  } else {
+    *zero_data = *src;
+    up = *src;
+  }
+
+  // Padding is overwritten below, it's passed here so the output size check
+  // allows for kernels larger than the input
+  uint8_t conv_pad = (k_w < k_h ? k_w : k_h) - 1 - pad;
+  if (nna_conv_setup(conv_op, conv_surface, &up, weight_address, k, k_w, k_h, 1, conv_pad, 1))
+    return -1;
+
+  conv_op->pad_x_left = k_w - 1 - pad;
+  conv_op->pad_x_right = k_w - 1 - pad + output_pad;
+  conv_op->pad_y_top = k_h - 1 - pad;
+  conv_op->pad_y_bottom = k_h - 1 - pad + output_pad;
+
+  uint16_t out_w = (src->width - 1) * stride - 2 * pad + k_w + output_pad;
+  uint16_t out_h = (src->height - 1) * stride - 2 * pad + k_h + output_pad;
+
+  nna_feature_cube(&conv_surface->dst_data, 0, out_w, out_h, k, PRECISION_INT8);
+  conv_op->input_width_cmac = out_w;
+  conv_op->input_height_cmac = out_h;
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "nna_config.h"
 #include "nna_interface.h"
@@ -7,7 +9,7 @@
 uint16_t calculate_eps(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface) {
 
   uint16_t eps = 0;
-  uint8_t bpe = 1; // Bytes per element
+  uint8_t bpe = 1 << conv_op->precision; // Bytes per element
   uint16_t memory_atomic_size = NNA_MEMORY_ATOMIC_SIZE;
 
   uint16_t channel = conv_surface->src_data.channel;
@@ -33,14 +35,19 @@ uint16_t calculate_eps(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_su
         break;
       }
   } else {
-    // Add implementation for pixel formats
+    // Pixel data is fetched a line at a time, each slice holds one input line
+    // including the left & right zero padding inserted by CDMA
+    uint32_t line_bytes = (conv_op->pad_x_left + width + conv_op->pad_x_right) *
+      calculate_pixel_channels(conv_op->data_format) * bpe;
+    eps = (line_bytes + NNA_CBUF_ENTRY_WIDTH - 1) / NNA_CBUF_ENTRY_WIDTH;
   }
   return eps;
 }
 
 uint32_t calculate_data_bank(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface) {
-  // Data bank is 512 bytes
-  return (uint32_t)(conv_op->entry_per_slice * conv_surface->src_data.height +
+  // Data bank is 512 bytes, every cube of a batch is held in CBUF
+  uint32_t batch = conv_op->batch ? conv_op->batch : 1;
+  return (uint32_t)(conv_op->entry_per_slice * conv_surface->src_data.height * batch +
     NNA_CBUF_ENTRIES_PER_BANK-1) >> 9; // divide by 512 bytes
 }
 
@@ -48,3 +55,332 @@ uint32_t calculate_weight_bank(nna_conv_surface_desc* conv_surface) {
    // Weight bank is 16K
    return ((conv_surface->weight_data.size & 0xFFFFFFE0) + 0x3FFF) >> 14; // divide by 16384 bytes
 }
+
+void nna_feature_cube(nna_data_cube* cube, uint32_t address, uint16_t width, uint16_t height,
+  uint16_t channel, uint8_t precision) {
+
+  // Feature data is organised as 1x1xNNA_ATOMIC_C_SIZE atoms laid out W->H->C
+  uint8_t bpe = 1 << precision; // Bytes per element
+
+  cube->type = 1;
+  cube->address = address;
+  cube->width = width;
+  cube->height = height;
+  cube->channel = channel;
+  cube->line_stride = width * NNA_ATOMIC_C_SIZE * bpe;
+  cube->surf_stride = cube->line_stride * height;
+  cube->plane_stride = 0;
+  cube->batch_stride = 0;
+  cube->size = cube->surf_stride * ((channel + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE);
+}
+
+uint32_t nna_batch_cube(nna_data_cube* cube, uint8_t batch) {
+
+  // Lay out batch copies of cube one after the other, each starting on a 32 byte
+  // boundary. Returns the total bytes needed for the batch.
+  if (batch <= 1) {
+    cube->batch_stride = 0;
+    return cube->size;
+  }
+
+  cube->batch_stride = (cube->size + 31) & ~31u;
+  return cube->batch_stride * batch;
+}
+
+void nna_cvt_zero_point(nna_cvt_param* cvt, int32_t zero_point) {
+
+  // Set the offset of a converter so zero_point is added to its output. The
+  // converter computes (x - offset) * scale >> truncate so the offset is
+  // -zero_point << truncate / scale, exact when scale divides it.
+  int16_t scale = cvt->scale ? cvt->scale : 1;
+  int64_t shifted = (int64_t)zero_point << cvt->truncate;
+
+  cvt->offset = -(int32_t)((shifted + (shifted < 0 ? -scale : scale) / 2) / scale);
+}
+
+uint8_t calculate_sdp_operand_bytes(nna_sdp_op* op) {
+
+  // Bytes per element read by SDP RDMA, when both ALU and MUL operands come
+  // from memory they are interleaved ALU then MUL for each element
+  return (1 << op->precision) * ((op->type == SDP_OP_BOTH) ? 2 : 1);
+}
+
+void nna_sdp_operand_cube(nna_data_cube* cube, uint32_t address, nna_sdp_op* op, uint16_t width,
+  uint16_t height, uint16_t channel) {
+
+  // Describe the X1, X2 or Y operand cube. Per kernel operands are a 1x1xK
+  // cube (one value per output channel), per point operands match the output cube.
+  uint8_t bpe = calculate_sdp_operand_bytes(op);
+
+  if (op->mode == SDP_OP_PER_KERNEL) {
+    width = 1;
+    height = 1;
+  }
+
+  cube->type = 1;
+  cube->address = address;
+  cube->width = width;
+  cube->height = height;
+  cube->channel = channel;
+  cube->line_stride = width * NNA_ATOMIC_C_SIZE * bpe;
+  cube->surf_stride = cube->line_stride * height;
+  cube->plane_stride = 0;
+  cube->batch_stride = 0;
+  cube->size = cube->surf_stride * ((channel + NNA_ATOMIC_C_SIZE - 1) / NNA_ATOMIC_C_SIZE);
+}
+
+int nna_conv_setup(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  nna_data_cube* src_data, uint32_t weight_address, uint16_t k, uint8_t k_w, uint8_t k_h,
+  uint8_t stride, uint8_t pad, uint8_t dilation) {
+
+  // Describe a direct convolution of a feature input cube with k kernels. The
+  // destination cube is set to the output size with its address left at zero.
+  int32_t out_w = ((src_data->width + pad + pad - ((k_w - 1) * dilation + 1)) / stride) + 1;
+  int32_t out_h = ((src_data->height + pad + pad - ((k_h - 1) * dilation + 1)) / stride) + 1;
+
+  if (out_w <= 0 || out_h <= 0) {
+    printf("nna_conv_setup - kernel %dx%d larger than padded input %dx%d\n", k_w, k_h,
+      src_data->width + pad + pad, src_data->height + pad + pad);
+    return -1;
+  }
+
+  memset(conv_op, 0, sizeof(nna_conv_op_desc));
+  memset(conv_surface, 0, sizeof(nna_conv_surface_desc));
+
+  conv_surface->src_data = *src_data;
+
+  conv_surface->weight_data.width = k_w;
+  conv_surface->weight_data.height = k_h;
+  conv_surface->weight_data.channel = src_data->channel;
+  conv_surface->weight_data.address = weight_address;
+
+  conv_op->data_format = FORMAT_FEATURE;
+
+  conv_op->input_width_csc = src_data->width;
+  conv_op->input_height_csc = src_data->height;
+  conv_op->input_channel_csc = src_data->channel;
+
+  conv_op->stride_x = stride;
+  conv_op->stride_y = stride;
+  conv_op->dilation_x = dilation;
+  conv_op->dilation_y = dilation;
+
+  conv_op->pad_x_left = pad;
+  conv_op->pad_x_right = pad;
+  conv_op->pad_y_top = pad;
+  conv_op->pad_y_bottom = pad;
+
+  conv_op->kernel_width_csc = k_w;
+  conv_op->kernel_height_csc = k_h;
+  conv_op->kernel_channel_csc = src_data->channel;
+
+  nna_feature_cube(&conv_surface->dst_data, 0, out_w, out_h, k, PRECISION_INT8);
+
+  conv_op->input_width_cmac = out_w;
+  conv_op->input_height_cmac = out_h;
+
+  conv_op->entry_per_slice = calculate_eps(conv_op, conv_surface);
+
+  conv_op->bytes_per_kernel = src_data->channel * k_w * k_h;
+  conv_surface->weight_data.size = (k * conv_op->bytes_per_kernel) + 31;
+
+  conv_op->data_bank = calculate_data_bank(conv_op, conv_surface);
+  conv_op->weight_bank = calculate_weight_bank(conv_surface);
+
+  // For feature format we can leave release as zero
+  conv_op->release = 0;
+
+  return 0;
+}
+
+int nna_conv_set_precision(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint8_t precision) {
+
+  // Switch a configured convolution to int8 or int16. Input, weights and output
+  // all use the same precision, the source cube must already be described at
+  // that precision with nna_feature_cube(). The SDP op should set src_precision
+  // and dst_precision to match (dst_precision can be changed to narrow the output).
+  uint8_t bpe = 1 << precision;
+
+  if (precision > PRECISION_INT16) {
+    printf("nna_conv_set_precision - unsupported precision %d\n", precision);
+    return -1;
+  }
+
+  if (conv_op->data_format != FORMAT_FEATURE && precision != PRECISION_INT8) {
+    printf("nna_conv_set_precision - pixel input is int8 only\n");
+    return -1;
+  }
+
+  if (conv_surface->src_data.line_stride != (uint32_t)conv_surface->src_data.width * NNA_ATOMIC_C_SIZE * bpe) {
+    printf("nna_conv_set_precision - source cube line stride %d doesn't match precision %d\n",
+      conv_surface->src_data.line_stride, precision);
+    return -1;
+  }
+
+  conv_op->precision = precision;
+
+  nna_feature_cube(&conv_surface->dst_data, conv_surface->dst_data.address, conv_surface->dst_data.width,
+    conv_surface->dst_data.height, conv_surface->dst_data.channel, precision);
+
+  conv_op->bytes_per_kernel = conv_op->kernel_channel_csc * conv_op->kernel_width_csc *
+    conv_op->kernel_height_csc * bpe;
+  conv_surface->weight_data.size = (conv_surface->dst_data.channel * conv_op->bytes_per_kernel) + 31;
+
+  conv_op->entry_per_slice = calculate_eps(conv_op, conv_surface);
+
+  conv_op->data_bank = calculate_data_bank(conv_op, conv_surface);
+  conv_op->weight_bank = calculate_weight_bank(conv_surface);
+
+  return 0;
+}
+
+uint8_t calculate_pixel_channels(uint8_t format) {
+
+  // Number of channels a pixel format presents to CSC
+  switch (format) {
+    case FORMAT_T_R8:
+      return 1;
+    case FORMAT_T_Y8___U8V8_N444:
+    case FORMAT_T_Y8___V8U8_N444:
+      return 3;
+    case FORMAT_T_A8B8G8R8:
+    case FORMAT_T_A8R8G8B8:
+    case FORMAT_T_B8G8R8A8:
+    case FORMAT_T_R8G8B8A8:
+    case FORMAT_T_X8B8G8R8:
+    case FORMAT_T_X8R8G8B8:
+    case FORMAT_T_B8G8R8X8:
+    case FORMAT_T_R8G8B8X8:
+    case FORMAT_T_A8Y8U8V8:
+    case FORMAT_T_V8U8Y8A8:
+      return 4;
+    default:
+      return 0; // Unsupported
+  }
+}
+
+uint8_t calculate_pixel_bytes(uint8_t format) {
+
+  // Bytes per pixel in the first (or only) plane
+  switch (calculate_pixel_channels(format)) {
+    case 4:
+      return 4;
+    case 0:
+      return 0;
+    default:
+      return 1; // Greyscale or the Y plane of semi-planar YUV
+  }
+}
+
+uint8_t nna_pixel_is_semiplanar(uint8_t format) {
+  return format == FORMAT_T_Y8___U8V8_N444 || format == FORMAT_T_Y8___V8U8_N444;
+}
+
+void nna_pixel_cube(nna_data_cube* cube, uint8_t format, uint32_t address, uint32_t uv_address,
+  uint16_t width, uint16_t height, uint32_t line_stride) {
+
+  // Describe a camera frame, line_stride of 0 means lines are packed
+  if (line_stride == 0)
+    line_stride = width * calculate_pixel_bytes(format);
+
+  cube->type = 1;
+  cube->address = address;
+  cube->width = width;
+  cube->height = height;
+  cube->channel = calculate_pixel_channels(format);
+  cube->line_stride = line_stride;
+  cube->surf_stride = line_stride * height;
+  cube->size = cube->surf_stride;
+  cube->plane_stride = 0;
+  cube->batch_stride = 0;
+
+  if (nna_pixel_is_semiplanar(format)) {
+    // Interleaved UV plane is two bytes per pixel
+    cube->plane_stride = uv_address - address;
+    cube->size += line_stride * 2 * height;
+  }
+}
+
+int nna_conv_set_pixel(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface, uint8_t format,
+  int16_t mean_ry, int16_t mean_gu, int16_t mean_bv, int16_t mean_ax) {
+
+  // Switch a configured convolution to read pixel data directly, the source cube
+  // should already be described with nna_pixel_cube()
+  uint8_t channels = calculate_pixel_channels(format);
+
+  if (channels == 0) {
+    printf("nna_conv_set_pixel - unsupported pixel format %d\n", format);
+    return -1;
+  }
+
+  conv_op->data_format = format;
+  conv_op->pixel_mapping = PIXEL_MAPPING_PITCH_LINEAR;
+  conv_op->pixel_sign_override = 0; // Camera data is unsigned
+
+  // Mean subtraction is done by CDMA as pixels are fetched
+  conv_op->mean_format = MEAN_FORMAT_ENABLE;
+  conv_op->mean_ry = mean_ry;
+  conv_op->mean_gu = mean_gu;
+  conv_op->mean_bv = mean_bv;
+  conv_op->mean_ax = mean_ax;
+
+  conv_surface->src_data.channel = channels;
+  conv_surface->weight_data.channel = channels;
+  conv_op->input_channel_csc = channels;
+  conv_op->kernel_channel_csc = channels;
+
+  // Weights need to be packed for all channels of the format including alpha
+  conv_op->bytes_per_kernel = channels * conv_surface->weight_data.width *
+    conv_surface->weight_data.height;
+  conv_surface->weight_data.size = (conv_surface->dst_data.channel * conv_op->bytes_per_kernel) + 31;
+
+  conv_op->entry_per_slice = calculate_eps(conv_op, conv_surface);
+
+  // Pixel lines are not reused so release every slice at the end of the op
+  conv_op->release = conv_op->input_height_csc;
+
+  conv_op->data_bank = calculate_data_bank(conv_op, conv_surface);
+  conv_op->weight_bank = calculate_weight_bank(conv_surface);
+
+  return 0;
+}
+
+int nna_conv_set_compressed(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint32_t weight_bytes, uint32_t wmb_address, uint32_t wmb_bytes, uint32_t wgs_address) {
+
+  // Switch a configured convolution to weights compressed by nna_compress_weights(),
+  // weight_data.address should point at the non zero weights
+  if (conv_op->data_format != FORMAT_FEATURE) {
+    printf("nna_conv_set_compressed - only feature input supported\n");
+    return -1;
+  }
+
+  if (conv_op->precision != PRECISION_INT8) {
+    printf("nna_conv_set_compressed - only int8 weights supported\n");
+    return -1;
+  }
+
+  if (wmb_bytes > NNA_CBUF_BANK_WEIGHT_SIZE) {
+    printf("nna_conv_set_compressed - %d byte weight mask exceeds one bank\n", wmb_bytes);
+    return -1;
+  }
+
+  conv_op->weight_format = WEIGHT_FORMAT_COMPRESSED;
+
+  // Only the non zero weights are fetched into CBUF
+  conv_surface->weight_data.size = (weight_bytes + 31) & 0xFFFFFFE0;
+
+  conv_surface->wmb_data.type = 1;
+  conv_surface->wmb_data.address = wmb_address;
+  conv_surface->wmb_data.size = wmb_bytes;
+
+  conv_surface->wgs_data.type = 1;
+  conv_surface->wgs_data.address = wgs_address;
+  conv_surface->wgs_data.size = ((conv_surface->dst_data.channel + KERNEL_PER_GROUP - 1) /
+    KERNEL_PER_GROUP) * sizeof(uint32_t);
+
+  conv_op->weight_bank = calculate_weight_bank(conv_surface);
+
+  return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Experimental Winograd F(2x2,3x3) convolution. CDMA transforms 4x4 input
+ * tiles, CMAC multiplies them with 4x4 weights transformed on the host by
+ * nna_pack_weights_winograd() and CACC produces 2x2 output tiles, needing
+ * 16 multiplies per 4 outputs instead of 36.
+ *
+ * NVDLA configurations can be built without Winograd, in which case the
+ * conv mode bits aren't implemented. nna_winograd_probe() checks the bits
+ * can be set, then runs a small convolution as direct and Winograd and
+ * compares the outputs. The result is kept, nna_conv_set_winograd() leaves
+ * ops as direct convolution until a probe has passed.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+// Probe conv, 4x4x8 input to 8 kernels, laid out in the scratch memory
+#define PROBE_DIM 4
+#define PROBE_C 8
+#define PROBE_K 8
+#define PROBE_TRUNCATE 4
+#define PROBE_IN_OFFSET       0x000
+#define PROBE_DIRECT_OFFSET   0x100
+#define PROBE_WINOGRAD_OFFSET 0x200
+#define PROBE_WGT_OFFSET      0x400
+#define PROBE_WINOGRAD_WGT_OFFSET 0x800
+
+static int winograd_probe = -1;
+
+static int set_winograd(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface) {
+
+  if (conv_op->data_format != FORMAT_FEATURE || conv_op->kernel_width_csc != 3 ||
+    conv_op->kernel_height_csc != 3 || conv_op->stride_x != 1 || conv_op->stride_y != 1 ||
+    conv_op->dilation_x != 1 || conv_op->dilation_y != 1 || conv_op->batch > 1 ||
+    conv_op->weight_format != WEIGHT_FORMAT_UNCOMPRESSED || conv_op->precision != PRECISION_INT8)
+    return 1;
+
+  uint16_t out_w = (conv_surface->dst_data.width + 1) & ~1;
+  uint16_t out_h = (conv_surface->dst_data.height + 1) & ~1;
+
+  conv_op->conv_mode = CONV_MODE_WINOGRAD;
+
+  // Extra zero padding at the right/bottom for the last tiles
+  conv_op->pad_x_right += out_w - conv_surface->dst_data.width;
+  conv_op->pad_y_bottom += out_h - conv_surface->dst_data.height;
+
+  // CSC sees the padded input, tiles overlap by 2
+  conv_op->input_width_csc = out_w + 2;
+  conv_op->input_height_csc = out_h + 2;
+
+  nna_feature_cube(&conv_surface->dst_data, conv_surface->dst_data.address, out_w, out_h,
+    conv_surface->dst_data.channel, PRECISION_INT8);
+  conv_op->input_width_cmac = out_w;
+  conv_op->input_height_cmac = out_h;
+
+  // Transformed weights are 4x4
+  conv_op->kernel_width_csc = 4;
+  conv_op->kernel_height_csc = 4;
+  conv_surface->weight_data.width = 4;
+  conv_surface->weight_data.height = 4;
+  conv_op->bytes_per_kernel = conv_surface->src_data.channel * 16;
+  conv_surface->weight_data.size = (conv_surface->dst_data.channel * conv_op->bytes_per_kernel) + 31;
+
+  // CBUF holds the padded input lines
+  nna_conv_surface_desc padded = *conv_surface;
+  padded.src_data.width = conv_op->input_width_csc;
+  conv_op->entry_per_slice = calculate_eps(conv_op, &padded);
+
+  conv_op->data_bank = calculate_data_bank(conv_op, conv_surface);
+  conv_op->weight_bank = calculate_weight_bank(conv_surface);
+
+  return 0;
+}
+
+static int mode_bits_supported() {
+
+  // Write the conv mode bit of CSC and CDMA and read it back
+  nna_conv_set_producer(0,0);
+
+  xregw(0x400Cu, CONV_MODE_WINOGRAD); // CSC_D_MISC_CFG_0
+  xregw(0x3014u, CONV_MODE_WINOGRAD); // CDMA_D_MISC_CFG_0
+
+  int supported = (xregr(0x400Cu) & 0x01) && (xregr(0x3014u) & 0x01);
+
+  xregw(0x400Cu, CONV_MODE_DIRECT);
+  xregw(0x3014u, CONV_MODE_DIRECT);
+
+  return supported;
+}
+
+static int probe_conv(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface,
+  uint8_t truncate) {
+
+  nna_conv_tile tile;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  if (nna_plan_conv(conv_op, conv_surface, &tile, 1) != 1)
+    return -1;
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface->dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface->dst_data;
+
+  sdp_op.conv_mode = conv_op->conv_mode;
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = truncate;
+
+  return nna_run_conv_tiles(&tile, 1, &sdp_op, &sdp_surface);
+}
+
+int nna_winograd_probe(uint32_t scratch_address, nna_mem_io* io) {
+
+  // Run a 3x3 convolution as direct and Winograd in NNA_WINOGRAD_PROBE_BYTES
+  // of scratch memory and compare them. Weights are multiples of 4 so their
+  // transform is exact and both outputs must match. Returns 1 if Winograd
+  // works, the result is kept for nna_winograd_supported().
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  int8_t hwc[PROBE_DIM * PROBE_DIM * PROBE_C];
+  int8_t khwc[PROBE_K * 9 * PROBE_C];
+  int8_t weights[PROBE_K * 16 * PROBE_C + 32];
+  int8_t feature[PROBE_DIM * PROBE_DIM * PROBE_C];
+  int8_t direct[PROBE_DIM * PROBE_DIM * PROBE_K];
+  int8_t winograd[PROBE_DIM * PROBE_DIM * PROBE_K];
+  uint32_t seed = 1;
+  uint8_t shift;
+
+  if (winograd_probe >= 0)
+    return winograd_probe;
+
+  winograd_probe = 0;
+
+  if (!mode_bits_supported()) {
+    printf("nna_winograd_probe - winograd not available\n");
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < sizeof(hwc); i++) {
+    seed = seed * 1103515245 + 12345;
+    hwc[i] = (int8_t)((seed >> 16) & 0x7F) - 64;
+  }
+  for (uint32_t i = 0; i < sizeof(khwc); i++) {
+    seed = seed * 1103515245 + 12345;
+    khwc[i] = (int8_t)(((seed >> 16) % 5) * 4) - 8;
+  }
+
+  nna_feature_cube(&src, scratch_address + PROBE_IN_OFFSET, PROBE_DIM, PROBE_DIM, PROBE_C,
+    PRECISION_INT8);
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  io->loadin(feature, src.size, src.address);
+
+  // Direct
+  nna_conv_setup(&conv_op, &conv_surface, &src, scratch_address + PROBE_WGT_OFFSET, PROBE_K, 3, 3,
+    1, 1, 1);
+  conv_surface.dst_data.address = scratch_address + PROBE_DIRECT_OFFSET;
+
+  int weight_bytes = nna_pack_weights(khwc, PROBE_K, 3, 3, PROBE_C, weights);
+  io->loadin(weights, weight_bytes, conv_surface.weight_data.address);
+
+  if (probe_conv(&conv_op, &conv_surface, PROBE_TRUNCATE))
+    return 0;
+
+  io->loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, feature);
+  nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, direct);
+
+  // Winograd, accumulators are 4 / 2^shift times the direct ones
+  nna_conv_setup(&conv_op, &conv_surface, &src, scratch_address + PROBE_WINOGRAD_WGT_OFFSET, PROBE_K,
+    3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = scratch_address + PROBE_WINOGRAD_OFFSET;
+
+  weight_bytes = nna_pack_weights_winograd(khwc, PROBE_K, PROBE_C, weights, &shift);
+  if (weight_bytes < 0 || set_winograd(&conv_op, &conv_surface))
+    return 0;
+  io->loadin(weights, weight_bytes, conv_surface.weight_data.address);
+
+  if (probe_conv(&conv_op, &conv_surface, PROBE_TRUNCATE + 2 - shift))
+    return 0;
+
+  io->loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, feature);
+  nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, winograd);
+
+  winograd_probe = !memcmp(direct, winograd, sizeof(direct));
+
+  printf("nna_winograd_probe - winograd %s\n", winograd_probe ? "available" :
+    "output differs from direct convolution");
+
+  return winograd_probe;
+}
+
+int nna_winograd_supported() {
+
+  // Result of nna_winograd_probe(), not available until probed
+  return winograd_probe > 0;
+}
+
+int nna_conv_set_winograd(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface) {
+
+  // Switch a configured 3x3 stride 1 convolution to Winograd. Returns 0 when
+  // switched, weights must then be packed by nna_pack_weights_winograd(). The
+  // output is produced in 2x2 tiles so the destination cube is rounded up to
+  // an even width and height. Only int8 is supported. Returns 1 if the op is
+  // left as direct convolution.
+  if (!nna_winograd_supported())
+    return 1;
+
+  return set_winograd(conv_op, conv_surface);
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Compare a 3x3 depthwise convolution (stride 1, pad 1) run on the CPU with
+ * NEON against the NNA lowering from nna_plan_conv_grouped(), for layer
+ * sizes typical of MobileNet. NNA time includes programming every op but not
+ * the layout conversion of the input/output.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define ITERATIONS 20
+#define OUT_SHIFT 7
+#define MAX_TILES 512
+
+struct layer_size {
+  uint16_t w;
+  uint16_t h;
+  uint16_t c;
+};
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static inline int8_t requant(int32_t acc) {
+  // Round and saturate the accumulator to int8
+  acc = (acc + (1 << (OUT_SHIFT - 1))) >> OUT_SHIFT;
+  return acc > 127 ? 127 : (acc < -128 ? -128 : acc);
+}
+
+void depthwise_3x3_ref(const int8_t* hwc, const int8_t* khwc, layer_size* size, int8_t* out) {
+
+  // Scalar reference, weights are Cx3x3x1
+  for (int y = 0; y < size->h; y++) {
+    for (int x = 0; x < size->w; x++) {
+      for (int c = 0; c < size->c; c++) {
+        int32_t acc = 0;
+        for (int ky = 0; ky < 3; ky++) {
+          for (int kx = 0; kx < 3; kx++) {
+            int iy = y + ky - 1;
+            int ix = x + kx - 1;
+            if (iy < 0 || iy >= size->h || ix < 0 || ix >= size->w)
+              continue;
+            acc += hwc[(iy * size->w + ix) * size->c + c] * khwc[(c * 3 + ky) * 3 + kx];
+          }
+        }
+        out[(y * size->w + x) * size->c + c] = requant(acc);
+      }
+    }
+  }
+}
+
+void depthwise_3x3_neon(const int8_t* hwc, const int8_t* khwc, layer_size* size, int8_t* out) {
+
+#ifdef __ARM_NEON
+  // Weights transposed to 9 taps of C channels so 8 channels load at once
+  int8_t* taps = (int8_t*)malloc(9 * size->c);
+  for (int c = 0; c < size->c; c++)
+    for (int t = 0; t < 9; t++)
+      taps[t * size->c + c] = khwc[c * 9 + t];
+
+  int32x4_t shift = vdupq_n_s32(-OUT_SHIFT);
+
+  for (int y = 0; y < size->h; y++) {
+    for (int x = 0; x < size->w; x++) {
+      int c = 0;
+      for (; c + 8 <= size->c; c += 8) {
+        int32x4_t acc_lo = vdupq_n_s32(0);
+        int32x4_t acc_hi = vdupq_n_s32(0);
+        for (int ky = 0; ky < 3; ky++) {
+          int iy = y + ky - 1;
+          if (iy < 0 || iy >= size->h)
+            continue;
+          for (int kx = 0; kx < 3; kx++) {
+            int ix = x + kx - 1;
+            if (ix < 0 || ix >= size->w)
+              continue;
+            int16x8_t prod = vmull_s8(vld1_s8(hwc + (iy * size->w + ix) * size->c + c),
+              vld1_s8(taps + (ky * 3 + kx) * size->c + c));
+            acc_lo = vaddw_s16(acc_lo, vget_low_s16(prod));
+            acc_hi = vaddw_s16(acc_hi, vget_high_s16(prod));
+          }
+        }
+        int16x8_t narrow = vcombine_s16(vqmovn_s32(vrshlq_s32(acc_lo, shift)),
+          vqmovn_s32(vrshlq_s32(acc_hi, shift)));
+        vst1_s8(out + (y * size->w + x) * size->c + c, vqmovn_s16(narrow));
+      }
+      // Remaining channels
+      for (; c < size->c; c++) {
+        int32_t acc = 0;
+        for (int ky = 0; ky < 3; ky++) {
+          for (int kx = 0; kx < 3; kx++) {
+            int iy = y + ky - 1;
+            int ix = x + kx - 1;
+            if (iy < 0 || iy >= size->h || ix < 0 || ix >= size->w)
+              continue;
+            acc += hwc[(iy * size->w + ix) * size->c + c] * taps[(ky * 3 + kx) * size->c + c];
+          }
+        }
+        out[(y * size->w + x) * size->c + c] = requant(acc);
+      }
+    }
+  }
+
+  free(taps);
+#else
+  depthwise_3x3_ref(hwc, khwc, size, out);
+#endif
+}
+
+double depthwise_nna(nna_conv_tile* tiles, int num_tiles, nna_sdp_op_desc* sdp_op,
+  nna_sdp_surface_desc* sdp_surface) {
+
+  double start = now_ms();
+
+  for (int i = 0; i < ITERATIONS; i++)
+    nna_run_conv_tiles(tiles, num_tiles, sdp_op, sdp_surface);
+
+  return (now_ms() - start) / ITERATIONS;
+}
+
+void bench_depthwise(layer_size* size) {
+
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  uint32_t hwc_bytes = size->w * size->h * size->c;
+  uint32_t in_offset = 0;
+  uint32_t out_offset = 0x100000;
+  uint32_t wgt_offset = 0x200000;
+
+  int8_t* hwc = (int8_t*)malloc(hwc_bytes);
+  int8_t* khwc = (int8_t*)malloc(size->c * 9);
+  int8_t* ref = (int8_t*)malloc(hwc_bytes);
+  int8_t* cpu = (int8_t*)malloc(hwc_bytes);
+  int8_t* nna = (int8_t*)malloc(hwc_bytes);
+
+  srand(size->c);
+  for (uint32_t i = 0; i < hwc_bytes; i++)
+    hwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < size->c * 9; i++)
+    khwc[i] = (rand() % 255) - 127;
+
+  // CPU
+  depthwise_3x3_ref(hwc, khwc, size, ref);
+  depthwise_3x3_neon(hwc, khwc, size, cpu);
+
+  double start = now_ms();
+  for (int i = 0; i < ITERATIONS; i++)
+    depthwise_3x3_neon(hwc, khwc, size, cpu);
+  double cpu_ms = (now_ms() - start) / ITERATIONS;
+
+  // NNA
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+in_offset, size->w, size->h, size->c, PRECISION_INT8);
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+wgt_offset, size->c, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+out_offset;
+
+  int8_t* feature = (int8_t*)malloc(src.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes_grouped(size->c, 3, 3, size->c, size->c));
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  int weight_bytes = nna_pack_weights_grouped(khwc, size->c, 3, 3, size->c, size->c, weights);
+
+  dma_loadin((char*)feature, src.size, (uint32_t)(gp_paddr)+in_offset);
+  dma_loadin((char*)weights, weight_bytes, (uint32_t)(gp_paddr)+wgt_offset);
+
+  int num_tiles = nna_plan_conv_grouped(&conv_op, &conv_surface, size->c, tiles, MAX_TILES);
+  if (num_tiles < 0) {
+    printf("%4dx%4dx%4d : can't be lowered\n", size->w, size->h, size->c);
+    goto done;
+  }
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = OUT_SHIFT;
+
+  {
+    double nna_ms = depthwise_nna(tiles, num_tiles, &sdp_op, &sdp_surface);
+
+    dma_loadout((uint32_t)(gp_paddr)+out_offset, src.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, nna);
+
+    int cpu_diff = 0;
+    int nna_diff = 0;
+    for (uint32_t i = 0; i < hwc_bytes; i++) {
+      cpu_diff += cpu[i] != ref[i];
+      nna_diff = abs(nna[i] - ref[i]) > nna_diff ? abs(nna[i] - ref[i]) : nna_diff;
+    }
+
+    printf("%4dx%4dx%4d : cpu %8.3f ms nna %8.3f ms (%3d ops) %-7s cpu mismatches %d nna max diff %d\n",
+      size->w, size->h, size->c, cpu_ms, nna_ms, num_tiles, nna_ms < cpu_ms ? "offload" : "cpu",
+      cpu_diff, nna_diff);
+  }
+
+done:
+  free(feature);
+  free(weights);
+  free(hwc);
+  free(khwc);
+  free(ref);
+  free(cpu);
+  free(nna);
+}
+
+int main(int argc, char **argv) {
+
+  layer_size sizes[] = {
+    {112, 112,  32},
+    { 56,  56,  64},
+    { 56,  56, 128},
+    { 28,  28, 256},
+    { 14,  14, 512},
+    {  7,   7,1024},
+  };
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x280000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+      bench_depthwise(&sizes[i]);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+
+#define ITERATIONS 20
+
+struct frame_size {
+  uint16_t w;
+  uint16_t h;
+  uint16_t c;
+};
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void bench_pack_mt(frame_size* size, uint8_t threads, uint32_t core_mask) {
+
+  // Time pack and unpack of a single int8 frame, checking the round trip
+  nna_data_cube cube;
+  nna_pack_pool* pool = NULL;
+  double start, pack_ms, unpack_ms;
+
+  nna_feature_cube(&cube, 0, size->w, size->h, size->c, PRECISION_INT8);
+
+  uint32_t hwc_bytes = size->w * size->h * size->c;
+  int8_t* hwc = (int8_t*)malloc(hwc_bytes);
+  int8_t* out = (int8_t*)malloc(hwc_bytes);
+  int8_t* feature = (int8_t*)malloc(cube.size);
+
+  for (uint32_t i = 0; i < hwc_bytes; i++)
+    hwc[i] = (int8_t)(i * 31);
+
+  if (threads > 1) {
+    pool = nna_pack_pool_create(threads, core_mask);
+    if (!pool) {
+      printf("Failed to create pool of %d threads\n", threads);
+      goto done;
+    }
+  }
+
+  // Warm up so page faults on first touch are not timed
+  nna_pack_feature(hwc, &cube, PRECISION_INT8, feature);
+  nna_unpack_feature(feature, &cube, PRECISION_INT8, out);
+
+  start = now_ms();
+  for (int i = 0; i < ITERATIONS; i++) {
+    if (pool)
+      nna_pack_feature_mt(pool, hwc, &cube, PRECISION_INT8, feature);
+    else
+      nna_pack_feature(hwc, &cube, PRECISION_INT8, feature);
+  }
+  pack_ms = (now_ms() - start) / ITERATIONS;
+
+  start = now_ms();
+  for (int i = 0; i < ITERATIONS; i++) {
+    if (pool)
+      nna_unpack_feature_mt(pool, feature, &cube, PRECISION_INT8, out);
+    else
+      nna_unpack_feature(feature, &cube, PRECISION_INT8, out);
+  }
+  unpack_ms = (now_ms() - start) / ITERATIONS;
+
+  printf("%4dx%4dx%-3d threads %d  pack %8.3f ms  unpack %8.3f ms  %s\n", size->w, size->h, size->c,
+    threads, pack_ms, unpack_ms, memcmp(hwc, out, hwc_bytes) ? "MISMATCH" : "ok");
+
+  nna_pack_pool_destroy(pool);
+
+done:
+  free(feature);
+  free(out);
+  free(hwc);
+}
+
+int main(int argc, char **argv) {
+
+  // Scaling of the feature pack/unpack over 1-4 threads. An optional core
+  // mask (hex) restricts the workers, e.g. 0xe keeps them off cpu0.
+  frame_size sizes[] = {
+    {143, 79, 8},   // Shape used by the direct convolution tests
+    {320, 240, 3},
+    {640, 480, 3},
+    {1280, 720, 3},
+    {1920, 1080, 3},
+    {1920, 1080, 16}
+  };
+  uint32_t core_mask = (argc > 1) ? strtoul(argv[1], NULL, 16) : 0;
+
+  printf("Running %s core mask %x ...\n", __FUNCTION__, core_mask);
+
+  for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    for (uint8_t threads = 1; threads <= 4; threads++)
+      bench_pack_mt(&sizes[s], threads, core_mask);
+    printf("\n");
+  }
+}
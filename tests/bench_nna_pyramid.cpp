@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Compare building a 3 level image pyramid (1/2, 1/4, 1/8) by 2x2 averaging
+ * on the CPU with NEON against nna_pyramid() on PDP, for camera frame sizes.
+ * Each level is made from the one before. NNA time includes programming
+ * every op, the layout conversion of the input and of the levels read back
+ * is timed separately and the offload decision is made on the total.
+ *
+ * PDP rounds after each of its width and height reciprocals so levels can
+ * differ by one from the CPU, more on later levels as differences carry.
+ *
+ * Camera frames are also run as uint8 with pixel like content (gradients
+ * and noise). They are packed with 128 subtracted, PDP then rounds halves
+ * of negative values away from zero where the CPU rounds them up.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define ITERATIONS 20
+#define LEVELS 3
+
+#define IN_OFFSET    0x000000
+#define LEVEL_OFFSET 0x800000
+
+struct layer_size {
+  uint16_t w;
+  uint16_t h;
+  uint16_t c;
+};
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void downscale_2x_ref(const int8_t* hwc, layer_size* size, int8_t* out) {
+
+  // Rounded average of each 2x2 block, an odd last row/column is dropped
+  uint16_t out_w = size->w / 2;
+
+  for (int y = 0; y < size->h / 2; y++) {
+    for (int x = 0; x < out_w; x++) {
+      for (int c = 0; c < size->c; c++) {
+        const int8_t* p = hwc + ((y * 2) * size->w + x * 2) * size->c + c;
+        int32_t sum = p[0] + p[size->c] + p[size->w * size->c] + p[(size->w + 1) * size->c];
+        out[(y * out_w + x) * size->c + c] = (sum + 2) >> 2;
+      }
+    }
+  }
+}
+
+void downscale_2x_neon(const int8_t* hwc, layer_size* size, int8_t* out, int16_t* rows) {
+
+#ifdef __ARM_NEON
+  uint16_t out_w = size->w / 2;
+  uint32_t row_bytes = size->w * size->c;
+
+  for (int y = 0; y < size->h / 2; y++) {
+    const int8_t* r0 = hwc + (y * 2) * row_bytes;
+    const int8_t* r1 = r0 + row_bytes;
+    int8_t* o = out + y * out_w * size->c;
+
+    // Add the two rows, then pairs of pixels
+    uint32_t i = 0;
+    for (; i + 8 <= row_bytes; i += 8)
+      vst1q_s16(rows + i, vaddl_s8(vld1_s8(r0 + i), vld1_s8(r1 + i)));
+    for (; i < row_bytes; i++)
+      rows[i] = r0[i] + r1[i];
+
+    for (int x = 0; x < out_w; x++) {
+      const int16_t* p = rows + x * 2 * size->c;
+      int c = 0;
+      for (; c + 8 <= size->c; c += 8)
+        vst1_s8(o + x * size->c + c, vrshrn_n_s16(vaddq_s16(vld1q_s16(p + c), vld1q_s16(p + size->c + c)), 2));
+      for (; c < size->c; c++)
+        o[x * size->c + c] = (p[c] + p[size->c + c] + 2) >> 2;
+    }
+  }
+#else
+  downscale_2x_ref(hwc, size, out);
+#endif
+}
+
+void downscale_2x_u8_ref(const uint8_t* hwc, layer_size* size, uint8_t* out) {
+
+  uint16_t out_w = size->w / 2;
+
+  for (int y = 0; y < size->h / 2; y++) {
+    for (int x = 0; x < out_w; x++) {
+      for (int c = 0; c < size->c; c++) {
+        const uint8_t* p = hwc + ((y * 2) * size->w + x * 2) * size->c + c;
+        uint32_t sum = p[0] + p[size->c] + p[size->w * size->c] + p[(size->w + 1) * size->c];
+        out[(y * out_w + x) * size->c + c] = (sum + 2) >> 2;
+      }
+    }
+  }
+}
+
+void downscale_2x_u8_neon(const uint8_t* hwc, layer_size* size, uint8_t* out, uint16_t* rows) {
+
+#ifdef __ARM_NEON
+  uint16_t out_w = size->w / 2;
+  uint32_t row_bytes = size->w * size->c;
+
+  for (int y = 0; y < size->h / 2; y++) {
+    const uint8_t* r0 = hwc + (y * 2) * row_bytes;
+    const uint8_t* r1 = r0 + row_bytes;
+    uint8_t* o = out + y * out_w * size->c;
+
+    uint32_t i = 0;
+    for (; i + 8 <= row_bytes; i += 8)
+      vst1q_u16(rows + i, vaddl_u8(vld1_u8(r0 + i), vld1_u8(r1 + i)));
+    for (; i < row_bytes; i++)
+      rows[i] = r0[i] + r1[i];
+
+    for (int x = 0; x < out_w; x++) {
+      const uint16_t* p = rows + x * 2 * size->c;
+      int c = 0;
+      for (; c + 8 <= size->c; c += 8)
+        vst1_u8(o + x * size->c + c, vrshrn_n_u16(vaddq_u16(vld1q_u16(p + c), vld1q_u16(p + size->c + c)), 2));
+      for (; c < size->c; c++)
+        o[x * size->c + c] = (p[c] + p[size->c + c] + 2) >> 2;
+    }
+  }
+#else
+  downscale_2x_u8_ref(hwc, size, out);
+#endif
+}
+
+void pyramid_cpu(const int8_t* hwc, layer_size* size, int8_t** levels, int16_t* rows, uint8_t neon,
+  uint8_t is_uint8) {
+
+  // Each level from the one before
+  layer_size level = *size;
+  const int8_t* in = hwc;
+
+  for (int i = 0; i < LEVELS; i++) {
+    if (is_uint8 && neon)
+      downscale_2x_u8_neon((const uint8_t*)in, &level, (uint8_t*)levels[i], (uint16_t*)rows);
+    else if (is_uint8)
+      downscale_2x_u8_ref((const uint8_t*)in, &level, (uint8_t*)levels[i]);
+    else if (neon)
+      downscale_2x_neon(in, &level, levels[i], rows);
+    else
+      downscale_2x_ref(in, &level, levels[i]);
+    level.w /= 2;
+    level.h /= 2;
+    in = levels[i];
+  }
+}
+
+static void pack_frame(const int8_t* hwc, nna_data_cube* cube, int8_t* feature, uint8_t is_uint8) {
+  if (is_uint8)
+    nna_pack_feature_uint8((const uint8_t*)hwc, cube, feature);
+  else
+    nna_pack_feature(hwc, cube, PRECISION_INT8, feature);
+}
+
+static void unpack_level(const int8_t* feature, nna_data_cube* cube, int8_t* hwc, uint8_t is_uint8) {
+  if (is_uint8)
+    nna_unpack_feature_uint8(feature, cube, (uint8_t*)hwc);
+  else
+    nna_unpack_feature(feature, cube, PRECISION_INT8, hwc);
+}
+
+void bench_pyramid(layer_size* size, uint8_t is_uint8) {
+
+  nna_pyramid_desc pyramid;
+  nna_pdp_pass passes[LEVELS];
+  int8_t* ref[LEVELS];
+  int8_t* cpu[LEVELS];
+
+  uint32_t in_bytes = size->w * size->h * size->c;
+
+  int8_t* hwc = (int8_t*)malloc(in_bytes);
+  int8_t* nna = (int8_t*)malloc(in_bytes / 4);
+  int16_t* rows = (int16_t*)malloc(size->w * size->c * sizeof(int16_t));
+  for (int i = 0; i < LEVELS; i++) {
+    ref[i] = (int8_t*)malloc(in_bytes >> (2 * (i + 1)));
+    cpu[i] = (int8_t*)malloc(in_bytes >> (2 * (i + 1)));
+  }
+
+  srand(size->w * size->h);
+  if (is_uint8) {
+    // Diagonal gradient per channel with sensor like noise
+    for (int y = 0; y < size->h; y++) {
+      for (int x = 0; x < size->w; x++) {
+        for (int c = 0; c < size->c; c++) {
+          int v = (x * 255 / size->w + y * 255 / size->h) / 2 + c * 16 + (rand() % 17) - 8;
+          ((uint8_t*)hwc)[(y * size->w + x) * size->c + c] = v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+      }
+    }
+  } else {
+    for (uint32_t i = 0; i < in_bytes; i++)
+      hwc[i] = (rand() % 255) - 127;
+  }
+
+  // CPU
+  pyramid_cpu(hwc, size, ref, rows, 0, is_uint8);
+  pyramid_cpu(hwc, size, cpu, rows, 1, is_uint8);
+
+  double start = now_ms();
+  for (int i = 0; i < ITERATIONS; i++)
+    pyramid_cpu(hwc, size, cpu, rows, 1, is_uint8);
+  double cpu_ms = (now_ms() - start) / ITERATIONS;
+
+  // NNA
+  memset(&pyramid, 0, sizeof(pyramid));
+  nna_feature_cube(&pyramid.image, (uint32_t)(gp_paddr)+IN_OFFSET, size->w, size->h, size->c,
+    PRECISION_INT8);
+  pyramid.precision = PRECISION_INT8;
+  pyramid.levels = LEVELS;
+  pyramid.address = (uint32_t)(gp_paddr)+LEVEL_OFFSET;
+
+  int8_t* feature = (int8_t*)malloc(pyramid.image.size);
+
+  int num_passes = nna_plan_pyramid(&pyramid, passes, LEVELS);
+  if (num_passes < 0) {
+    printf("%4dx%4dx%4d : can't be lowered\n", size->w, size->h, size->c);
+    goto done;
+  }
+
+  {
+    double pack_ms = 0;
+    double nna_ms = 0;
+    double unpack_ms = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+      start = now_ms();
+      pack_frame(hwc, &pyramid.image, feature, is_uint8);
+      dma_loadin((char*)feature, pyramid.image.size, pyramid.image.address);
+      double run_start = now_ms();
+      nna_run_pdp_passes(passes, num_passes);
+      double unpack_start = now_ms();
+      for (int l = 0; l < LEVELS; l++) {
+        dma_loadout(pyramid.level[l].address, pyramid.level[l].size, (char*)feature);
+        unpack_level(feature, &pyramid.level[l], nna, is_uint8);
+      }
+      pack_ms += run_start - start;
+      nna_ms += unpack_start - run_start;
+      unpack_ms += now_ms() - unpack_start;
+    }
+    pack_ms /= ITERATIONS;
+    nna_ms /= ITERATIONS;
+    unpack_ms /= ITERATIONS;
+
+    double total_ms = pack_ms + nna_ms + unpack_ms;
+
+    int cpu_diff = 0;
+    int nna_diff = 0;
+    for (int i = 0; i < LEVELS; i++) {
+      uint32_t level_bytes = pyramid.level[i].width * pyramid.level[i].height * size->c;
+
+      dma_loadout(pyramid.level[i].address, pyramid.level[i].size, (char*)feature);
+      unpack_level(feature, &pyramid.level[i], nna, is_uint8);
+
+      cpu_diff += memcmp(cpu[i], ref[i], level_bytes) != 0;
+      for (uint32_t j = 0; j < level_bytes; j++) {
+        int d = is_uint8 ? abs((uint8_t)nna[j] - (uint8_t)ref[i][j]) : abs(nna[j] - ref[i][j]);
+        nna_diff = d > nna_diff ? d : nna_diff;
+      }
+    }
+
+    printf("%4dx%4dx%4d %-5s : cpu %8.3f ms nna %8.3f ms (pack %.3f + %3d ops %.3f + unpack %.3f) %-7s "
+      "cpu mismatches %d nna max diff %d\n", size->w, size->h, size->c, is_uint8 ? "uint8" : "int8",
+      cpu_ms, total_ms, pack_ms,
+      num_passes, nna_ms, unpack_ms, total_ms < cpu_ms ? "offload" : "cpu", cpu_diff, nna_diff);
+  }
+
+done:
+  free(feature);
+  free(hwc);
+  free(nna);
+  free(rows);
+  for (int i = 0; i < LEVELS; i++) {
+    free(ref[i]);
+    free(cpu[i]);
+  }
+}
+
+int main(int argc, char **argv) {
+
+  // Camera frames (RGB) and a larger feature map
+  layer_size sizes[] = {
+    {1280, 720,   3},
+    { 640, 480,   3},
+    { 320, 240,   3},
+    { 320, 240,  32},
+  };
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0xA80000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+      bench_pyramid(&sizes[i], 0);
+
+    // Camera frames as captured
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+      if (sizes[i].c == 3)
+        bench_pyramid(&sizes[i], 1);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Compare 2x nearest and bilinear upsampling run on the CPU with NEON against
+ * the NNA lowering from nna_plan_upsample() and nna_plan_deconv(), for feature
+ * sizes typical of a segmentation/detection neck. NNA time includes programming
+ * every op but not the layout conversion of the input/output.
+ *
+ * Bilinear on the NNA treats pixels outside the input as zero so only the
+ * interior is compared, the outer ring of output pixels differs from the
+ * edge clamped CPU version.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define ITERATIONS 20
+#define MAX_TILES 512
+#define MAX_PASSES 4096
+
+struct layer_size {
+  uint16_t w;
+  uint16_t h;
+  uint16_t c;
+};
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+static nna_sdp_pass passes[MAX_PASSES];
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void nearest_2x_cpu(const int8_t* hwc, layer_size* size, int8_t* out) {
+
+  // Every input pixel is copied to a 2x2 block
+  uint32_t out_w = size->w * 2;
+
+  for (int y = 0; y < size->h; y++) {
+    int8_t* row = out + (uint32_t)(y * 2) * out_w * size->c;
+    for (int x = 0; x < size->w; x++) {
+      const int8_t* in = hwc + (y * size->w + x) * size->c;
+      int8_t* o = row + x * 2 * size->c;
+      int c = 0;
+#ifdef __ARM_NEON
+      for (; c + 16 <= size->c; c += 16) {
+        int8x16_t v = vld1q_s8(in + c);
+        vst1q_s8(o + c, v);
+        vst1q_s8(o + size->c + c, v);
+      }
+#endif
+      for (; c < size->c; c++) {
+        o[c] = in[c];
+        o[size->c + c] = in[c];
+      }
+    }
+    memcpy(row + out_w * size->c, row, out_w * size->c);
+  }
+}
+
+static inline int8_t bilinear_tap(int32_t a, int32_t b, int32_t c, int32_t d) {
+  // Weights 9/16, 3/16, 3/16, 1/16 with rounding
+  return (int8_t)((9 * a + 3 * b + 3 * c + d + 8) >> 4);
+}
+
+void bilinear_2x_ref(const int8_t* hwc, layer_size* size, int8_t* out) {
+
+  // Half pixel centres, input edges are clamped
+  uint32_t out_w = size->w * 2;
+
+  for (int oy = 0; oy < size->h * 2; oy++) {
+    int y0 = oy >> 1;
+    int y1 = (oy & 1) ? y0 + 1 : y0 - 1;
+    y1 = y1 < 0 ? 0 : (y1 >= size->h ? size->h - 1 : y1);
+    for (int ox = 0; ox < size->w * 2; ox++) {
+      int x0 = ox >> 1;
+      int x1 = (ox & 1) ? x0 + 1 : x0 - 1;
+      x1 = x1 < 0 ? 0 : (x1 >= size->w ? size->w - 1 : x1);
+      for (int c = 0; c < size->c; c++) {
+        out[(oy * out_w + ox) * size->c + c] = bilinear_tap(hwc[(y0 * size->w + x0) * size->c + c],
+          hwc[(y0 * size->w + x1) * size->c + c], hwc[(y1 * size->w + x0) * size->c + c],
+          hwc[(y1 * size->w + x1) * size->c + c]);
+      }
+    }
+  }
+}
+
+void bilinear_2x_neon(const int8_t* hwc, layer_size* size, int8_t* out) {
+
+#ifdef __ARM_NEON
+  uint32_t out_w = size->w * 2;
+  int16x8_t three = vdupq_n_s16(3);
+  int16x8_t nine = vdupq_n_s16(9);
+
+  for (int oy = 0; oy < size->h * 2; oy++) {
+    int y0 = oy >> 1;
+    int y1 = (oy & 1) ? y0 + 1 : y0 - 1;
+    y1 = y1 < 0 ? 0 : (y1 >= size->h ? size->h - 1 : y1);
+    for (int ox = 0; ox < size->w * 2; ox++) {
+      int x0 = ox >> 1;
+      int x1 = (ox & 1) ? x0 + 1 : x0 - 1;
+      x1 = x1 < 0 ? 0 : (x1 >= size->w ? size->w - 1 : x1);
+      const int8_t* a = hwc + (y0 * size->w + x0) * size->c;
+      const int8_t* b = hwc + (y0 * size->w + x1) * size->c;
+      const int8_t* c = hwc + (y1 * size->w + x0) * size->c;
+      const int8_t* d = hwc + (y1 * size->w + x1) * size->c;
+      int8_t* o = out + (oy * out_w + ox) * size->c;
+      int ch = 0;
+      for (; ch + 8 <= size->c; ch += 8) {
+        int16x8_t acc = vmulq_s16(vmovl_s8(vld1_s8(a + ch)), nine);
+        acc = vmlaq_s16(acc, vaddl_s8(vld1_s8(b + ch), vld1_s8(c + ch)), three);
+        acc = vaddw_s8(acc, vld1_s8(d + ch));
+        vst1_s8(o + ch, vqrshrn_n_s16(acc, 4));
+      }
+      for (; ch < size->c; ch++)
+        o[ch] = bilinear_tap(a[ch], b[ch], c[ch], d[ch]);
+    }
+  }
+#else
+  bilinear_2x_ref(hwc, size, out);
+#endif
+}
+
+void bench_upsample(layer_size* size) {
+
+  nna_data_cube src;
+  nna_data_cube dst;
+  nna_data_cube zero;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+  int num_tiles = -1;
+
+  uint32_t in_bytes = size->w * size->h * size->c;
+  uint32_t out_bytes = in_bytes * 4;
+  uint32_t in_offset = 0;
+  uint32_t out_offset = 0x100000;
+  uint32_t zero_offset = 0x300000;
+  uint32_t wgt_offset = 0x500000;
+
+  int8_t* hwc = (int8_t*)malloc(in_bytes);
+  int8_t* ref = (int8_t*)malloc(out_bytes);
+  int8_t* cpu = (int8_t*)malloc(out_bytes);
+  int8_t* nna = (int8_t*)malloc(out_bytes);
+
+  srand(size->c);
+  for (uint32_t i = 0; i < in_bytes; i++)
+    hwc[i] = (rand() % 255) - 127;
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+in_offset, size->w, size->h, size->c, PRECISION_INT8);
+  nna_upsample_cube(&dst, (uint32_t)(gp_paddr)+out_offset, &src, 2);
+
+  int8_t* feature = (int8_t*)malloc(dst.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes_grouped(size->c, 4, 4, size->c, size->c));
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  // Nearest
+  {
+    nearest_2x_cpu(hwc, size, cpu);
+
+    double start = now_ms();
+    for (int i = 0; i < ITERATIONS; i++)
+      nearest_2x_cpu(hwc, size, cpu);
+    double cpu_ms = (now_ms() - start) / ITERATIONS;
+
+    int num_passes = nna_plan_upsample(&src, &dst, 2, 1, passes, MAX_PASSES);
+
+    start = now_ms();
+    for (int i = 0; i < ITERATIONS; i++)
+      nna_run_sdp_passes(passes, num_passes);
+    double nna_ms = (now_ms() - start) / ITERATIONS;
+
+    dma_loadout(dst.address, dst.size, (char*)feature);
+    nna_unpack_feature(feature, &dst, PRECISION_INT8, nna);
+
+    printf("%4dx%4dx%4d nearest  : cpu %8.3f ms nna %8.3f ms (%3d ops) %-7s mismatches %d\n",
+      size->w, size->h, size->c, cpu_ms, nna_ms, num_passes, nna_ms < cpu_ms ? "offload" : "cpu",
+      memcmp(cpu, nna, out_bytes) != 0);
+  }
+
+  // Bilinear, zero insertion then a depthwise 4x4 transposed convolution
+  {
+    bilinear_2x_ref(hwc, size, ref);
+    bilinear_2x_neon(hwc, size, cpu);
+
+    double start = now_ms();
+    for (int i = 0; i < ITERATIONS; i++)
+      bilinear_2x_neon(hwc, size, cpu);
+    double cpu_ms = (now_ms() - start) / ITERATIONS;
+
+    if (nna_plan_deconv(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+zero_offset, &zero,
+      (uint32_t)(gp_paddr)+wgt_offset, size->c, 4, 4, 2, 1, 0) == 0) {
+      conv_surface.dst_data.address = dst.address;
+      num_tiles = nna_plan_conv_grouped(&conv_op, &conv_surface, size->c, tiles, MAX_TILES);
+    }
+
+    if (num_tiles < 0) {
+      printf("%4dx%4dx%4d bilinear : can't be lowered\n", size->w, size->h, size->c);
+      goto done;
+    }
+
+    int weight_bytes = nna_pack_weights_bilinear(size->c, weights);
+    dma_loadin((char*)weights, weight_bytes, (uint32_t)(gp_paddr)+wgt_offset);
+
+    // Gaps between the inserted pixels are never written so only clear once
+    memset(feature, 0, zero.size);
+    dma_loadin((char*)feature, zero.size, zero.address);
+
+    int num_passes = nna_plan_upsample(&src, &zero, 2, 0, passes, MAX_PASSES);
+
+    memset(&sdp_op, 0, sizeof(sdp_op));
+    memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+    sdp_surface.src_data = conv_surface.dst_data;
+    sdp_surface.src_data.address = 0; // Input is from conv hw
+    sdp_surface.dst_data = conv_surface.dst_data;
+
+    sdp_op.out_cvt.scale = 1;
+    sdp_op.out_cvt.truncate = 4;
+
+    start = now_ms();
+    for (int i = 0; i < ITERATIONS; i++) {
+      nna_run_sdp_passes(passes, num_passes);
+      nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface);
+    }
+    double nna_ms = (now_ms() - start) / ITERATIONS;
+
+    dma_loadout(dst.address, dst.size, (char*)feature);
+    nna_unpack_feature(feature, &dst, PRECISION_INT8, nna);
+
+    int cpu_diff = memcmp(cpu, ref, out_bytes) != 0;
+    int nna_diff = 0;
+    for (int y = 1; y < size->h * 2 - 1; y++) {
+      for (int x = 1; x < size->w * 2 - 1; x++) {
+        for (int c = 0; c < size->c; c++) {
+          uint32_t i = (y * size->w * 2 + x) * size->c + c;
+          nna_diff = abs(nna[i] - ref[i]) > nna_diff ? abs(nna[i] - ref[i]) : nna_diff;
+        }
+      }
+    }
+
+    printf("%4dx%4dx%4d bilinear : cpu %8.3f ms nna %8.3f ms (%3d ops) %-7s cpu mismatches %d nna max diff %d\n",
+      size->w, size->h, size->c, cpu_ms, nna_ms, num_passes + num_tiles,
+      nna_ms < cpu_ms ? "offload" : "cpu", cpu_diff, nna_diff);
+  }
+
+done:
+  free(feature);
+  free(weights);
+  free(hwc);
+  free(ref);
+  free(cpu);
+  free(nna);
+}
+
+int main(int argc, char **argv) {
+
+  layer_size sizes[] = {
+    {160, 120,  32},
+    { 80,  60,  64},
+    { 40,  30, 128},
+    { 20,  15, 256},
+  };
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x580000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+    for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+      bench_upsample(&sizes[i]);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
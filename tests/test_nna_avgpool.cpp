@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Average pooling with padding and global average pooling of classification
+ * head sizes, including kernels pooled in stages by nna_plan_pool(). Results
+ * are compared bit exact to the PDP model run over the planned passes and
+ * to within one of the true average.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define IN_OFFSET      0x000000
+#define OUT_OFFSET     0x200000
+#define SCRATCH_OFFSET 0x300000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+void nna_avgpool(uint16_t w, uint16_t h, uint16_t c, uint16_t k, uint16_t stride, uint8_t pad,
+  int8_t zero_point) {
+
+  nna_pool_desc pool;
+  nna_pdp_pass passes[NNA_MAX_POOL_STAGES];
+
+  uint16_t out_w = (w + 2 * pad - k) / stride + 1;
+  uint16_t out_h = (h + 2 * pad - k) / stride + 1;
+
+  printf ("Running test %s %dx%dx%d %dx%d stride %d pad %d ...\n", __FUNCTION__, w, h, c, k, k,
+    stride, pad);
+
+  int8_t* in = (int8_t*)malloc(w * h * c);
+  int8_t* out = (int8_t*)malloc(out_w * out_h * c);
+  int8_t* ref = (int8_t*)malloc(w * h * c);
+  int8_t* stage = (int8_t*)malloc(w * h * c);
+
+  srand(w * h * c * k);
+  for (int i = 0; i < w * h * c; i++)
+    in[i] = (rand() % 255) - 127;
+
+  memset(&pool, 0, sizeof(pool));
+  pool.mode = POOL_MODE_AVG;
+  pool.precision = PRECISION_INT8;
+  pool.kernel_w = k;
+  pool.kernel_h = k;
+  pool.stride_x = stride;
+  pool.stride_y = stride;
+  pool.pad_left = pad;
+  pool.pad_right = pad;
+  pool.pad_top = pad;
+  pool.pad_bottom = pad;
+  pool.pad_value = zero_point;
+  pool.scratch_address = (uint32_t)(gp_paddr)+SCRATCH_OFFSET;
+
+  nna_feature_cube(&pool.src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_feature_cube(&pool.dst, (uint32_t)(gp_paddr)+OUT_OFFSET, out_w, out_h, c, PRECISION_INT8);
+
+  int8_t* feature = (int8_t*)malloc(pool.src.size);
+
+  nna_pack_feature(in, &pool.src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, pool.src.size, pool.src.address);
+
+  // Model of the planned passes
+  int num_passes = nna_plan_pool(&pool, passes, NNA_MAX_POOL_STAGES);
+  memcpy(ref, in, w * h * c);
+  for (int i = 0; i < num_passes; i++) {
+    nna_ref_pdp(&passes[i].pdp_op, &passes[i].pdp_surface, ref, stage);
+    memcpy(ref, stage, w * h * c);
+  }
+
+  if (num_passes < 0 || nna_pool(&pool)) {
+    printf("Failed to run pooling\n");
+  } else {
+    dma_loadout(pool.dst.address, pool.dst.size, (char*)feature);
+    nna_unpack_feature(feature, &pool.dst, PRECISION_INT8, out);
+
+    int errors = 0;
+    for (int y = 0; y < out_h; y++) {
+      for (int x = 0; x < out_w; x++) {
+        for (int ch = 0; ch < c; ch++) {
+          int32_t sum = 0;
+          for (int ky = 0; ky < k; ky++) {
+            for (int kx = 0; kx < k; kx++) {
+              int iy = y * stride - pad + ky;
+              int ix = x * stride - pad + kx;
+              if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                sum += zero_point;
+              else
+                sum += in[(iy * w + ix) * c + ch];
+            }
+          }
+          int i = (y * out_w + x) * c + ch;
+          int avg = (int)lround((double)sum / (k * k));
+          if (out[i] != ref[i] || abs(out[i] - avg) > 1) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d (average %d)\n", y, x, ch, out[i], ref[i], avg);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d errors in %d passes\n", errors ? "FAILED" : "PASSED", errors, num_passes);
+  }
+
+  free(in);
+  free(out);
+  free(ref);
+  free(stage);
+  free(feature);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x400000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Padded 3x3 with a zero point and 2x2 downsampling in one op
+    nna_avgpool(56, 56, 32, 3, 2, 1, -5);
+    nna_avgpool(56, 56, 32, 2, 2, 0, 0);
+
+    // Global pooling of classification heads, 7x7 in one op, 14x14 and 20x20
+    // in two stages, 13x13 padded to 14x14 and a large kernel that isn't global
+    nna_avgpool(7, 7, 1024, 7, 7, 0, 0);
+    nna_avgpool(14, 14, 512, 14, 14, 0, 0);
+    nna_avgpool(20, 20, 256, 20, 20, 0, 0);
+    nna_avgpool(13, 13, 256, 13, 13, 0, 0);
+    nna_avgpool(32, 32, 64, 16, 16, 0, 0);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Convert cubes between int8 and int16 with SDP on its own, widening with a
+ * zero point and gain and narrowing with saturation, compared bit exact to
+ * the model of the SDP output converter.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define SRC_OFFSET 0x000000
+#define DST_OFFSET 0x200000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static const char* names[] = { "int8", "int16" };
+
+void nna_convert_precision(uint8_t src_precision, uint8_t dst_precision, uint16_t w, uint16_t h,
+  uint16_t c, int32_t zero_point, uint16_t scale, uint8_t truncate) {
+
+  // Convert a random cube between precisions and compare to the bit exact
+  // model of the SDP output converter
+  nna_convert_desc convert;
+  nna_sdp_op_desc sdp_op;
+
+  printf ("Running test %s %s to %s %dx%dx%d ...\n", __FUNCTION__, names[src_precision],
+    names[dst_precision], w, h, c);
+
+  int count = w * h * c;
+  int16_t* src = (int16_t*)malloc(count * sizeof(int16_t));
+  int16_t* dst = (int16_t*)malloc(count * sizeof(int16_t));
+  int8_t* src8 = (int8_t*)malloc(count);
+  int8_t* dst8 = (int8_t*)malloc(count);
+
+  srand(w * h * c + src_precision);
+  for (int i = 0; i < count; i++) {
+    src[i] = src_precision == PRECISION_INT16 ? (rand() % 65535) - 32767 : (rand() % 255) - 127;
+    src8[i] = src[i];
+  }
+
+  memset(&convert, 0, sizeof(convert));
+  convert.src_precision = src_precision;
+  convert.dst_precision = dst_precision;
+  nna_feature_cube(&convert.src, (uint32_t)(gp_paddr)+SRC_OFFSET, w, h, c, src_precision);
+  nna_feature_cube(&convert.dst, (uint32_t)(gp_paddr)+DST_OFFSET, w, h, c, dst_precision);
+  convert.cvt.scale = scale;
+  convert.cvt.truncate = truncate;
+  nna_cvt_zero_point(&convert.cvt, zero_point);
+
+  // The reference is the pass the conversion is planned to
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  sdp_op.dst_precision = dst_precision;
+  sdp_op.out_cvt = convert.cvt;
+
+  int8_t* feature = (int8_t*)malloc(convert.src.size > convert.dst.size ? convert.src.size : convert.dst.size);
+
+  nna_pack_feature(src_precision == PRECISION_INT16 ? (void*)src : (void*)src8, &convert.src,
+    src_precision, feature);
+  dma_loadin((char*)feature, convert.src.size, convert.src.address);
+
+  if (nna_convert(&convert)) {
+    printf("Failed to run convert\n");
+  } else {
+    dma_loadout(convert.dst.address, convert.dst.size, (char*)feature);
+    nna_unpack_feature(feature, &convert.dst, dst_precision,
+      dst_precision == PRECISION_INT16 ? (void*)dst : (void*)dst8);
+
+    int errors = 0;
+    for (int i = 0; i < count; i++) {
+      int32_t r = nna_ref_sdp_out(&sdp_op, src[i]);
+      int32_t v = dst_precision == PRECISION_INT16 ? dst[i] : dst8[i];
+      if (r != v) {
+        if (errors < 8)
+          printf("dst[%d] %d expected %d\n", i, v, r);
+        errors++;
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+  free(src);
+  free(dst);
+  free(src8);
+  free(dst8);
+  free(feature);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x400000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Widen int8 with a zero point and gain to int16, narrow int16 back to
+    // int8 (saturating) and a plain copy of each width
+    nna_convert_precision(PRECISION_INT8, PRECISION_INT16, 56, 56, 64, -3, 181, 0);
+    nna_convert_precision(PRECISION_INT16, PRECISION_INT8, 56, 56, 64, 0, 1, 8);
+    nna_convert_precision(PRECISION_INT16, PRECISION_INT8, 17, 9, 13, 100, 3, 9);
+    nna_convert_precision(PRECISION_INT8, PRECISION_INT8, 28, 28, 32, 0, 1, 0);
+    nna_convert_precision(PRECISION_INT16, PRECISION_INT16, 28, 28, 32, 0, 1, 0);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
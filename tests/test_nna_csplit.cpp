@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define MAX_TILES 1024
+
+#define IN_OFFSET      0x000000
+#define BIAS_OFFSET    0x0F0000
+#define OUT_OFFSET     0x100000
+#define PARTIAL_OFFSET 0x180000
+#define WGT_OFFSET     0x200000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+static inline int32_t round_shift(int32_t v, uint8_t shift) {
+  return shift ? (v + (1 << (shift - 1))) >> shift : v;
+}
+
+void nna_csplit_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k, uint8_t k_size,
+  uint16_t slice_c, uint8_t clip, uint8_t out_shift) {
+
+  // Same size convolution with per kernel bias and relu, the input channels
+  // are split into slices of slice_c (0 picks the largest that fits). The CPU
+  // reference rounds each slice's accumulators like CACC and saturates the
+  // int16 partial sums. The output is allowed to differ by one.
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+  uint8_t pad = k_size / 2;
+
+  printf ("Running test %s %dx%dx%d %dx%dx%d ...\n", __FUNCTION__, w, h, c, k_size, k_size, k);
+
+  int8_t* hwc = (int8_t*)malloc(w * h * c);
+  int8_t* khwc = (int8_t*)malloc((uint32_t)k * k_size * k_size * c);
+  int16_t* bias = (int16_t*)malloc(k * sizeof(int16_t));
+  int8_t* out = (int8_t*)malloc(w * h * k);
+
+  srand(w * h * c + k);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (rand() % 255) - 127;
+  for (uint32_t i = 0; i < (uint32_t)k * k_size * k_size * c; i++)
+    khwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k; i++)
+    bias[i] = (rand() % 2048) - 1024;
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, k_size, k_size,
+    1, pad, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+  conv_op.clip_truncate = clip;
+
+  if (slice_c == 0)
+    slice_c = nna_csplit_channels(&conv_op, &conv_surface);
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+
+  sdp_op.x1_op.enable = 1;
+  sdp_op.x1_op.type = SDP_OP_ADD;
+  sdp_op.x1_op.mode = SDP_OP_PER_KERNEL;
+  sdp_op.x1_op.precision = PRECISION_INT16;
+  sdp_op.x1_op.act = ACTIVATION_RELU;
+  nna_sdp_operand_cube(&sdp_surface.x1_data, (uint32_t)(gp_paddr)+BIAS_OFFSET, &sdp_op.x1_op, 1, 1, k);
+
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = out_shift;
+
+  int8_t* feature = (int8_t*)malloc(src.size > conv_surface.dst_data.size ? src.size :
+    conv_surface.dst_data.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes_csplit(k, k_size, k_size, c, slice_c));
+  int16_t* operand = (int16_t*)malloc(k * sizeof(int16_t) + 16);
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  int weight_bytes = nna_pack_weights_csplit(khwc, k, k_size, k_size, c, slice_c, weights);
+  dma_loadin((char*)weights, weight_bytes, (uint32_t)(gp_paddr)+WGT_OFFSET);
+
+  int operand_bytes = nna_pack_sdp_kernel(bias, 0, k, &sdp_op.x1_op, operand);
+  dma_loadin((char*)operand, operand_bytes, sdp_surface.x1_data.address);
+
+  int num_tiles = nna_plan_conv_csplit(&conv_op, &conv_surface, slice_c, tiles, MAX_TILES);
+
+  if (num_tiles < 0 || nna_run_conv_csplit(tiles, num_tiles, &sdp_op, &sdp_surface,
+    (uint32_t)(gp_paddr)+PARTIAL_OFFSET)) {
+    printf("Failed to run channel split conv\n");
+  } else {
+    dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, out);
+
+    int errors = 0;
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        for (int kk = 0; kk < k; kk++) {
+          int32_t partial = 0;
+          for (int cb = 0; cb < c; cb += slice_c) {
+            int cn = (c - cb) < slice_c ? (c - cb) : slice_c;
+            int32_t acc = 0;
+            for (int ky = 0; ky < k_size; ky++) {
+              for (int kx = 0; kx < k_size; kx++) {
+                int iy = y + ky - pad;
+                int ix = x + kx - pad;
+                if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                  continue;
+                for (int ch = cb; ch < cb + cn; ch++)
+                  acc += hwc[(iy * w + ix) * c + ch] *
+                    khwc[(((uint32_t)kk * k_size + ky) * k_size + kx) * c + ch];
+              }
+            }
+            partial += round_shift(acc, clip);
+            if (cb + slice_c < c)
+              partial = partial > 32767 ? 32767 : (partial < -32768 ? -32768 : partial);
+          }
+          int32_t v = partial + bias[kk];
+          v = v < 0 ? 0 : v;
+          v = round_shift(v, out_shift);
+          v = v > 127 ? 127 : v;
+          if (abs(v - out[(y * w + x) * k + kk]) > 1) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d\n", y, x, kk, out[(y * w + x) * k + kk], v);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d slices of %d channels, %d ops, %d errors\n", errors ? "FAILED" : "PASSED",
+      (c + slice_c - 1) / slice_c, slice_c, num_tiles, errors);
+  }
+
+  free(hwc);
+  free(khwc);
+  free(bias);
+  free(out);
+  free(feature);
+  free(weights);
+  free(operand);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x600000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // ResNet tail layer forced into 4 slices, a layer too deep for a single
+    // kernel group and a wide 5x5 layer that also needs height tiling
+    nna_csplit_conv(7, 7, 512, 64, 3, 128, 4, 5);
+    nna_csplit_conv(3, 3, 8192, 8, 3, 0, 7, 4);
+    nna_csplit_conv(30, 20, 1024, 24, 5, 256, 6, 4);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
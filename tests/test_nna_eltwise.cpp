@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Elementwise add, mul, max and min of two int8 cubes in memory with the
+ * second operand rescaled and the result requantised, compared to a CPU
+ * reference. The output is allowed to differ by one due to rounding in SDP.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define A_OFFSET   0x000000
+#define B_OFFSET   0x100000
+#define OUT_OFFSET 0x200000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static const char* names[] = { "add", "mul", "max", "min" };
+
+static int32_t cvt(int32_t x, nna_cvt_param* param) {
+  // (x - offset) * scale >> truncate with rounding
+  int64_t v = (int64_t)(x - param->offset) * param->scale;
+  return param->truncate ? (int32_t)((v + (1LL << (param->truncate - 1))) >> param->truncate) : (int32_t)v;
+}
+
+void nna_eltwise_op(uint8_t op, uint16_t w, uint16_t h, uint16_t c) {
+
+  nna_eltwise_desc eltwise;
+
+  printf ("Running test %s %s %dx%dx%d ...\n", __FUNCTION__, names[op], w, h, c);
+
+  int8_t* a = (int8_t*)malloc(w * h * c);
+  int8_t* b = (int8_t*)malloc(w * h * c);
+  int8_t* out = (int8_t*)malloc(w * h * c);
+
+  srand(op * w * h * c);
+  for (int i = 0; i < w * h * c; i++) {
+    a[i] = (rand() % 255) - 127;
+    b[i] = (rand() % 255) - 127;
+  }
+
+  memset(&eltwise, 0, sizeof(eltwise));
+  eltwise.op = op;
+  eltwise.precision = PRECISION_INT8;
+  nna_feature_cube(&eltwise.a, (uint32_t)(gp_paddr)+A_OFFSET, w, h, c, PRECISION_INT8);
+  nna_feature_cube(&eltwise.b, (uint32_t)(gp_paddr)+B_OFFSET, w, h, c, PRECISION_INT8);
+  nna_feature_cube(&eltwise.out, (uint32_t)(gp_paddr)+OUT_OFFSET, w, h, c, PRECISION_INT8);
+
+  // b is at 3/4 of the scale of a (with a zero point of 2), the result is halved
+  // for add/max/min and scaled down by 128 for mul
+  eltwise.b_cvt.enable = 1;
+  eltwise.b_cvt.offset = 2;
+  eltwise.b_cvt.scale = 3;
+  eltwise.b_cvt.truncate = 2;
+  eltwise.out_cvt.scale = 1;
+  eltwise.out_cvt.truncate = op == NNA_ELTWISE_MUL ? 7 : 1;
+
+  int8_t* feature = (int8_t*)malloc(eltwise.a.size);
+
+  nna_pack_feature(a, &eltwise.a, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, eltwise.a.size, eltwise.a.address);
+  nna_pack_feature(b, &eltwise.b, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, eltwise.b.size, eltwise.b.address);
+
+  if (nna_eltwise(&eltwise)) {
+    printf("Failed to run eltwise\n");
+  } else {
+    dma_loadout(eltwise.out.address, eltwise.out.size, (char*)feature);
+    nna_unpack_feature(feature, &eltwise.out, PRECISION_INT8, out);
+
+    int errors = 0;
+    for (int i = 0; i < w * h * c; i++) {
+      int32_t y = cvt(b[i], &eltwise.b_cvt);
+      int32_t r;
+      switch (op) {
+        case NNA_ELTWISE_ADD:
+          r = a[i] + y;
+          break;
+        case NNA_ELTWISE_MUL:
+          r = a[i] * y;
+          break;
+        case NNA_ELTWISE_MAX:
+          r = a[i] > y ? a[i] : y;
+          break;
+        default:
+          r = a[i] < y ? a[i] : y;
+          break;
+      }
+      r = cvt(r, &eltwise.out_cvt);
+      r = r > 127 ? 127 : (r < -128 ? -128 : r);
+      if (abs(r - out[i]) > 1) {
+        if (errors < 8)
+          printf("out[%d] %d expected %d\n", i, out[i], r);
+        errors++;
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+  free(a);
+  free(b);
+  free(out);
+  free(feature);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x300000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // ResNet skip connection sizes and an odd channel count
+    for (uint8_t op = NNA_ELTWISE_ADD; op <= NNA_ELTWISE_MIN; op++)
+      nna_eltwise_op(op, 56, 56, 64);
+    nna_eltwise_op(NNA_ELTWISE_ADD, 28, 28, 128);
+    nna_eltwise_op(NNA_ELTWISE_ADD, 17, 9, 13);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Run a 3x3 convolution (pad 1) followed by chains of post ops planned by
+ * nna_plan_sdp_fusion(), check the number of passes and compare bit exact to
+ * the CPU model of the SDP datapath evaluated over the same plan.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define MAX_TILES 64
+#define MAX_PASSES 4
+
+#define IN_OFFSET      0x000000
+#define OUT_OFFSET     0x080000
+#define WGT_OFFSET     0x100000
+#define BIAS_OFFSET    0x1E0000
+#define BN_OFFSET      0x1E8000
+#define RES_OFFSET     0x1F0000
+#define PARTIAL_OFFSET 0x200000
+
+#define CHAIN_BIAS_RELU       0 // bias -> relu -> requant
+#define CHAIN_BN_RESIDUAL     1 // bn -> residual add -> relu -> requant
+#define CHAIN_BIAS_BN_CVT_RES 2 // bias -> bn -> converted residual add -> relu -> requant
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+static nna_sdp_pass passes[MAX_PASSES];
+
+struct host_operand {
+  uint32_t address;
+  uint8_t mode;
+  const int16_t* alu;
+  const int16_t* mul;
+};
+
+static void operand_values(host_operand* operands, int num_operands, uint32_t address,
+  uint32_t pos, uint16_t k, uint16_t channels, int32_t* alu, int32_t* mul) {
+
+  // Values of the host copy of the operand at address for output element pos, kernel k
+  *alu = 0;
+  *mul = 0;
+  for (int i = 0; i < num_operands; i++) {
+    if (!address || operands[i].address != address)
+      continue;
+    uint32_t idx = operands[i].mode == SDP_OP_PER_POINT ? pos * channels + k : k;
+    *alu = operands[i].alu ? operands[i].alu[idx] : 0;
+    *mul = operands[i].mul ? operands[i].mul[idx] : 0;
+  }
+}
+
+void nna_fusion_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k, int chain_type, int expected) {
+
+  nna_data_cube src;
+  nna_data_cube res_cube;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_surface_desc sdp_surface;
+  nna_post_chain chain;
+  nna_sdp_op op;
+  host_operand operands[3];
+  int num_operands = 0;
+
+  printf ("Running test %s %dx%dx%d -> %d chain %d ...\n", __FUNCTION__, w, h, c, k, chain_type);
+
+  int8_t* hwc = (int8_t*)malloc(w * h * c);
+  int8_t* khwc = (int8_t*)malloc(k * 9 * c);
+  int16_t* bias = (int16_t*)malloc(k * sizeof(int16_t));
+  int16_t* bn_add = (int16_t*)malloc(k * sizeof(int16_t));
+  int16_t* bn_mul = (int16_t*)malloc(k * sizeof(int16_t));
+  int16_t* res = (int16_t*)malloc(w * h * k * sizeof(int16_t));
+  int8_t* out = (int8_t*)malloc(w * h * k);
+
+  // Small weights keep the partial of a split chain mostly within int16
+  srand(w * h * c * k + chain_type);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k * 9 * c; i++)
+    khwc[i] = (rand() % 31) - 15;
+  for (int i = 0; i < k; i++) {
+    bias[i] = (rand() % 2048) - 1024;
+    bn_add[i] = (rand() % 4096) - 2048;
+    bn_mul[i] = (rand() % 48) + 16;
+  }
+  for (int i = 0; i < w * h * k; i++)
+    res[i] = (rand() % 255) - 127;
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  int8_t* feature = (int8_t*)malloc(src.size > conv_surface.dst_data.size ? src.size : conv_surface.dst_data.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(k, 3, 3, c));
+  int8_t* operand = (int8_t*)malloc(w * h * k + 4 * k + 32);
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  int weight_bytes = nna_pack_weights(khwc, k, 3, 3, c, weights);
+  dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+  // Operands, packed with an op of the type the planner gives the stage
+  memset(&op, 0, sizeof(op));
+  op.type = SDP_OP_ADD;
+  op.mode = SDP_OP_PER_KERNEL;
+  op.precision = PRECISION_INT16;
+  int bytes = nna_pack_sdp_kernel(bias, 0, k, &op, operand);
+  dma_loadin((char*)operand, bytes, (uint32_t)(gp_paddr)+BIAS_OFFSET);
+
+  op.type = SDP_OP_BOTH;
+  bytes = nna_pack_sdp_kernel(bn_add, bn_mul, k, &op, operand);
+  dma_loadin((char*)operand, bytes, (uint32_t)(gp_paddr)+BN_OFFSET);
+
+  op.type = SDP_OP_ADD;
+  op.mode = SDP_OP_PER_POINT;
+  op.precision = PRECISION_INT8;
+  nna_sdp_operand_cube(&res_cube, (uint32_t)(gp_paddr)+RES_OFFSET, &op, w, h, k);
+  bytes = nna_pack_sdp_point(res, 0, &res_cube, &op, operand);
+  dma_loadin((char*)operand, bytes, res_cube.address);
+
+  // Chain
+  memset(&chain, 0, sizeof(chain));
+  chain.src_precision = PRECISION_INT8;
+  chain.dst_precision = PRECISION_INT8;
+  chain.out_cvt.scale = 1;
+  chain.out_cvt.truncate = chain_type == CHAIN_BIAS_RELU ? 7 : 5;
+
+  if (chain_type != CHAIN_BN_RESIDUAL) {
+    nna_post_op* post = &chain.ops[chain.num_ops++];
+    post->type = NNA_POST_ADD;
+    post->mode = SDP_OP_PER_KERNEL;
+    post->precision = PRECISION_INT16;
+    post->shift = 4;
+    post->address = (uint32_t)(gp_paddr)+BIAS_OFFSET;
+    operands[num_operands++] = (host_operand){ post->address, SDP_OP_PER_KERNEL, bias, 0 };
+  }
+
+  if (chain_type != CHAIN_BIAS_RELU) {
+    nna_post_op* post = &chain.ops[chain.num_ops++];
+    post->type = NNA_POST_BN;
+    post->mode = SDP_OP_PER_KERNEL;
+    post->precision = PRECISION_INT16;
+    post->shift = 2;
+    post->truncate = 8;
+    post->address = (uint32_t)(gp_paddr)+BN_OFFSET;
+    operands[num_operands++] = (host_operand){ post->address, SDP_OP_PER_KERNEL, bn_add, bn_mul };
+
+    post = &chain.ops[chain.num_ops++];
+    post->type = NNA_POST_ADD;
+    post->mode = SDP_OP_PER_POINT;
+    post->precision = PRECISION_INT8;
+    post->address = res_cube.address;
+    if (chain_type == CHAIN_BIAS_BN_CVT_RES) {
+      post->cvt.enable = 1;
+      post->cvt.scale = 3;
+      post->cvt.truncate = 1;
+      post->cvt.offset = -5;
+    } else {
+      post->shift = 5;
+    }
+    operands[num_operands++] = (host_operand){ post->address, SDP_OP_PER_POINT, res, 0 };
+  }
+
+  chain.ops[chain.num_ops++].type = NNA_POST_RELU;
+
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+
+  int num_passes = nna_plan_sdp_fusion(&chain, &sdp_surface, (uint32_t)(gp_paddr)+PARTIAL_OFFSET,
+    passes, MAX_PASSES);
+  int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+
+  if (num_passes != expected) {
+    printf("FAILED %d passes expected %d\n", num_passes, expected);
+  } else if (num_tiles < 0 || nna_run_conv_fused(tiles, num_tiles, passes, num_passes)) {
+    printf("Failed to run convolution\n");
+  } else {
+    dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, out);
+
+    int errors = 0;
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        for (int kk = 0; kk < k; kk++) {
+          int32_t acc = 0;
+          for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+              int iy = y + ky - 1;
+              int ix = x + kx - 1;
+              if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                continue;
+              for (int ch = 0; ch < c; ch++)
+                acc += hwc[(iy * w + ix) * c + ch] * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+            }
+          }
+
+          // Every pass of the plan in turn
+          int64_t v = acc;
+          uint32_t pos = y * w + x;
+          for (int p = 0; p < num_passes; p++) {
+            nna_sdp_op_desc* sdp_op = &passes[p].sdp_op;
+            nna_sdp_surface_desc* surface = &passes[p].sdp_surface;
+            int32_t alu, mul;
+
+            operand_values(operands, num_operands, surface->x1_data.address, pos, kk, k, &alu, &mul);
+            v = nna_ref_sdp_x(&sdp_op->x1_op, v, alu, mul);
+            operand_values(operands, num_operands, surface->x2_data.address, pos, kk, k, &alu, &mul);
+            v = nna_ref_sdp_x(&sdp_op->x2_op, v, alu, mul);
+            operand_values(operands, num_operands, surface->y_data.address, pos, kk, k, &alu, &mul);
+            v = nna_ref_sdp_y(&sdp_op->y_op, v, alu, mul);
+            v = nna_ref_sdp_out(sdp_op, v);
+          }
+
+          if (v != out[pos * k + kk]) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d\n", y, x, kk, out[pos * k + kk], (int)v);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d errors (%d passes)\n", errors ? "FAILED" : "PASSED", errors, num_passes);
+  }
+
+  free(hwc);
+  free(khwc);
+  free(bias);
+  free(bn_add);
+  free(bn_mul);
+  free(res);
+  free(out);
+  free(feature);
+  free(weights);
+  free(operand);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x280000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Bias and relu in X1, batch norm and residual add in X1/X2, and a
+    // converted residual that needs Y so relu spills into a second pass
+    nna_fusion_conv(32, 32, 8, 16, CHAIN_BIAS_RELU, 1);
+    nna_fusion_conv(32, 32, 8, 16, CHAIN_BN_RESIDUAL, 1);
+    nna_fusion_conv(19, 11, 12, 24, CHAIN_BIAS_BN_CVT_RES, 2);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
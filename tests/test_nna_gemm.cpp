@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define OUT_SHIFT 9
+#define BIAS_SHIFT 4
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+void nna_gemm_mxkxn(uint16_t m, uint16_t k, uint16_t n) {
+
+  // Multiply a random MxK matrix by a random KxN matrix, add a per column bias
+  // with relu and compare to a CPU reference. The output is allowed to differ
+  // by one from the reference due to rounding in SDP.
+  nna_gemm_desc gemm;
+  nna_data_cube a_cube;
+  nna_data_cube c_cube;
+  nna_sdp_op bias_op;
+
+  printf ("Running test %s %dx%dx%d ...\n", __FUNCTION__, m, k, n);
+
+  int8_t* a = (int8_t*)malloc(m * k);
+  int8_t* b = (int8_t*)malloc(k * n);
+  int16_t* bias = (int16_t*)malloc(n * sizeof(int16_t));
+  int8_t* c = (int8_t*)malloc(m * n);
+
+  srand(m * k * n);
+  for (int i = 0; i < m * k; i++)
+    a[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k * n; i++)
+    b[i] = (rand() % 255) - 127;
+  for (int i = 0; i < n; i++)
+    bias[i] = (rand() % 2048) - 1024;
+
+  memset(&gemm, 0, sizeof(gemm));
+  gemm.m = m;
+  gemm.k = k;
+  gemm.n = n;
+  gemm.a_address = (uint32_t)(gp_paddr);
+  gemm.b_address = (uint32_t)(gp_paddr)+0x200000;
+  gemm.bias_address = (uint32_t)(gp_paddr)+0x3F0000;
+  gemm.c_address = (uint32_t)(gp_paddr)+0x400000;
+  gemm.bias_type = SDP_OP_ADD;
+  gemm.bias_shift = BIAS_SHIFT;
+  gemm.act = ACTIVATION_RELU;
+  gemm.out_cvt.scale = 1;
+  gemm.out_cvt.truncate = OUT_SHIFT;
+
+  // Convert the operands to the NNA layouts
+  nna_feature_cube(&a_cube, gemm.a_address, 1, m, k, PRECISION_INT8);
+  nna_feature_cube(&c_cube, gemm.c_address, 1, m, n, PRECISION_INT8);
+
+  memset(&bias_op, 0, sizeof(bias_op));
+  bias_op.type = SDP_OP_ADD;
+  bias_op.precision = PRECISION_INT16;
+
+  int8_t* feature = (int8_t*)malloc(a_cube.size > c_cube.size ? a_cube.size : c_cube.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(n, 1, 1, k));
+  int16_t* operand = (int16_t*)malloc(n * sizeof(int16_t) + 16);
+
+  nna_pack_feature(a, &a_cube, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, a_cube.size, gemm.a_address);
+
+  int weight_bytes = nna_pack_gemm_b(b, k, n, weights);
+  dma_loadin((char*)weights, weight_bytes, gemm.b_address);
+
+  int operand_bytes = nna_pack_sdp_kernel(bias, 0, n, &bias_op, operand);
+  dma_loadin((char*)operand, operand_bytes, gemm.bias_address);
+
+  if (nna_gemm(&gemm)) {
+    printf("Failed to run gemm\n");
+  } else {
+    dma_loadout(gemm.c_address, c_cube.size, (char*)feature);
+    nna_unpack_feature(feature, &c_cube, PRECISION_INT8, c);
+
+    int errors = 0;
+    for (int i = 0; i < m; i++) {
+      for (int j = 0; j < n; j++) {
+        int32_t acc = bias[j] << BIAS_SHIFT;
+        for (int q = 0; q < k; q++)
+          acc += a[i * k + q] * b[q * n + j];
+        acc = (acc + (1 << (OUT_SHIFT - 1))) >> OUT_SHIFT;
+        acc = acc < 0 ? 0 : (acc > 127 ? 127 : acc);
+        if (abs(acc - c[i * n + j]) > 1) {
+          if (errors < 8)
+            printf("c[%d][%d] %d expected %d\n", i, j, c[i * n + j], acc);
+          errors++;
+        }
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+  free(a);
+  free(b);
+  free(bias);
+  free(c);
+  free(feature);
+  free(weights);
+  free(operand);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x500000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Keyword spotting sized layer, a batch of transformer tokens and a layer
+    // that needs both row tiling and column splitting
+    nna_gemm_mxkxn(1, 250, 12);
+    nna_gemm_mxkxn(64, 128, 512);
+    nna_gemm_mxkxn(1000, 1024, 1000);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
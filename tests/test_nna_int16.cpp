@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Run a 3x3 convolution with int16 input, weights and output and compare to
+ * a CPU reference, the output is expected to match exactly.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define OUT_SHIFT 12
+#define MAX_TILES 64
+
+#define IN_OFFSET  0x000000
+#define OUT_OFFSET 0x100000
+#define WGT_OFFSET 0x300000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+void conv_int16_ref(const int16_t* hwc, const int16_t* khwc, uint16_t w, uint16_t h, uint16_t c,
+  uint16_t k, int16_t* out) {
+
+  // Accumulate in 64 bits then round and saturate to int16
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      for (int kk = 0; kk < k; kk++) {
+        int64_t acc = 0;
+        for (int ky = 0; ky < 3; ky++) {
+          for (int kx = 0; kx < 3; kx++) {
+            int iy = y + ky - 1;
+            int ix = x + kx - 1;
+            if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+              continue;
+            for (int ch = 0; ch < c; ch++)
+              acc += (int32_t)hwc[(iy * w + ix) * c + ch] * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+          }
+        }
+        // Rounded half away from zero as the output converter does
+        out[(y * w + x) * k + kk] = nna_ref_saturate(nna_ref_shift_right(acc, OUT_SHIFT), 16);
+      }
+    }
+  }
+}
+
+void nna_int16_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k) {
+
+  // 3x3 convolution (pad 1), all int16
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  printf ("Running test %s %dx%dx%d -> %d ...\n", __FUNCTION__, w, h, c, k);
+
+  int16_t* hwc = (int16_t*)malloc(w * h * c * sizeof(int16_t));
+  int16_t* khwc = (int16_t*)malloc(k * 9 * c * sizeof(int16_t));
+  int16_t* ref = (int16_t*)malloc(w * h * k * sizeof(int16_t));
+  int16_t* out = (int16_t*)malloc(w * h * k * sizeof(int16_t));
+
+  srand(w * h * c * k);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (rand() % 8191) - 4095;
+  for (int i = 0; i < k * 9 * c; i++)
+    khwc[i] = (rand() % 2047) - 1023;
+
+  conv_int16_ref(hwc, khwc, w, h, c, k, ref);
+
+  // Input cube is described at int16, 16 bytes per atom
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT16);
+
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  if (nna_conv_set_precision(&conv_op, &conv_surface, PRECISION_INT16)) {
+    printf("Failed to set int16 precision\n");
+    goto done;
+  }
+
+  {
+    int8_t* feature = (int8_t*)malloc(src.size > conv_surface.dst_data.size ? src.size : conv_surface.dst_data.size);
+    int16_t* weights = (int16_t*)malloc(nna_weight_bytes_int16(k, 3, 3, c));
+
+    nna_pack_feature(hwc, &src, PRECISION_INT16, feature);
+    dma_loadin((char*)feature, src.size, src.address);
+
+    int weight_bytes = nna_pack_weights_int16(khwc, k, 3, 3, c, weights);
+    dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+    memset(&sdp_op, 0, sizeof(sdp_op));
+    memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+    sdp_surface.src_data = conv_surface.dst_data;
+    sdp_surface.src_data.address = 0; // Input is from conv hw
+    sdp_surface.dst_data = conv_surface.dst_data;
+
+    sdp_op.src_precision = PRECISION_INT16;
+    sdp_op.dst_precision = PRECISION_INT16;
+    sdp_op.out_cvt.scale = 1;
+    sdp_op.out_cvt.truncate = OUT_SHIFT;
+
+    int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+    if (num_tiles < 0 || nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface)) {
+      printf("Failed to run int16 convolution\n");
+    } else {
+      dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+      nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT16, out);
+
+      int errors = 0;
+      for (int i = 0; i < w * h * k; i++) {
+        if (out[i] != ref[i]) {
+          if (errors < 8)
+            printf("out[%d] %d expected %d\n", i, out[i], ref[i]);
+          errors++;
+        }
+      }
+      printf("%s %d errors (%d tiles)\n", errors ? "FAILED" : "PASSED", errors, num_tiles);
+    }
+
+    free(feature);
+    free(weights);
+  }
+
+done:
+  free(hwc);
+  free(khwc);
+  free(ref);
+  free(out);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x320000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Single pass, odd channels and a layer tiled by height
+    nna_int16_conv(28, 28, 16, 32);
+    nna_int16_conv(20, 15, 12, 20);
+    nna_int16_conv(40, 300, 24, 80);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Generate lookup tables for sigmoid, tanh, swish and hard swish, report the
+ * table accuracy against the float functions then run each table on SDP over
+ * every int8 input and compare to the host model of the lookup.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define IN_SCALE  (1.0f / 16.0f)
+#define OUT_SHIFT 4
+
+#define IN_OFFSET  0x0000
+#define OUT_OFFSET 0x1000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static const char* names[] = { "sigmoid", "tanh", "swish", "hard swish" };
+
+static float out_scale(uint8_t function) {
+  // Sigmoid and tanh are within +/-1, swish and hard swish reach the input range
+  return (function == NNA_LUT_SIGMOID || function == NNA_LUT_TANH) ? 1.0f / 2048.0f : 1.0f / 256.0f;
+}
+
+void nna_lut_report() {
+
+  // Table accuracy for int8 inputs and a wider int16 input range
+  nna_lut_param lut;
+  float max_err;
+  float mean_err;
+
+  printf ("Running test %s ...\n", __FUNCTION__);
+
+  for (uint8_t f = NNA_LUT_SIGMOID; f <= NNA_LUT_HARD_SWISH; f++) {
+    nna_lut_generate(&lut, f, IN_SCALE, out_scale(f));
+    nna_lut_accuracy(&lut, f, IN_SCALE, out_scale(f), -128, 127, &max_err, &mean_err);
+    printf("%-10s int8  in : max error %.3f mean %.3f output steps\n", names[f], max_err, mean_err);
+
+    nna_lut_generate(&lut, f, IN_SCALE / 256.0f, out_scale(f));
+    nna_lut_accuracy(&lut, f, IN_SCALE / 256.0f, out_scale(f), -32768, 32767, &max_err, &mean_err);
+    printf("%-10s int16 in : max error %.3f mean %.3f output steps\n", names[f], max_err, mean_err);
+  }
+}
+
+void nna_lut_sdp(uint8_t function) {
+
+  // Every int8 value through Y with only the LUT enabled, output requantised
+  // to int8 by the output converter
+  nna_lut_param lut;
+  nna_sdp_pass pass;
+  nna_data_cube cube;
+
+  uint16_t w = 32;
+  uint16_t h = 8;
+  uint16_t c = 8;
+
+  printf ("Running test %s %s ...\n", __FUNCTION__, names[function]);
+
+  int8_t* hwc = (int8_t*)malloc(w * h * c);
+  int8_t* out = (int8_t*)malloc(w * h * c);
+  int8_t* feature = (int8_t*)malloc(w * h * c);
+
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (i % 256) - 128;
+
+  nna_lut_generate(&lut, function, IN_SCALE, out_scale(function));
+
+  nna_feature_cube(&cube, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_pack_feature(hwc, &cube, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, cube.size, cube.address);
+
+  memset(&pass, 0, sizeof(pass));
+  pass.sdp_surface.src_data = cube;
+  pass.sdp_surface.dst_data = cube;
+  pass.sdp_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  pass.sdp_op.y_op.enable = 1;
+  pass.sdp_op.y_op.type = SDP_OP_NONE;
+  pass.sdp_op.y_op.act = ACTIVATION_LUT;
+  pass.sdp_op.lut = &lut;
+  pass.sdp_op.out_cvt.scale = 1;
+  pass.sdp_op.out_cvt.truncate = OUT_SHIFT;
+
+  if (nna_run_sdp_passes(&pass, 1)) {
+    printf("Failed to run SDP\n");
+  } else {
+    dma_loadout(pass.sdp_surface.dst_data.address, cube.size, (char*)feature);
+    nna_unpack_feature(feature, &cube, PRECISION_INT8, out);
+
+    int errors = 0;
+    float max_err = 0.0f;
+    for (int i = 0; i < w * h * c; i++) {
+      int32_t expected = (nna_lut_eval(&lut, hwc[i]) + (1 << (OUT_SHIFT - 1))) >> OUT_SHIFT;
+      expected = expected > 127 ? 127 : (expected < -128 ? -128 : expected);
+      if (abs(expected - out[i]) > 1) {
+        if (errors < 8)
+          printf("x %d out %d expected %d\n", hwc[i], out[i], expected);
+        errors++;
+      }
+      // Error to the float function in int8 output steps
+      float err = fabsf(out[i] - nna_lut_reference(function, hwc[i] * IN_SCALE) /
+        (out_scale(function) * (1 << OUT_SHIFT)));
+      max_err = err > max_err ? err : max_err;
+    }
+    printf("%s %d errors, max error to float %.3f\n", errors ? "FAILED" : "PASSED", errors, max_err);
+  }
+
+  free(hwc);
+  free(out);
+  free(feature);
+}
+
+int main(int argc, char **argv) {
+
+  nna_lut_report();
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x2000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    for (uint8_t f = NNA_LUT_SIGMOID; f <= NNA_LUT_HARD_SWISH; f++)
+      nna_lut_sdp(f);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Max and min pooling of feature maps wider than the PDP line buffer read
+ * from memory, the output is split by nna_pdp_plan_split() and compared to a
+ * CPU reference.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define IN_OFFSET  0x000000
+#define OUT_OFFSET 0x400000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+void nna_pdp_split(uint8_t mode, uint16_t w, uint16_t h, uint16_t c, uint8_t k, uint8_t stride,
+  uint8_t pad) {
+
+  nna_pdp_op_desc pdp_op;
+  nna_pdp_surface_desc pdp_surface;
+
+  uint16_t out_w = (w + 2 * pad - k) / stride + 1;
+  uint16_t out_h = (h + 2 * pad - k) / stride + 1;
+
+  printf ("Running test %s %s %dx%dx%d %dx%d stride %d pad %d ...\n", __FUNCTION__,
+    mode == POOL_MODE_MAX ? "max" : "min", w, h, c, k, k, stride, pad);
+
+  int8_t* in = (int8_t*)malloc(w * h * c);
+  int8_t* out = (int8_t*)malloc(out_w * out_h * c);
+
+  srand(w * h * c * k);
+  for (int i = 0; i < w * h * c; i++)
+    in[i] = (rand() % 255) - 127;
+
+  memset(&pdp_op, 0, sizeof(pdp_op));
+  memset(&pdp_surface, 0, sizeof(pdp_surface));
+
+  pdp_op.pool_mode = mode;
+  pdp_op.pool_width = k;
+  pdp_op.pool_height = k;
+  pdp_op.stride_x = stride;
+  pdp_op.stride_y = stride;
+  pdp_op.pad_left = pad;
+  pdp_op.pad_top = pad;
+  pdp_op.pad_right = pad;
+  pdp_op.pad_bottom = pad;
+
+  nna_feature_cube(&pdp_surface.src_data, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_feature_cube(&pdp_surface.dst_data, (uint32_t)(gp_paddr)+OUT_OFFSET, out_w, out_h, c, PRECISION_INT8);
+
+  int8_t* feature = (int8_t*)malloc(pdp_surface.src_data.size);
+
+  nna_pack_feature(in, &pdp_surface.src_data, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, pdp_surface.src_data.size, pdp_surface.src_data.address);
+
+  nna_pdp_set_producer(0,0);
+
+  if (nna_pdp_program(&pdp_op, &pdp_surface)) {
+    printf("Failed to program pooling\n");
+  } else {
+    nna_pdp_enable(0,1);
+
+    nna_wait_done(0x10,0x10);
+    nna_reset();
+
+    printf("%d splits, input %d/%d/%d output %d/%d/%d\n", pdp_op.split_num,
+      pdp_op.partial_in_width_first, pdp_op.partial_in_width_mid, pdp_op.partial_in_width_last,
+      pdp_op.partial_out_width_first, pdp_op.partial_out_width_mid, pdp_op.partial_out_width_last);
+
+    dma_loadout(pdp_surface.dst_data.address, pdp_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &pdp_surface.dst_data, PRECISION_INT8, out);
+
+    // Padding takes no part in max and min pooling
+    int errors = 0;
+    for (int y = 0; y < out_h; y++) {
+      for (int x = 0; x < out_w; x++) {
+        for (int ch = 0; ch < c; ch++) {
+          int r = mode == POOL_MODE_MAX ? -128 : 127;
+          for (int ky = 0; ky < k; ky++) {
+            for (int kx = 0; kx < k; kx++) {
+              int iy = y * stride - pad + ky;
+              int ix = x * stride - pad + kx;
+              if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                continue;
+              int v = in[(iy * w + ix) * c + ch];
+              r = mode == POOL_MODE_MAX ? (v > r ? v : r) : (v < r ? v : r);
+            }
+          }
+          int o = out[(y * out_w + x) * c + ch];
+          if (o != r) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d\n", y, x, ch, o, r);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+  free(in);
+  free(out);
+  free(feature);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x600000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // 1280 wide detection feature maps, a narrow map that needs no split,
+    // overlapping 3x3 kernels and a 1920 wide stride 1 map with many splits
+    nna_pdp_split(POOL_MODE_MAX, 1280, 24, 16, 2, 2, 0);
+    nna_pdp_split(POOL_MODE_MAX, 160, 24, 16, 2, 2, 0);
+    nna_pdp_split(POOL_MODE_MAX, 1280, 24, 16, 3, 2, 1);
+    nna_pdp_split(POOL_MODE_MIN, 1920, 8, 8, 3, 1, 1);
+
+    // Stride of the kernel, the last input columns are left unread
+    nna_pdp_split(POOL_MODE_MAX, 2048, 12, 8, 3, 3, 0);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
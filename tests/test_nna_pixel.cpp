@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Run a 3x3 convolution (pad 1) directly from a camera frame in each of the
+ * greyscale, packed 32-bit and semi-planar YUV pixel formats. CDMA subtracts
+ * the mean as pixels are fetched and the weights are remapped to the byte
+ * order of the format, the result should match a CPU reference exactly. The
+ * large frame doesn't fit in CBUF so is also split into tiles by height.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define OUT_SHIFT 10
+#define MEAN 128
+#define MAX_TILES 64
+
+#define IN_OFFSET   0x000000
+#define OUT_OFFSET  0x100000
+#define WGT_OFFSET  0x300000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+void nna_pixel_conv(uint16_t w, uint16_t h, uint8_t format, uint16_t k) {
+
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  printf ("Running test %s %dx%d format %d -> %d ...\n", __FUNCTION__, w, h, format, k);
+
+  // Source channels of the weights, greyscale or RGB/YUV
+  uint8_t c = calculate_pixel_channels(format) == 1 ? 1 : 3;
+  uint8_t pixel_bytes = calculate_pixel_bytes(format);
+
+  // Lines are aligned to 32 bytes
+  uint32_t line_stride = ((uint32_t)w * pixel_bytes + 31) & 0xFFFFFFE0;
+  uint32_t uv_address = (uint32_t)(gp_paddr)+IN_OFFSET + line_stride * h;
+  nna_pixel_cube(&src, format, (uint32_t)(gp_paddr)+IN_OFFSET, uv_address, w, h, line_stride);
+
+  // Memory byte of the format each source channel is read from
+  int8_t order[4];
+  int8_t byte_of[3];
+  int pc = nna_pixel_channel_order(format, order);
+  for (int j = 0; j < pc; j++) {
+    if (order[j] >= 0)
+      byte_of[order[j]] = j;
+  }
+
+  uint8_t* frame = (uint8_t*)malloc(src.size);
+  int8_t* khwc = (int8_t*)malloc(k * 9 * c);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(k, 3, 3, pc));
+  int8_t* out = (int8_t*)malloc(w * h * k);
+  int8_t* feature = NULL;
+
+  srand(w * h * k + format);
+  for (uint32_t i = 0; i < src.size; i++)
+    frame[i] = rand() % 256;
+  for (int i = 0; i < k * 9 * c; i++)
+    khwc[i] = (rand() % 255) - 127;
+
+  dma_loadin((char*)frame, src.size, src.address);
+
+  if (nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1) ||
+      nna_conv_set_pixel(&conv_op, &conv_surface, format, MEAN, MEAN, MEAN, MEAN)) {
+    printf("Failed to set up convolution\n");
+    goto done;
+  }
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  {
+    int weight_bytes = nna_pack_weights_pixel(khwc, k, 3, 3, c, format, weights);
+    dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+  }
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = OUT_SHIFT;
+
+  {
+    int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+    if (num_tiles < 0 || nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface)) {
+      printf("Failed to run convolution\n");
+      goto done;
+    }
+    printf("%d tiles\n", num_tiles);
+  }
+
+  {
+    feature = (int8_t*)malloc(conv_surface.dst_data.size);
+    dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, out);
+
+    int errors = 0;
+    for (int kk = 0; kk < k; kk++) {
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          // Padding is zero after the mean is subtracted
+          int64_t acc = 0;
+          for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+              int iy = y + ky - 1;
+              int ix = x + kx - 1;
+              if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                continue;
+              for (int ch = 0; ch < c; ch++) {
+                // Semi-planar U and V are interleaved in the second plane
+                uint8_t p;
+                if (nna_pixel_is_semiplanar(format) && byte_of[ch] > 0)
+                  p = frame[line_stride * h + iy * line_stride * 2 + ix * 2 + byte_of[ch] - 1];
+                else
+                  p = frame[iy * line_stride + ix * pixel_bytes + byte_of[ch]];
+                acc += (p - MEAN) * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+              }
+            }
+          }
+          // Rounded half away from zero as the output converter does
+          acc = nna_ref_saturate(nna_ref_shift_right(acc, OUT_SHIFT), 8);
+          if (acc != out[(y * w + x) * k + kk]) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d\n", y, x, kk, out[(y * w + x) * k + kk], (int)acc);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+done:
+  free(frame);
+  free(khwc);
+  free(weights);
+  free(out);
+  free(feature);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x400000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    nna_pixel_conv(64, 48, FORMAT_T_R8, 8);
+    nna_pixel_conv(64, 48, FORMAT_T_A8B8G8R8, 16);
+    nna_pixel_conv(61, 37, FORMAT_T_X8R8G8B8, 8);
+    nna_pixel_conv(61, 37, FORMAT_T_B8G8R8A8, 8);
+    nna_pixel_conv(64, 48, FORMAT_T_Y8___U8V8_N444, 8);
+    nna_pixel_conv(61, 37, FORMAT_T_Y8___V8U8_N444, 8);
+
+    // Split into tiles by height
+    nna_pixel_conv(640, 360, FORMAT_T_A8B8G8R8, 8);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
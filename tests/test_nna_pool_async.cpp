@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Pool a wide feature map from memory on PDP while a GEMM runs on conv/SDP,
+ * both results are checked against CPU references and the time is compared
+ * to running the two one after the other. The first GEMM tile is run without
+ * a reset so the pooling must have finished alongside it, the reset after it
+ * waits for the pooling and the second GEMM starts from a reset NNA.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define POOL_IN_OFFSET  0x000000
+#define POOL_OUT_OFFSET 0x100000
+#define GEMM_A_OFFSET   0x200000
+#define GEMM_B_OFFSET   0x280000
+#define GEMM_BIAS_OFFSET 0x2F0000
+#define GEMM_C_OFFSET   0x300000
+#define GEMM_C2_OFFSET  0x380000
+
+#define OUT_SHIFT 9
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[NNA_GEMM_MAX_TILES];
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void nna_pool_async(uint16_t w, uint16_t h, uint16_t c, uint16_t m, uint16_t k, uint16_t n) {
+
+  nna_pool_desc pool;
+  nna_pdp_pass pass;
+  nna_gemm_desc gemm;
+  nna_gemm_desc gemm2;
+  nna_data_cube a_cube;
+  nna_data_cube c_cube;
+  nna_sdp_op bias_op;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+  nna_sdp_surface_desc tile_surface;
+  int pool_done = 0;
+
+  printf ("Running test %s pool %dx%dx%d gemm %dx%dx%d ...\n", __FUNCTION__, w, h, c, m, k, n);
+
+  int8_t* in = (int8_t*)malloc(w * h * c);
+  int8_t* pooled = (int8_t*)malloc((w / 2) * (h / 2) * c);
+  int8_t* a = (int8_t*)malloc(m * k);
+  int8_t* b = (int8_t*)malloc(k * n);
+  int16_t* bias = (int16_t*)calloc(n, sizeof(int16_t));
+  int8_t* out = (int8_t*)malloc(m * n);
+  int8_t* out2 = (int8_t*)malloc(m * n);
+
+  srand(w * h * c + m * k * n);
+  for (int i = 0; i < w * h * c; i++)
+    in[i] = (rand() % 255) - 127;
+  for (int i = 0; i < m * k; i++)
+    a[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k * n; i++)
+    b[i] = (rand() % 255) - 127;
+
+  // 2x2 max pooling from memory
+  memset(&pool, 0, sizeof(pool));
+  pool.mode = POOL_MODE_MAX;
+  pool.precision = PRECISION_INT8;
+  pool.kernel_w = 2;
+  pool.kernel_h = 2;
+  pool.stride_x = 2;
+  pool.stride_y = 2;
+  nna_feature_cube(&pool.src, (uint32_t)(gp_paddr)+POOL_IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_feature_cube(&pool.dst, (uint32_t)(gp_paddr)+POOL_OUT_OFFSET, w / 2, h / 2, c, PRECISION_INT8);
+
+  // GEMM on a different tensor
+  memset(&gemm, 0, sizeof(gemm));
+  gemm.m = m;
+  gemm.k = k;
+  gemm.n = n;
+  gemm.a_address = (uint32_t)(gp_paddr)+GEMM_A_OFFSET;
+  gemm.b_address = (uint32_t)(gp_paddr)+GEMM_B_OFFSET;
+  gemm.bias_address = (uint32_t)(gp_paddr)+GEMM_BIAS_OFFSET;
+  gemm.c_address = (uint32_t)(gp_paddr)+GEMM_C_OFFSET;
+  gemm.bias_type = SDP_OP_ADD;
+  gemm.out_cvt.scale = 1;
+  gemm.out_cvt.truncate = OUT_SHIFT;
+
+  // Same product to another output
+  gemm2 = gemm;
+  gemm2.c_address = (uint32_t)(gp_paddr)+GEMM_C2_OFFSET;
+
+  nna_feature_cube(&a_cube, gemm.a_address, 1, m, k, PRECISION_INT8);
+  nna_feature_cube(&c_cube, gemm.c_address, 1, m, n, PRECISION_INT8);
+
+  memset(&bias_op, 0, sizeof(bias_op));
+  bias_op.type = SDP_OP_ADD;
+  bias_op.precision = PRECISION_INT16;
+
+  int8_t* feature = (int8_t*)malloc(pool.src.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(n, 1, 1, k));
+  int16_t* operand = (int16_t*)malloc(n * sizeof(int16_t) + 16);
+
+  nna_pack_feature(in, &pool.src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, pool.src.size, pool.src.address);
+  nna_pack_feature(a, &a_cube, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, a_cube.size, gemm.a_address);
+  int weight_bytes = nna_pack_gemm_b(b, k, n, weights);
+  dma_loadin((char*)weights, weight_bytes, gemm.b_address);
+  int operand_bytes = nna_pack_sdp_kernel(bias, 0, n, &bias_op, operand);
+  dma_loadin((char*)operand, operand_bytes, gemm.bias_address);
+
+  if (nna_plan_pool(&pool, &pass, 1) != 1) {
+    printf("Failed to plan pooling\n");
+    goto done;
+  }
+
+  {
+    // One after the other
+    double start = now_ms();
+    if (nna_pool_submit(&pass) || nna_pool_wait() || nna_gemm(&gemm) || nna_gemm(&gemm2)) {
+      printf("Failed to run pooling and gemm\n");
+      goto done;
+    }
+    double serial_ms = now_ms() - start;
+
+    // Pooling left running while the first gemm tile runs, the tile is run
+    // by hand as nna_run_conv_tiles() would reset and wait for the pooling
+    start = now_ms();
+    int num_tiles = nna_gemm_plan(&gemm, tiles, NNA_GEMM_MAX_TILES, &sdp_op, &sdp_surface);
+    if (num_tiles < 1 || nna_sdp_tile_surface(&sdp_op, &sdp_surface, &tiles[0], &tile_surface) ||
+        nna_pool_submit(&pass)) {
+      printf("Failed to run pooling and gemm\n");
+      goto done;
+    }
+
+    nna_conv_set_producer(0,0);
+    nna_sdp_set_producer(0,0);
+
+    if (nna_conv_program(&tiles[0].conv_op, &tiles[0].conv_surface)) {
+      printf("Failed to run pooling and gemm\n");
+      nna_pool_wait();
+      goto done;
+    }
+    nna_sdp_program(&sdp_op, &tile_surface);
+
+    nna_conv_enable(0,0);
+    nna_sdp_enable(0,1);
+
+    nna_wait_done(0x150001,0x150001);
+    pool_done = nna_pool_poll();
+    if (!tiles[0].conv_op.skip_data_rls && !tiles[0].conv_op.skip_weight_rls)
+      nna_reset();
+
+    if (nna_run_conv_tiles(tiles + 1, num_tiles - 1, &sdp_op, &sdp_surface) || nna_gemm(&gemm2)) {
+      printf("Failed to run pooling and gemm\n");
+      nna_pool_wait();
+      goto done;
+    }
+    nna_pool_wait();
+    double overlap_ms = now_ms() - start;
+
+    printf("serial %.3f ms overlapped %.3f ms\n", serial_ms, overlap_ms);
+  }
+
+  {
+    int errors = 0;
+
+    if (!pool_done) {
+      printf("pooling still running after the first gemm tile\n");
+      errors++;
+    }
+
+    dma_loadout(pool.dst.address, pool.dst.size, (char*)feature);
+    nna_unpack_feature(feature, &pool.dst, PRECISION_INT8, pooled);
+
+    for (int y = 0; y < h / 2; y++) {
+      for (int x = 0; x < w / 2; x++) {
+        for (int ch = 0; ch < c; ch++) {
+          int r = -128;
+          for (int ky = 0; ky < 2; ky++)
+            for (int kx = 0; kx < 2; kx++)
+              r = in[((y * 2 + ky) * w + x * 2 + kx) * c + ch] > r ? in[((y * 2 + ky) * w + x * 2 + kx) * c + ch] : r;
+          if (pooled[(y * (w / 2) + x) * c + ch] != r) {
+            if (errors < 8)
+              printf("pooled[%d][%d][%d] %d expected %d\n", y, x, ch, pooled[(y * (w / 2) + x) * c + ch], r);
+            errors++;
+          }
+        }
+      }
+    }
+
+    // The output is allowed to differ by one from the reference due to
+    // rounding in SDP
+    dma_loadout(gemm.c_address, c_cube.size, (char*)feature);
+    nna_unpack_feature(feature, &c_cube, PRECISION_INT8, out);
+    dma_loadout(gemm2.c_address, c_cube.size, (char*)feature);
+    nna_unpack_feature(feature, &c_cube, PRECISION_INT8, out2);
+
+    for (int i = 0; i < m; i++) {
+      for (int j = 0; j < n; j++) {
+        int32_t acc = 0;
+        for (int q = 0; q < k; q++)
+          acc += a[i * k + q] * b[q * n + j];
+        acc = (acc + (1 << (OUT_SHIFT - 1))) >> OUT_SHIFT;
+        acc = acc > 127 ? 127 : (acc < -128 ? -128 : acc);
+        if (abs(acc - out[i * n + j]) > 1) {
+          if (errors < 8)
+            printf("c[%d][%d] %d expected %d\n", i, j, out[i * n + j], acc);
+          errors++;
+        }
+        if (out2[i * n + j] != out[i * n + j]) {
+          if (errors < 8)
+            printf("second c[%d][%d] %d expected %d\n", i, j, out2[i * n + j], out[i * n + j]);
+          errors++;
+        }
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+done:
+  free(in);
+  free(pooled);
+  free(a);
+  free(b);
+  free(bias);
+  free(out);
+  free(out2);
+  free(feature);
+  free(weights);
+  free(operand);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x400000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Detection sized map split across the PDP line buffer alongside a
+    // transformer sized GEMM, the GEMM is a single tile that takes longer
+    // than the pooling
+    nna_pool_async(1280, 8, 16, 256, 512, 512);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
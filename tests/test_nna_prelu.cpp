@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Run a 3x3 convolution (pad 1) with a per kernel bias followed by PReLU with
+ * per channel slopes in X2, or by a leaky relu in Y, and compare bit exact to
+ * the CPU model of the SDP datapath.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define OUT_SHIFT 7
+#define BIAS_SHIFT 4
+#define MAX_TILES 64
+
+#define IN_OFFSET    0x000000
+#define OUT_OFFSET   0x080000
+#define WGT_OFFSET   0x100000
+#define BIAS_OFFSET  0x1F0000
+#define SLOPE_OFFSET 0x1F8000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+void nna_prelu_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k, float leaky) {
+
+  // A leaky slope of zero runs PReLU with random per channel slopes
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  printf ("Running test %s %dx%dx%d -> %d %s %.3f ...\n", __FUNCTION__, w, h, c, k,
+    leaky != 0.0f ? "leaky relu" : "prelu", leaky);
+
+  int8_t* hwc = (int8_t*)malloc(w * h * c);
+  int8_t* khwc = (int8_t*)malloc(k * 9 * c);
+  int16_t* bias = (int16_t*)malloc(k * sizeof(int16_t));
+  float* slope = (float*)malloc(k * sizeof(float));
+  int8_t* out = (int8_t*)malloc(w * h * k);
+
+  srand(w * h * c * k);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k * 9 * c; i++)
+    khwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k; i++) {
+    bias[i] = (rand() % 2048) - 1024;
+    slope[i] = (rand() % 1000) / 2000.0f;
+  }
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  int8_t* feature = (int8_t*)malloc(src.size > conv_surface.dst_data.size ? src.size : conv_surface.dst_data.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(k, 3, 3, c));
+  int16_t* bias_operand = (int16_t*)malloc(k * sizeof(int16_t) + 16);
+  int16_t* slope_operand = (int16_t*)malloc(k * sizeof(int16_t) + 16);
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  int weight_bytes = nna_pack_weights(khwc, k, 3, 3, c, weights);
+  dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+
+  sdp_op.x1_op.enable = 1;
+  sdp_op.x1_op.type = SDP_OP_ADD;
+  sdp_op.x1_op.alu_type = SDP_ALU_OP_SUM;
+  sdp_op.x1_op.mode = SDP_OP_PER_KERNEL;
+  sdp_op.x1_op.precision = PRECISION_INT16;
+  sdp_op.x1_op.shift_value = BIAS_SHIFT;
+  int operand_bytes = nna_pack_sdp_kernel(bias, 0, k, &sdp_op.x1_op, bias_operand);
+  dma_loadin((char*)bias_operand, operand_bytes, (uint32_t)(gp_paddr)+BIAS_OFFSET);
+  nna_sdp_operand_cube(&sdp_surface.x1_data, (uint32_t)(gp_paddr)+BIAS_OFFSET, &sdp_op.x1_op, w, h, k);
+
+  if (leaky != 0.0f) {
+    nna_leaky_relu_op(&sdp_op.y_op, leaky);
+  } else {
+    operand_bytes = nna_prelu_op(&sdp_op.x2_op, slope, k, slope_operand);
+    dma_loadin((char*)slope_operand, operand_bytes, (uint32_t)(gp_paddr)+SLOPE_OFFSET);
+    nna_sdp_operand_cube(&sdp_surface.x2_data, (uint32_t)(gp_paddr)+SLOPE_OFFSET, &sdp_op.x2_op, w, h, k);
+  }
+
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = OUT_SHIFT;
+
+  int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+  if (num_tiles < 0 || nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface)) {
+    printf("Failed to run convolution\n");
+  } else {
+    dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, out);
+
+    int errors = 0;
+    int negative = 0;
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        for (int kk = 0; kk < k; kk++) {
+          int32_t acc = 0;
+          for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+              int iy = y + ky - 1;
+              int ix = x + kx - 1;
+              if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                continue;
+              for (int ch = 0; ch < c; ch++)
+                acc += hwc[(iy * w + ix) * c + ch] * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+            }
+          }
+          int64_t v = nna_ref_sdp_x(&sdp_op.x1_op, acc, bias[kk], 0);
+          v = nna_ref_sdp_x(&sdp_op.x2_op, v, 0, slope_operand[kk]);
+          v = nna_ref_sdp_y(&sdp_op.y_op, v, 0, 0);
+          int32_t ref = nna_ref_sdp_out(&sdp_op, v);
+          negative += ref < 0;
+          if (ref != out[(y * w + x) * k + kk]) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d\n", y, x, kk, out[(y * w + x) * k + kk], ref);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d errors (%d negative outputs)\n", errors ? "FAILED" : "PASSED", errors, negative);
+  }
+
+  free(hwc);
+  free(khwc);
+  free(bias);
+  free(slope);
+  free(out);
+  free(feature);
+  free(weights);
+  free(bias_operand);
+  free(slope_operand);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x200000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    nna_prelu_conv(32, 32, 8, 16, 0.0f);
+    nna_prelu_conv(19, 11, 12, 24, 0.0f);
+    nna_prelu_conv(32, 32, 8, 16, 0.1f);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
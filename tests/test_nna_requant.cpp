@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Run a 3x3 convolution (pad 1) of a network quantised per channel with batch
+ * norm and relu, folded into the SDP X1/X2 operands by nna_fold_requant(), and
+ * compare to a float reference of the same layer. The output is allowed to
+ * differ by one from the reference due to the fixed point multipliers.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define MAX_TILES 64
+
+#define IN_OFFSET  0x000000
+#define OUT_OFFSET 0x080000
+#define WGT_OFFSET 0x100000
+#define X1_OFFSET  0x1F0000
+#define X2_OFFSET  0x1F8000
+
+#define IN_SCALE  0.02f
+#define OUT_SCALE 0.05f
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+static float frand(float lo, float hi) {
+  return lo + (hi - lo) * (rand() % 10000) / 10000.0f;
+}
+
+void nna_requant_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k, uint8_t bn, int16_t zp_out) {
+
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+  nna_requant_desc requant;
+
+  printf ("Running test %s %dx%dx%d -> %d%s zero point %d ...\n", __FUNCTION__, w, h, c, k,
+    bn ? " batch norm" : "", zp_out);
+
+  int8_t* hwc = (int8_t*)malloc(w * h * c);
+  int8_t* khwc = (int8_t*)malloc(k * 9 * c);
+  float* weight_scale = (float*)malloc(k * sizeof(float));
+  int32_t* bias = (int32_t*)malloc(k * sizeof(int32_t));
+  float* gamma = (float*)malloc(k * sizeof(float));
+  float* beta = (float*)malloc(k * sizeof(float));
+  float* mean = (float*)malloc(k * sizeof(float));
+  float* var = (float*)malloc(k * sizeof(float));
+  int8_t* out = (int8_t*)malloc(w * h * k);
+
+  // Per channel weight scales spanning a decade, as produced by per channel
+  // quantisation of a layer with very different kernel magnitudes
+  srand(w * h * c * k + bn);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k * 9 * c; i++)
+    khwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k; i++) {
+    weight_scale[i] = frand(0.0002f, 0.002f);
+    bias[i] = (rand() % 20000) - 10000;
+    gamma[i] = frand(0.5f, 2.0f);
+    beta[i] = frand(-1.0f, 1.0f);
+    mean[i] = frand(-0.5f, 0.5f);
+    var[i] = frand(0.5f, 4.0f);
+  }
+
+  memset(&requant, 0, sizeof(requant));
+  requant.k = k;
+  requant.in_scale = IN_SCALE;
+  requant.weight_scale = weight_scale;
+  requant.bias = bias;
+  if (bn) {
+    requant.bn_gamma = gamma;
+    requant.bn_beta = beta;
+    requant.bn_mean = mean;
+    requant.bn_var = var;
+    requant.bn_eps = 0.001f;
+  }
+  requant.out_scale = OUT_SCALE;
+  requant.out_zero_point = zp_out;
+  requant.act = ACTIVATION_RELU;
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  int8_t* feature = (int8_t*)malloc(src.size > conv_surface.dst_data.size ? src.size : conv_surface.dst_data.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(k, 3, 3, c));
+  int16_t* x1_operand = (int16_t*)malloc(k * sizeof(int16_t) + 16);
+  int16_t* x2_operand = (int16_t*)malloc(k * sizeof(int16_t) + 16);
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  int weight_bytes = nna_pack_weights(khwc, k, 3, 3, c, weights);
+  dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  int operand_bytes = nna_fold_requant(&requant, &sdp_op, x1_operand, x2_operand);
+  if (operand_bytes < 0) {
+    printf("Failed to fold requantisation\n");
+    goto done;
+  }
+  dma_loadin((char*)x1_operand, operand_bytes, (uint32_t)(gp_paddr)+X1_OFFSET);
+  dma_loadin((char*)x2_operand, operand_bytes, (uint32_t)(gp_paddr)+X2_OFFSET);
+
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+  nna_sdp_operand_cube(&sdp_surface.x1_data, (uint32_t)(gp_paddr)+X1_OFFSET, &sdp_op.x1_op, w, h, k);
+  nna_sdp_operand_cube(&sdp_surface.x2_data, (uint32_t)(gp_paddr)+X2_OFFSET, &sdp_op.x2_op, w, h, k);
+
+  {
+    int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+    if (num_tiles < 0 || nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface)) {
+      printf("Failed to run convolution\n");
+      goto done;
+    }
+  }
+
+  dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+  nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, out);
+
+  {
+    int errors = 0;
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        for (int kk = 0; kk < k; kk++) {
+          int32_t acc = bias[kk];
+          for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+              int iy = y + ky - 1;
+              int ix = x + kx - 1;
+              if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                continue;
+              for (int ch = 0; ch < c; ch++)
+                acc += hwc[(iy * w + ix) * c + ch] * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+            }
+          }
+          float real = acc * IN_SCALE * weight_scale[kk];
+          if (bn)
+            real = gamma[kk] * (real - mean[kk]) / sqrtf(var[kk] + 0.001f) + beta[kk];
+          real = real < 0.0f ? 0.0f : real;
+          int32_t ref = (int32_t)roundf(real / OUT_SCALE) + zp_out;
+          ref = ref > 127 ? 127 : (ref < -128 ? -128 : ref);
+          if (abs(ref - out[(y * w + x) * k + kk]) > 1) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d\n", y, x, kk, out[(y * w + x) * k + kk], ref);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+done:
+  free(hwc);
+  free(khwc);
+  free(weight_scale);
+  free(bias);
+  free(gamma);
+  free(beta);
+  free(mean);
+  free(var);
+  free(out);
+  free(feature);
+  free(weights);
+  free(x1_operand);
+  free(x2_operand);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x200000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    nna_requant_conv(32, 32, 16, 16, 0, -128);
+    nna_requant_conv(32, 32, 16, 32, 1, -128);
+    nna_requant_conv(19, 11, 12, 24, 1, 3);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
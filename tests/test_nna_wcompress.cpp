@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Run a pruned convolution with uncompressed and compressed weights, both
+ * are compared to a CPU reference and timed.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define ITERATIONS 20
+#define OUT_SHIFT 9
+#define MAX_TILES 64
+
+#define IN_OFFSET  0x000000
+#define OUT_OFFSET 0x080000
+#define WGT_OFFSET 0x100000
+#define WT_OFFSET  0x180000
+#define WMB_OFFSET 0x1F0000
+#define WGS_OFFSET 0x1FF000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int check_output(const int8_t* ref, nna_data_cube* dst, int8_t* feature, int8_t* out) {
+
+  dma_loadout(dst->address, dst->size, (char*)feature);
+  nna_unpack_feature(feature, dst, PRECISION_INT8, out);
+
+  int errors = 0;
+  for (uint32_t i = 0; i < (uint32_t)dst->width * dst->height * dst->channel; i++)
+    errors += ref[i] != out[i];
+
+  return errors;
+}
+
+void nna_wcompress_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k, uint8_t sparsity) {
+
+  // 3x3 convolution (pad 1) with sparsity percent of the weights set to zero
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  printf ("Running test %s %dx%dx%d 3x3x%d %d%% zeros ...\n", __FUNCTION__, w, h, c, k, sparsity);
+
+  uint32_t k_bytes = (uint32_t)k * 9 * c;
+  int8_t* hwc = (int8_t*)malloc(w * h * c);
+  int8_t* khwc = (int8_t*)malloc(k_bytes);
+  int8_t* ref = (int8_t*)malloc(w * h * k);
+  int8_t* out = (int8_t*)malloc(w * h * k);
+
+  srand(k_bytes + sparsity);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (rand() % 255) - 127;
+  for (uint32_t i = 0; i < k_bytes; i++)
+    khwc[i] = (rand() % 100) < sparsity ? 0 : (rand() % 255) - 127;
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      for (int kk = 0; kk < k; kk++) {
+        int32_t acc = 0;
+        for (int ky = 0; ky < 3; ky++) {
+          for (int kx = 0; kx < 3; kx++) {
+            int iy = y + ky - 1;
+            int ix = x + kx - 1;
+            if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+              continue;
+            for (int ch = 0; ch < c; ch++)
+              acc += hwc[(iy * w + ix) * c + ch] * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+          }
+        }
+        // Rounded half away from zero as the output converter does
+        ref[(y * w + x) * k + kk] = nna_ref_saturate(nna_ref_shift_right(acc, OUT_SHIFT), 8);
+      }
+    }
+  }
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = OUT_SHIFT;
+
+  int8_t* feature = (int8_t*)malloc(src.size > conv_surface.dst_data.size ? src.size :
+    conv_surface.dst_data.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(k, 3, 3, c));
+  int8_t* wt = (int8_t*)malloc(nna_weight_bytes(k, 3, 3, c));
+  uint8_t* wmb = (uint8_t*)malloc(nna_wmb_bytes(k, conv_op.bytes_per_kernel));
+  uint32_t* wgs = (uint32_t*)malloc((k + NNA_ATOMIC_K_SIZE - 1) / NNA_ATOMIC_K_SIZE * sizeof(uint32_t));
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  int weight_bytes = nna_pack_weights(khwc, k, 3, 3, c, weights);
+  dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+  uint32_t wmb_bytes = nna_wmb_bytes(k, conv_op.bytes_per_kernel);
+  int wt_bytes = nna_compress_weights(weights, k, conv_op.bytes_per_kernel, wt, wmb, wgs);
+  dma_loadin((char*)wt, wt_bytes, (uint32_t)(gp_paddr)+WT_OFFSET);
+  dma_loadin((char*)wmb, wmb_bytes, (uint32_t)(gp_paddr)+WMB_OFFSET);
+  dma_loadin((char*)wgs, (k + NNA_ATOMIC_K_SIZE - 1) / NNA_ATOMIC_K_SIZE * sizeof(uint32_t),
+    (uint32_t)(gp_paddr)+WGS_OFFSET);
+
+  // Uncompressed
+  int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+  double start = now_ms();
+  for (int i = 0; i < ITERATIONS && num_tiles > 0; i++)
+    nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface);
+  double plain_ms = (now_ms() - start) / ITERATIONS;
+  int plain_errors = num_tiles > 0 ? check_output(ref, &conv_surface.dst_data, feature, out) : -1;
+
+  // Compressed
+  conv_surface.weight_data.address = (uint32_t)(gp_paddr)+WT_OFFSET;
+  if (nna_conv_set_compressed(&conv_op, &conv_surface, wt_bytes, (uint32_t)(gp_paddr)+WMB_OFFSET,
+    wmb_bytes, (uint32_t)(gp_paddr)+WGS_OFFSET))
+    num_tiles = -1;
+  else
+    num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+
+  // Clear the output so a compressed run that does nothing is caught
+  memset(feature, 0, conv_surface.dst_data.size);
+  dma_loadin((char*)feature, conv_surface.dst_data.size, conv_surface.dst_data.address);
+  start = now_ms();
+  for (int i = 0; i < ITERATIONS && num_tiles > 0; i++)
+    nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface);
+  double compressed_ms = (now_ms() - start) / ITERATIONS;
+  int compressed_errors = num_tiles > 0 ? check_output(ref, &conv_surface.dst_data, feature, out) : -1;
+
+  printf("weights %d bytes, compressed %d + %d mask bytes\n", weight_bytes, wt_bytes, wmb_bytes);
+  printf("uncompressed %8.3f ms %d errors\n", plain_ms, plain_errors);
+  printf("compressed   %8.3f ms %d errors\n", compressed_ms, compressed_errors);
+  printf("%s\n", (plain_errors == 0 && compressed_errors == 0) ? "PASSED" : "FAILED");
+
+  free(hwc);
+  free(khwc);
+  free(ref);
+  free(out);
+  free(feature);
+  free(weights);
+  free(wt);
+  free(wmb);
+  free(wgs);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x200000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Pruning levels of production models on a large K layer
+    nna_wcompress_conv(28, 28, 64, 128, 50);
+    nna_wcompress_conv(28, 28, 64, 128, 70);
+    nna_wcompress_conv(14, 14, 128, 96, 70);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Probe for Winograd support then run a 3x3 convolution as direct and (when
+ * available) Winograd. The Winograd output is compared to a CPU model of
+ * F(2x2,3x3) using the same transformed weights so it should match exactly,
+ * the difference to direct convolution is from rounding the weights.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define ITERATIONS 20
+#define OUT_SHIFT 9
+#define MAX_TILES 64
+
+#define IN_OFFSET  0x000000
+#define OUT_OFFSET 0x080000
+#define WGT_OFFSET 0x100000
+#define PROBE_OFFSET 0x1F0000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+static int loadin(void* src, size_t size, int paddr) {
+  dma_loadin((char*)src, size, paddr);
+  return 0;
+}
+
+static void* loadout(int paddr, size_t size, void* dst) {
+  dma_loadout(paddr, size, (char*)dst);
+  return dst;
+}
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static inline int8_t requant(int32_t acc, uint8_t shift) {
+  // Rounded half away from zero as the output converter does
+  return nna_ref_saturate(nna_ref_shift_right(acc, shift), 8);
+}
+
+static int8_t winograd_weight(const int8_t* weights, uint16_t k, uint16_t c, uint16_t kk, int i,
+  int j, uint16_t ch) {
+
+  // Read a transformed weight back from the direct convolution layout
+  uint32_t bytes_per_kernel = 16 * c;
+  uint16_t kg = kk / NNA_ATOMIC_K_SIZE;
+  uint16_t kn = (k - kg * NNA_ATOMIC_K_SIZE) < NNA_ATOMIC_K_SIZE ? (k - kg * NNA_ATOMIC_K_SIZE) : NNA_ATOMIC_K_SIZE;
+  uint16_t cb = ch / NNA_ATOMIC_C_SIZE;
+  uint16_t cn = (c - cb * NNA_ATOMIC_C_SIZE) < NNA_ATOMIC_C_SIZE ? (c - cb * NNA_ATOMIC_C_SIZE) : NNA_ATOMIC_C_SIZE;
+
+  return weights[kg * NNA_ATOMIC_K_SIZE * bytes_per_kernel + cb * NNA_ATOMIC_C_SIZE * 16 * kn +
+    ((i * 4 + j) * kn + (kk % NNA_ATOMIC_K_SIZE)) * cn + ch % NNA_ATOMIC_C_SIZE];
+}
+
+void winograd_ref(const int8_t* hwc, const int8_t* weights, uint16_t w, uint16_t h, uint16_t c,
+  uint16_t k, uint8_t shift, int8_t* out) {
+
+  // F(2x2,3x3) with pad 1, Y = At.[sum over c of U . (Bt.d.B)].A
+  static const int8_t bt[4][4] = { {1, 0, -1, 0}, {0, 1, 1, 0}, {0, -1, 1, 0}, {0, 1, 0, -1} };
+  static const int8_t at[2][4] = { {1, 1, 1, 0}, {0, 1, -1, -1} };
+
+  for (uint16_t kk = 0; kk < k; kk++) {
+    for (int ty = 0; ty < h; ty += 2) {
+      for (int tx = 0; tx < w; tx += 2) {
+        int32_t m[4][4] = {};
+        for (uint16_t ch = 0; ch < c; ch++) {
+          int32_t d[4][4], t[4][4];
+          for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+              int y = ty - 1 + i;
+              int x = tx - 1 + j;
+              d[i][j] = (y < 0 || y >= h || x < 0 || x >= w) ? 0 : hwc[(y * w + x) * c + ch];
+            }
+          }
+          for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+              t[i][j] = bt[i][0] * d[0][j] + bt[i][1] * d[1][j] + bt[i][2] * d[2][j] + bt[i][3] * d[3][j];
+          for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+              m[i][j] += winograd_weight(weights, k, c, kk, i, j, ch) *
+                (t[i][0] * bt[j][0] + t[i][1] * bt[j][1] + t[i][2] * bt[j][2] + t[i][3] * bt[j][3]);
+        }
+        for (int i = 0; i < 2; i++) {
+          for (int j = 0; j < 2; j++) {
+            if (ty + i >= h || tx + j >= w)
+              continue;
+            int32_t y = 0;
+            for (int p = 0; p < 4; p++)
+              for (int q = 0; q < 4; q++)
+                y += at[i][p] * m[p][q] * at[j][q];
+            out[((ty + i) * w + tx + j) * k + kk] = requant(y, shift);
+          }
+        }
+      }
+    }
+  }
+}
+
+void direct_ref(const int8_t* hwc, const int8_t* khwc, uint16_t w, uint16_t h, uint16_t c,
+  uint16_t k, int8_t* out) {
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      for (int kk = 0; kk < k; kk++) {
+        int32_t acc = 0;
+        for (int ky = 0; ky < 3; ky++) {
+          for (int kx = 0; kx < 3; kx++) {
+            int iy = y + ky - 1;
+            int ix = x + kx - 1;
+            if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+              continue;
+            for (int ch = 0; ch < c; ch++)
+              acc += hwc[(iy * w + ix) * c + ch] * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+          }
+        }
+        out[(y * w + x) * k + kk] = requant(acc, OUT_SHIFT);
+      }
+    }
+  }
+}
+
+int run_conv(nna_conv_op_desc* conv_op, nna_conv_surface_desc* conv_surface, uint8_t truncate,
+  double* ms) {
+
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+
+  int num_tiles = nna_plan_conv(conv_op, conv_surface, tiles, MAX_TILES);
+  if (num_tiles < 0)
+    return -1;
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface->dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface->dst_data;
+
+  sdp_op.conv_mode = conv_op->conv_mode;
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = truncate;
+
+  double start = now_ms();
+  for (int i = 0; i < ITERATIONS; i++)
+    nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface);
+  *ms = (now_ms() - start) / ITERATIONS;
+
+  return num_tiles;
+}
+
+void nna_winograd_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k) {
+
+  // 3x3 convolution (pad 1) run as direct then Winograd
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  double direct_ms;
+  double winograd_ms;
+  uint8_t shift;
+
+  printf ("Running test %s %dx%dx%d -> %d ...\n", __FUNCTION__, w, h, c, k);
+
+  // Winograd output is rounded up to even width/height
+  uint32_t out_bytes = ((w + 1) & ~1) * ((h + 1) & ~1) * k;
+
+  int8_t* hwc = (int8_t*)malloc(w * h * c);
+  int8_t* khwc = (int8_t*)malloc(k * 9 * c);
+  int8_t* ref = (int8_t*)malloc(w * h * k);
+  int8_t* direct = (int8_t*)malloc(w * h * k);
+  int8_t* out = (int8_t*)malloc(out_bytes);
+
+  srand(w * h * c * k);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k * 9 * c; i++)
+    khwc[i] = (rand() % 255) - 127;
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+
+  int8_t* feature = (int8_t*)malloc(src.size > out_bytes ? src.size : out_bytes);
+  int8_t* weights = (int8_t*)malloc(k * 16 * c + 32);
+
+  nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  // Direct convolution
+  direct_ref(hwc, khwc, w, h, c, k, ref);
+
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  int weight_bytes = nna_pack_weights(khwc, k, 3, 3, c, weights);
+  dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+  if (run_conv(&conv_op, &conv_surface, OUT_SHIFT, &direct_ms) < 0) {
+    printf("Failed to plan direct convolution\n");
+    goto done;
+  }
+
+  {
+    dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, direct);
+
+    int errors = 0;
+    for (int i = 0; i < w * h * k; i++)
+      errors += direct[i] != ref[i];
+    printf("direct   %8.3f ms %s %d errors\n", direct_ms, errors ? "FAILED" : "PASSED", errors);
+  }
+
+  // Winograd, same op switched over
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  if (nna_conv_set_winograd(&conv_op, &conv_surface)) {
+    printf("winograd not used, op left as direct convolution\n");
+    goto done;
+  }
+
+  weight_bytes = nna_pack_weights_winograd(khwc, k, c, weights, &shift);
+  if (weight_bytes < 0)
+    goto done;
+  dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+  // Accumulators are 4 / 2^shift times the direct ones
+  winograd_ref(hwc, weights, w, h, c, k, OUT_SHIFT + 2 - shift, ref);
+
+  if (run_conv(&conv_op, &conv_surface, OUT_SHIFT + 2 - shift, &winograd_ms) < 0) {
+    printf("Failed to plan winograd convolution\n");
+    goto done;
+  }
+
+  {
+    dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, out);
+
+    // Compare the requested output area, the odd row/column is dropped
+    int errors = 0;
+    int max_diff = 0;
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        for (int kk = 0; kk < k; kk++) {
+          int8_t v = out[(y * conv_surface.dst_data.width + x) * k + kk];
+          errors += v != ref[(y * w + x) * k + kk];
+          max_diff = abs(v - direct[(y * w + x) * k + kk]) > max_diff ?
+            abs(v - direct[(y * w + x) * k + kk]) : max_diff;
+        }
+      }
+    }
+    printf("winograd %8.3f ms %s %d errors (weight shift %d, max diff to direct %d)\n",
+      winograd_ms, errors ? "FAILED" : "PASSED", errors, shift, max_diff);
+  }
+
+done:
+  free(hwc);
+  free(khwc);
+  free(ref);
+  free(direct);
+  free(out);
+  free(feature);
+  free(weights);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x200000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    // Probe in the memory after the weights
+    nna_mem_io io = { loadin, loadout };
+    nna_winograd_probe((uint32_t)(gp_paddr)+PROBE_OFFSET, &io);
+
+    // Even and odd sized layers
+    nna_winograd_conv(56, 56, 64, 64);
+    nna_winograd_conv(28, 28, 128, 128);
+    nna_winograd_conv(15, 13, 32, 48);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Run a 3x3 convolution (pad 1) of an asymmetric quantised input with full
+ * range weights. The input zero point is removed either by padding with it
+ * and folding the weight sum correction into the bias (split over the X1
+ * shift_value when it exceeds int16) or by the CDMA input converter with zero
+ * padding. uint8 inputs are packed as int8 with 128 subtracted. The output
+ * zero point is added by the SDP output converter, the result should match a
+ * CPU reference exactly.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hw_adaptor.h"
+#include "mem_ctrl.h"
+
+#include "nna_hw.h"
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+#include "nna_plan.h"
+
+#define OUT_SHIFT 12
+#define MAX_TILES 64
+
+#define IN_OFFSET   0x000000
+#define OUT_OFFSET  0x080000
+#define WGT_OFFSET  0x100000
+#define BIAS_OFFSET 0x1F0000
+
+static void* gp_vaddr;
+static void* gp_paddr;
+
+static nna_conv_tile tiles[MAX_TILES];
+
+void nna_zero_point_conv(uint16_t w, uint16_t h, uint16_t c, uint16_t k, int16_t zp_in, int16_t zp_out,
+  uint8_t is_uint8, uint8_t in_cvt) {
+
+  nna_data_cube src;
+  nna_conv_op_desc conv_op;
+  nna_conv_surface_desc conv_surface;
+  nna_sdp_op_desc sdp_op;
+  nna_sdp_surface_desc sdp_surface;
+  nna_sdp_op bias_op;
+
+  printf ("Running test %s %dx%dx%d -> %d %s zero points %d/%d%s ...\n", __FUNCTION__, w, h, c, k,
+    is_uint8 ? "uint8" : "int8", zp_in, zp_out, in_cvt ? " input converter" : "");
+
+  uint8_t* hwc = (uint8_t*)malloc(w * h * c);
+  int8_t* khwc = (int8_t*)malloc(k * 9 * c);
+  int32_t* bias = (int32_t*)malloc(k * sizeof(int32_t));
+  int16_t* bias16 = (int16_t*)malloc(k * sizeof(int16_t));
+  int8_t* out = (int8_t*)malloc(w * h * k);
+
+  srand(w * h * c * k + zp_in);
+  for (int i = 0; i < w * h * c; i++)
+    hwc[i] = is_uint8 ? rand() % 256 : (uint8_t)((rand() % 255) - 127);
+  for (int i = 0; i < k * 9 * c; i++)
+    khwc[i] = (rand() % 255) - 127;
+  for (int i = 0; i < k; i++)
+    bias[i] = (rand() % 65536) - 32768;
+
+  // Zero point of the int8 values the NNA reads
+  int16_t zp = is_uint8 ? zp_in - 128 : zp_in;
+
+  nna_feature_cube(&src, (uint32_t)(gp_paddr)+IN_OFFSET, w, h, c, PRECISION_INT8);
+  nna_conv_setup(&conv_op, &conv_surface, &src, (uint32_t)(gp_paddr)+WGT_OFFSET, k, 3, 3, 1, 1, 1);
+  conv_surface.dst_data.address = (uint32_t)(gp_paddr)+OUT_OFFSET;
+
+  if (in_cvt) {
+    // Converted inputs are real values, padded with zero
+    conv_op.in_cvt.enable = 1;
+    conv_op.in_cvt.offset = zp;
+    conv_op.in_cvt.scale = 1;
+    conv_op.in_cvt.truncate = 0;
+  } else {
+    // Padded elements are the real value zero
+    conv_op.pad_value = zp;
+  }
+
+  int8_t* feature = (int8_t*)malloc(src.size > conv_surface.dst_data.size ? src.size : conv_surface.dst_data.size);
+  int8_t* weights = (int8_t*)malloc(nna_weight_bytes(k, 3, 3, c));
+  int16_t* operand = (int16_t*)malloc(k * sizeof(int16_t) + 16);
+
+  if (is_uint8)
+    nna_pack_feature_uint8(hwc, &src, feature);
+  else
+    nna_pack_feature(hwc, &src, PRECISION_INT8, feature);
+  dma_loadin((char*)feature, src.size, src.address);
+
+  int weight_bytes = nna_pack_weights(khwc, k, 3, 3, c, weights);
+  dma_loadin((char*)weights, weight_bytes, conv_surface.weight_data.address);
+
+  // Bias with the zero point correction unless the converter removes it
+  int shift = nna_zero_point_bias(khwc, k, 3, 3, c, in_cvt ? 0 : zp, bias, bias16);
+  if (shift < 0) {
+    printf("Failed to correct the bias\n");
+    goto done;
+  }
+
+  memset(&bias_op, 0, sizeof(bias_op));
+  bias_op.type = SDP_OP_ADD;
+  bias_op.precision = PRECISION_INT16;
+
+  {
+    int operand_bytes = nna_pack_sdp_kernel(bias16, 0, k, &bias_op, operand);
+    dma_loadin((char*)operand, operand_bytes, (uint32_t)(gp_paddr)+BIAS_OFFSET);
+  }
+
+  memset(&sdp_op, 0, sizeof(sdp_op));
+  memset(&sdp_surface, 0, sizeof(sdp_surface));
+
+  sdp_surface.src_data = conv_surface.dst_data;
+  sdp_surface.src_data.address = 0; // Input is from conv hw
+  sdp_surface.dst_data = conv_surface.dst_data;
+
+  sdp_op.x1_op.enable = 1;
+  sdp_op.x1_op.type = SDP_OP_ADD;
+  sdp_op.x1_op.alu_type = SDP_ALU_OP_SUM;
+  sdp_op.x1_op.mode = SDP_OP_PER_KERNEL;
+  sdp_op.x1_op.precision = PRECISION_INT16;
+  sdp_op.x1_op.shift_value = shift;
+  nna_sdp_operand_cube(&sdp_surface.x1_data, (uint32_t)(gp_paddr)+BIAS_OFFSET, &sdp_op.x1_op, w, h, k);
+
+  sdp_op.out_cvt.scale = 1;
+  sdp_op.out_cvt.truncate = OUT_SHIFT;
+  nna_cvt_zero_point(&sdp_op.out_cvt, zp_out);
+
+  {
+    int num_tiles = nna_plan_conv(&conv_op, &conv_surface, tiles, MAX_TILES);
+    if (num_tiles < 0 || nna_run_conv_tiles(tiles, num_tiles, &sdp_op, &sdp_surface)) {
+      printf("Failed to run convolution\n");
+      goto done;
+    }
+  }
+
+  {
+    dma_loadout(conv_surface.dst_data.address, conv_surface.dst_data.size, (char*)feature);
+    nna_unpack_feature(feature, &conv_surface.dst_data, PRECISION_INT8, out);
+
+    int errors = 0;
+    for (int kk = 0; kk < k; kk++) {
+      // The bias the hardware adds, with the correction taken back out it
+      // must be within the operand rounding of the real bias
+      int64_t sum = 0;
+      for (int i = 0; i < 9 * c; i++)
+        sum += khwc[kk * 9 * c + i];
+      int64_t hw_bias = ((int64_t)bias16[kk] << shift) + (in_cvt ? 0 : zp * sum);
+      if (llabs(hw_bias - bias[kk]) > (shift ? 1 << (shift - 1) : 0)) {
+        if (errors < 8)
+          printf("bias[%d] %lld expected %d\n", kk, (long long)hw_bias, bias[kk]);
+        errors++;
+      }
+
+      for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+          // Real values are q - zero point, padding contributes nothing
+          int64_t acc = hw_bias;
+          for (int ky = 0; ky < 3; ky++) {
+            for (int kx = 0; kx < 3; kx++) {
+              int iy = y + ky - 1;
+              int ix = x + kx - 1;
+              if (iy < 0 || iy >= h || ix < 0 || ix >= w)
+                continue;
+              for (int ch = 0; ch < c; ch++) {
+                int32_t q = is_uint8 ? hwc[(iy * w + ix) * c + ch] - 128 : (int8_t)hwc[(iy * w + ix) * c + ch];
+                // The input converter saturates to int8
+                int32_t v = in_cvt ? nna_ref_saturate(q - zp, 8) : q - zp;
+                acc += v * khwc[((kk * 3 + ky) * 3 + kx) * c + ch];
+              }
+            }
+          }
+          // Rounded half away from zero as the output converter does
+          acc = nna_ref_saturate(nna_ref_shift_right(acc, OUT_SHIFT) + zp_out, 8);
+          if (acc != out[(y * w + x) * k + kk]) {
+            if (errors < 8)
+              printf("out[%d][%d][%d] %d expected %d\n", y, x, kk, out[(y * w + x) * k + kk], (int)acc);
+            errors++;
+          }
+        }
+      }
+    }
+    printf("%s %d errors\n", errors ? "FAILED" : "PASSED", errors);
+  }
+
+done:
+  free(hwc);
+  free(khwc);
+  free(bias);
+  free(bias16);
+  free(out);
+  free(feature);
+  free(weights);
+  free(operand);
+}
+
+int main(int argc, char **argv) {
+
+  hw_init();
+
+  // Set clock to 400Mhz
+  nna_configure(nna_cmd_clk, 400);
+
+  // Turn on NNA
+  nna_on();
+
+  // Map NNA registers
+  void* r = xreg_open();
+  if (r) {
+    printf("xreg_open ok\n");
+
+    void* tmp_paddr;
+    void* tmp_vaddr;
+
+    dma_mem_alloc(0x200000, (&tmp_vaddr), (&tmp_paddr));
+    gp_paddr = tmp_paddr;
+    gp_vaddr = tmp_vaddr;
+
+    nna_reset();
+
+    nna_zero_point_conv(32, 32, 8, 16, 0, 0, 0, 0);
+    nna_zero_point_conv(32, 32, 8, 16, -20, 5, 0, 0);
+    nna_zero_point_conv(19, 11, 12, 24, 17, -12, 0, 0);
+
+    // uint8 images with the usual zero points
+    nna_zero_point_conv(32, 32, 8, 16, 128, 0, 1, 0);
+    nna_zero_point_conv(19, 11, 12, 24, 3, -12, 1, 0);
+
+    // Zero point removed by the CDMA input converter
+    nna_zero_point_conv(32, 32, 8, 16, -20, 5, 0, 1);
+    nna_zero_point_conv(19, 11, 12, 24, 128, 7, 1, 1);
+
+    dma_mem_free(gp_vaddr);
+    xreg_close();
+  }
+
+  nna_off();
+
+  hw_deinit();
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2021  Jasbir Matharu, <jasknuj@gmail.com>
+ *
+ * This file is part of v381-nna.
+ *
+ * v381-nna is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+
+ * v381-nna is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with v381-nna.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Host tool that calibrates the SDP shifts of the cifar10 example with the
+ * bit exact CPU model of the conv + SDP datapath and compares them to the hand
+ * tuned values copied from CMSIS-NN.
+ *
+ * The real scale of each layer is taken from the hand tuned network (input
+ * steps of 1, bias << BIAS_LSHIFT in accumulator steps, output steps of
+ * 2^OUT_RSHIFT) so both compute the same function, the calibrated shifts just
+ * follow the range seen over the calibration set. By default only power of
+ * two shifts are chosen as in the example, -s also chooses converter scales.
+ * Each layer prints its rescaled bias array with the shifts, the shifts only
+ * apply to that array and not to the hand tuned one.
+ *
+ * Usage: nna_calibrate [-s] [image ...]
+ *
+ * Each image file is 32x32x3 int8 HWC converted as described in
+ * nna_cifar10_image.h, without any the image built into the example is used.
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nna_config.h"
+#include "nna_interface.h"
+#include "nna_pack.h"
+
+#include "nna_cifar10_weights.h"
+#include "nna_cifar10_image.h"
+
+#define IMAGE_DIM 32
+#define IMAGE_CH 3
+#define IMAGE_BYTES (IMAGE_DIM * IMAGE_DIM * IMAGE_CH)
+#define MAX_IMAGES 256
+#define MAX_LAYER_BYTES (32 * 32 * 32) // Largest layer input/output
+#define NUM_LAYERS 4
+#define NUM_CLASSES 10
+
+struct cifar10_layer {
+  const char* name;
+  uint16_t in_dim;
+  uint16_t in_ch;
+  uint16_t out_ch;
+  uint8_t ker_dim;
+  uint8_t pad;
+  uint8_t relu_pool;
+  const int8_t* weights; // NNA direct layout
+  const int16_t* bias;
+  uint8_t bias_lshift;
+  uint8_t out_rshift;
+};
+
+static int8_t image_data[8 * 32 * 32] = IMG_DATA;
+
+static char labels[][13] = {"airplane","automobile","bird","cat","deer","dog","frog","horse","ship","truck"};
+
+static int8_t conv1_wt[3 * 5 * 5 * 32] = CONV1_WT;
+static int16_t conv1_bias[32] = CONV1_BIAS;
+static int8_t conv2_wt[16 * 5 * 5 * 32] = CONV2_WT;
+static int16_t conv2_bias[16] = CONV2_BIAS;
+static int8_t conv3_wt[16 * 5 * 5 * 32] = CONV3_WT;
+static int16_t conv3_bias[32] = CONV3_BIAS;
+static int8_t conv4_wt[32 * 4 * 4 * 10] = CONV4_WT;
+static int16_t conv4_bias[10] = CONV4_BIAS;
+
+// Shapes and hand tuned shifts of nna_cifar10.cpp
+static cifar10_layer layers[NUM_LAYERS] = {
+  { "CONV1", 32,  3, 32, 5, 2, 1, conv1_wt, conv1_bias, 6, 9 },
+  { "CONV2", 16, 32, 16, 5, 2, 1, conv2_wt, conv2_bias, 4, 9 },
+  { "CONV3",  8, 16, 32, 5, 2, 1, conv3_wt, conv3_bias, 1, 7 },
+  { "CONV4",  4, 32, 10, 4, 0, 0, conv4_wt, conv4_bias, 1, 8 },
+};
+
+static void unpack_weights(const int8_t* weights, uint16_t k, uint8_t k_w, uint8_t k_h, uint16_t c,
+  int8_t* khwc) {
+
+  // Inverse of nna_pack_weights(), kernel groups of C'->K->W->H->C
+  for (uint16_t kg = 0; kg < k; kg += NNA_ATOMIC_K_SIZE) {
+    uint16_t kn = (k - kg) < NNA_ATOMIC_K_SIZE ? (k - kg) : NNA_ATOMIC_K_SIZE;
+    for (uint16_t cb = 0; cb < c; cb += NNA_ATOMIC_C_SIZE) {
+      uint16_t cn = (c - cb) < NNA_ATOMIC_C_SIZE ? (c - cb) : NNA_ATOMIC_C_SIZE;
+      for (uint8_t h = 0; h < k_h; h++) {
+        for (uint8_t w = 0; w < k_w; w++) {
+          for (uint16_t kk = kg; kk < kg + kn; kk++) {
+            memcpy(khwc + (((uint32_t)kk * k_h + h) * k_w + w) * c + cb, weights, cn);
+            weights += cn;
+          }
+        }
+      }
+    }
+  }
+}
+
+static int load_images(int argc, char** argv, int first, int8_t* images) {
+
+  int num_images = 0;
+
+  for (int i = first; i < argc && num_images < MAX_IMAGES; i++) {
+    FILE* f = fopen(argv[i], "rb");
+    if (!f) {
+      printf("Can't open %s\n", argv[i]);
+      continue;
+    }
+    if (fread(images + num_images * IMAGE_BYTES, 1, IMAGE_BYTES, f) == IMAGE_BYTES)
+      num_images++;
+    else
+      printf("%s is not a 32x32x3 image\n", argv[i]);
+    fclose(f);
+  }
+
+  // Built in image is in feature layout, 8 channels per pixel
+  if (!num_images) {
+    for (int p = 0; p < IMAGE_DIM * IMAGE_DIM; p++)
+      memcpy(images + p * IMAGE_CH, image_data + p * NNA_ATOMIC_C_SIZE, IMAGE_CH);
+    num_images = 1;
+  }
+
+  return num_images;
+}
+
+int main(int argc, char **argv) {
+
+  int first = 1;
+  uint8_t scales = 0;
+
+  if (argc > 1 && !strcmp(argv[1], "-s")) {
+    scales = 1;
+    first++;
+  }
+
+  int8_t* images = (int8_t*)malloc(MAX_IMAGES * IMAGE_BYTES);
+  int num_images = load_images(argc, argv, first, images);
+
+  // Calibrated and hand tuned networks each feed their own outputs forward
+  int8_t* in = (int8_t*)malloc(num_images * MAX_LAYER_BYTES);
+  int8_t* hand_in = (int8_t*)malloc(num_images * MAX_LAYER_BYTES);
+  memcpy(in, images, num_images * IMAGE_BYTES);
+  memcpy(hand_in, images, num_images * IMAGE_BYTES);
+
+  float in_scale = 1.0f;
+  float hand_scale = 1.0f;
+
+  printf("Calibrating cifar10 over %d image(s)\n\n", num_images);
+
+  for (int l = 0; l < NUM_LAYERS; l++) {
+    cifar10_layer* cl = &layers[l];
+    nna_calib_layer layer;
+    nna_calib_result result;
+    nna_calib_result hand;
+
+    int8_t* khwc = (int8_t*)malloc(cl->out_ch * cl->ker_dim * cl->ker_dim * cl->in_ch);
+    float* bias = (float*)malloc(cl->out_ch * sizeof(float));
+
+    unpack_weights(cl->weights, cl->out_ch, cl->ker_dim, cl->ker_dim, cl->in_ch, khwc);
+    for (int k = 0; k < cl->out_ch; k++)
+      bias[k] = (float)(cl->bias[k] << cl->bias_lshift) * hand_scale;
+
+    memset(&layer, 0, sizeof(layer));
+    layer.in_w = cl->in_dim;
+    layer.in_h = cl->in_dim;
+    layer.in_c = cl->in_ch;
+    layer.k = cl->out_ch;
+    layer.k_w = cl->ker_dim;
+    layer.k_h = cl->ker_dim;
+    layer.stride = 1;
+    layer.pad = cl->pad;
+    layer.khwc = khwc;
+    layer.weight_scale = 1.0f;
+    layer.bias = bias;
+    layer.act = cl->relu_pool ? ACTIVATION_RELU : ACTIVATION_NONE;
+    layer.pool = cl->relu_pool ? 3 : 0;
+    layer.pool_stride = cl->relu_pool ? 2 : 0;
+    layer.pow2 = !scales;
+
+    memset(&result, 0, sizeof(result));
+    result.bias = (int16_t*)malloc(cl->out_ch * sizeof(int16_t));
+
+    memset(&hand, 0, sizeof(hand));
+    hand.bias = (int16_t*)cl->bias;
+    hand.bias_shift = cl->bias_lshift;
+    hand.out_cvt.scale = 1;
+    hand.out_cvt.truncate = cl->out_rshift;
+
+    int8_t* out = (int8_t*)malloc(num_images * MAX_LAYER_BYTES);
+    int8_t* hand_out = (int8_t*)malloc(num_images * MAX_LAYER_BYTES);
+
+    if (nna_calibrate_layer(&layer, in_scale, in, num_images, &result, out) ||
+      nna_calib_eval(&layer, hand_in, num_images, &hand, hand_out)) {
+      printf("%s failed\n", cl->name);
+      return 1;
+    }
+
+    printf("%s max %lld saturated %u, hand tuned bias << %d, out >> %d max %lld saturated %u\n",
+      cl->name, (long long)result.max_abs, result.saturated, cl->bias_lshift, cl->out_rshift,
+      (long long)hand.max_abs, hand.saturated);
+    // The bias is rescaled to the calibrated shift, so it replaces the
+    // hand tuned array of nna_cifar10_weights.h together with the shifts
+    printf("#define %s_BIAS {", cl->name);
+    for (int k = 0; k < cl->out_ch; k++)
+      printf("%s%d", k ? "," : "", result.bias[k]);
+    printf("}\n");
+    printf("#define %s_BIAS_LSHIFT %d\n", cl->name, result.bias_shift);
+    printf("#define %s_OUT_RSHIFT %d\n", cl->name, result.out_cvt.truncate);
+    if (scales)
+      printf("#define %s_OUT_SCALE %d\n", cl->name, result.out_cvt.scale);
+    printf("\n");
+
+    in_scale = result.out_scale;
+    hand_scale *= (float)(1 << cl->out_rshift);
+
+    memcpy(in, out, num_images * result.pool_w * result.pool_h * cl->out_ch);
+    memcpy(hand_in, hand_out, num_images * result.pool_w * result.pool_h * cl->out_ch);
+
+    free(khwc);
+    free(bias);
+    free(result.bias);
+    free(out);
+    free(hand_out);
+  }
+
+  // Both networks should classify the set the same way
+  for (int i = 0; i < num_images; i++) {
+    int best = 0;
+    int hand_best = 0;
+    for (int c = 1; c < NUM_CLASSES; c++) {
+      best = in[i * NUM_CLASSES + c] > in[i * NUM_CLASSES + best] ? c : best;
+      hand_best = hand_in[i * NUM_CLASSES + c] > hand_in[i * NUM_CLASSES + hand_best] ? c : hand_best;
+    }
+    printf("image %d : %-12s (hand tuned %s)\n", i, labels[best], labels[hand_best]);
+  }
+
+  free(images);
+  free(in);
+  free(hand_in);
+  return 0;
+}